@@ -0,0 +1,492 @@
+//
+// Loopback benchmarks of the TCP, UDP and accept paths, results as JSON
+//
+
+#include "ConnectionHandler.hpp"
+#include "HostPort.hpp"
+#include "Metrics.hpp"
+#include "TcpServer.hpp"
+#include "UdpServerN.hpp"
+#include "Writer.hpp"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    using Clock = std::chrono::steady_clock;
+
+    constexpr std::size_t MESSAGE_SIZE  = 64;
+    constexpr std::size_t BULK_CHUNK    = 64 * 1024;
+    constexpr std::size_t UDP_BATCH     = 64;
+    constexpr std::size_t ACCEPT_CLIENTS = 4;
+
+    // Every client connection ends in TIME_WAIT, this keeps a run from
+    // exhausting the ephemeral ports
+    constexpr uint64_t MAX_CONNECTIONS = 10000;
+
+    struct Options {
+        std::string scenario;                    // Empty runs all of them
+        std::chrono::milliseconds duration {2000};
+        int port = 9200;
+        std::string output;                      // Empty prints to stdout
+    };
+
+    struct Result {
+        std::string scenario;
+        std::string operation;                   // What one operation and its latency stand for
+        uint64_t operations = 0;
+        uint64_t bytes = 0;
+        double seconds = 0;
+        double cpuSeconds = 0;
+        std::vector<double> latenciesUs;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Measurement helpers
+    // -----------------------------------------------------------------------------------------------------------------
+
+    // User and system time of the whole process, server threads included
+    double cpuSeconds() {
+
+        rusage usage {};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+               usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    }
+
+    double elapsedUs(Clock::time_point since) {
+
+        return std::chrono::duration<double, std::micro>(Clock::now() - since).count();
+    }
+
+    double percentile(const std::vector<double> &sorted, double q) {
+
+        if(sorted.empty()) {
+            return 0;
+        }
+        std::size_t index = static_cast<std::size_t>(q * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    // Times a scenario body, it fills in operations, bytes and latencies
+    Result measure(const std::string &scenario, const std::string &operation, const std::function<void(Result &)> &body) {
+
+        Result result;
+        result.scenario  = scenario;
+        result.operation = operation;
+
+        double cpuBefore = cpuSeconds();
+        auto started = Clock::now();
+
+        body(result);
+
+        result.seconds    = std::chrono::duration<double>(Clock::now() - started).count();
+        result.cpuSeconds = cpuSeconds() - cpuBefore;
+        return result;
+    }
+
+    void waitFor(const std::function<bool()> &done, std::chrono::milliseconds limit) {
+
+        auto deadline = Clock::now() + limit;
+        while(!done() && Clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Handlers
+    // -----------------------------------------------------------------------------------------------------------------
+
+    class QuietHandler : public nettle::TcpConnectionHandler {
+
+    public:
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newConnection(nettle::Socket connection) override { }
+    };
+
+    class EchoHandler : public QuietHandler {
+
+    public:
+        bool connectionReady(nettle::Socket &connection) override {
+
+            char buffer[4096];
+            nettle::IoResult read = connection.readSome(buffer, sizeof(buffer));
+            if(read.bytes == 0) {
+                return false;
+            }
+            return connection.socketWriteOut(buffer, static_cast<int>(read.bytes)) > 0;
+        }
+    };
+
+    class SinkHandler : public QuietHandler {
+
+    public:
+        std::atomic<uint64_t> received {0};
+
+        void newConnection(nettle::Socket connection) override {
+
+            std::vector<uint8_t> buffer(BULK_CHUNK);
+            while(true) {
+                nettle::IoResult read = connection.readSome(buffer.data(), buffer.size());
+                received += read.bytes;
+
+                if(read.status == nettle::IoStatus::CLOSED || read.status == nettle::IoStatus::FAILED) {
+                    break;
+                }
+            }
+        }
+    };
+
+    class CountingDatagramHandler : public nettle::UdpConnectionHandlerN<MESSAGE_SIZE> {
+
+    public:
+        std::atomic<uint64_t> received {0};
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newData(uint8_t data[MESSAGE_SIZE]) override {
+
+            received++;
+        }
+
+        void newBatch(std::span<const nettle::Datagram> batch) override {
+
+            received += batch.size();
+        }
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Scenarios
+    // -----------------------------------------------------------------------------------------------------------------
+
+    Result tcpRequestResponse(const Options &options, int port) {
+
+        nettle::HostPort hp("127.0.0.1", port);
+        EchoHandler handler;
+
+        nettle::TcpServerConfig config;
+        config.mode   = nettle::TcpServeMode::EVENT_LOOP;
+        config.tuning = nettle::TuningProfile::lowLatency();
+
+        nettle::TcpServer server(hp, handler, config);
+        server.serve();
+
+        nettle::Writer writer(hp, nettle::WriterType::TCP, nettle::ErrorSink, nettle::TuningProfile::lowLatency());
+
+        Result result = measure("tcp_request_response", "64 byte request echoed back", [&](Result &result) {
+
+            char request[MESSAGE_SIZE] = {};
+            char reply[MESSAGE_SIZE];
+            auto deadline = Clock::now() + options.duration;
+
+            while(Clock::now() < deadline && !writer.hasError()) {
+                auto started = Clock::now();
+                if(writer.socketWriteOut(request, MESSAGE_SIZE) <= 0 ||
+                   writer.socketReadIn(reply, MESSAGE_SIZE) != static_cast<int>(MESSAGE_SIZE)) {
+                    break;
+                }
+                result.latenciesUs.push_back(elapsedUs(started));
+                result.operations++;
+                result.bytes += 2 * MESSAGE_SIZE;
+            }
+        });
+
+        server.stop();
+        return result;
+    }
+
+    Result tcpBulk(const Options &options, int port) {
+
+        nettle::HostPort hp("127.0.0.1", port);
+        SinkHandler handler;
+
+        nettle::TcpServerConfig config;
+        config.tuning = nettle::TuningProfile::bulkThroughput();
+        config.tuning.deferAcceptSec.reset();
+
+        nettle::TcpServer server(hp, handler, config);
+        server.serve();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        Result result = measure("tcp_bulk", "64 KiB write, the run ends once the server read everything", [&](Result &result) {
+
+            std::vector<uint8_t> chunk(BULK_CHUNK, 'b');
+            {
+                nettle::Writer writer(hp, nettle::WriterType::TCP, nettle::ErrorSink, nettle::TuningProfile::bulkThroughput());
+                auto deadline = Clock::now() + options.duration;
+
+                while(Clock::now() < deadline && !writer.hasError()) {
+                    auto started = Clock::now();
+                    nettle::IoResult sent = writer.writeSome(chunk.data(), chunk.size());
+                    if(sent.status != nettle::IoStatus::COMPLETE && sent.status != nettle::IoStatus::PARTIAL) {
+                        break;
+                    }
+                    result.latenciesUs.push_back(elapsedUs(started));
+                    result.operations++;
+                    result.bytes += sent.bytes;
+                }
+            }
+
+            waitFor([&] { return handler.received.load() >= result.bytes; }, std::chrono::seconds(10));
+        });
+
+        server.stop();
+        return result;
+    }
+
+    Result udpPacketsPerSecond(const Options &options, int port) {
+
+        nettle::HostPort hp("127.0.0.1", port);
+        CountingDatagramHandler handler;
+
+        nettle::UdpServerConfig config;
+        config.batchSize = UDP_BATCH;
+        config.tuning.recvBuffer = 8 * 1024 * 1024;
+
+        nettle::UdpServerN<MESSAGE_SIZE> server(hp, handler, config);
+        server.serve();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        nettle::Writer writer(hp, nettle::WriterType::UDP);
+
+        Result result = measure("udp_pps", "sendmmsg of 64 datagrams of 64 bytes, operations are datagrams received", [&](Result &result) {
+
+            uint8_t payload[MESSAGE_SIZE] = {};
+            std::vector<nettle::OutboundDatagram> batch(UDP_BATCH, nettle::OutboundDatagram{payload, MESSAGE_SIZE});
+            auto deadline = Clock::now() + options.duration;
+
+            while(Clock::now() < deadline && !writer.hasError()) {
+                auto started = Clock::now();
+                writer.sendBatch(batch);
+                result.latenciesUs.push_back(elapsedUs(started));
+            }
+
+            // Loopback drops what the receiver can't keep up with, only arrivals count
+            uint64_t last;
+            do {
+                last = handler.received.load();
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            } while(handler.received.load() != last);
+
+            result.operations = handler.received.load();
+            result.bytes = result.operations * MESSAGE_SIZE;
+        });
+
+        server.stop();
+        return result;
+    }
+
+    Result tcpAccept(const Options &options, int port) {
+
+        nettle::HostPort hp("127.0.0.1", port);
+        QuietHandler handler;
+
+        nettle::TcpServerConfig config;
+        config.maxPendingRequests = 1024;
+
+        nettle::TcpServer server(hp, handler, config);
+        server.serve();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        uint64_t acceptedBefore = server.metrics().get(nettle::Counter::ACCEPTS);
+
+        Result result = measure("tcp_accept", "connect and close by one of 4 clients, operations are accepts", [&](Result &result) {
+
+            std::atomic<uint64_t> attempts {0};
+            std::vector<std::vector<double>> latencies(ACCEPT_CLIENTS);
+            std::vector<std::thread> clients;
+            auto deadline = Clock::now() + options.duration;
+
+            for(std::size_t i = 0; i < ACCEPT_CLIENTS; i++) {
+                clients.emplace_back([&, i] {
+                    while(Clock::now() < deadline && attempts++ < MAX_CONNECTIONS) {
+                        auto started = Clock::now();
+                        nettle::Writer writer(hp, nettle::WriterType::TCP, [](nettle::SocketError) { });
+                        if(writer.hasError()) {
+                            break;
+                        }
+                        writer.socketClose();
+                        latencies[i].push_back(elapsedUs(started));
+                    }
+                });
+            }
+            for(auto &client : clients) {
+                client.join();
+            }
+
+            uint64_t connected = 0;
+            for(auto &clientLatencies : latencies) {
+                connected += clientLatencies.size();
+                result.latenciesUs.insert(result.latenciesUs.end(), clientLatencies.begin(), clientLatencies.end());
+            }
+
+            waitFor([&] { return server.metrics().get(nettle::Counter::ACCEPTS) - acceptedBefore >= connected; },
+                    std::chrono::seconds(5));
+            result.operations = server.metrics().get(nettle::Counter::ACCEPTS) - acceptedBefore;
+        });
+
+        server.stop();
+        return result;
+    }
+
+    Result writerConnect(const Options &options, int port) {
+
+        nettle::HostPort hp("127.0.0.1", port);
+        QuietHandler handler;
+
+        nettle::TcpServerConfig config;
+        config.mode = nettle::TcpServeMode::EVENT_LOOP;
+        config.maxPendingRequests = 1024;
+
+        nettle::TcpServer server(hp, handler, config);
+        server.serve();
+
+        Result result = measure("writer_connect", "Writer construction up to an established connection", [&](Result &result) {
+
+            auto deadline = Clock::now() + options.duration;
+            while(Clock::now() < deadline && result.operations < MAX_CONNECTIONS) {
+                auto started = Clock::now();
+                nettle::Writer writer(hp, nettle::WriterType::TCP, [](nettle::SocketError) { });
+                double latency = elapsedUs(started);
+
+                if(writer.hasError()) {
+                    break;
+                }
+                result.latenciesUs.push_back(latency);
+                result.operations++;
+            }
+        });
+
+        server.stop();
+        return result;
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Report
+    // -----------------------------------------------------------------------------------------------------------------
+
+    std::string toJson(std::vector<Result> &results, const Options &options) {
+
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(3);
+        out << "{\n  \"benchmark\": \"nettle_bench\",\n  \"duration_ms\": " << options.duration.count()
+            << ",\n  \"results\": [";
+
+        for(std::size_t i = 0; i < results.size(); i++) {
+            Result &result = results[i];
+            std::sort(result.latenciesUs.begin(), result.latenciesUs.end());
+
+            double seconds = (result.seconds > 0) ? result.seconds : 1;
+            double perOp = (result.operations > 0) ? result.cpuSeconds * 1e6 / result.operations : 0;
+
+            out << ((i > 0) ? ",\n" : "\n")
+                << "    {\n"
+                << "      \"scenario\": \"" << result.scenario << "\",\n"
+                << "      \"operation\": \"" << result.operation << "\",\n"
+                << "      \"operations\": " << result.operations << ",\n"
+                << "      \"bytes\": " << result.bytes << ",\n"
+                << "      \"seconds\": " << result.seconds << ",\n"
+                << "      \"ops_per_sec\": " << result.operations / seconds << ",\n"
+                << "      \"bytes_per_sec\": " << result.bytes / seconds << ",\n"
+                << "      \"latency_us\": {\"samples\": " << result.latenciesUs.size()
+                << ", \"p50\": " << percentile(result.latenciesUs, 0.50)
+                << ", \"p99\": " << percentile(result.latenciesUs, 0.99)
+                << ", \"p999\": " << percentile(result.latenciesUs, 0.999)
+                << ", \"max\": " << (result.latenciesUs.empty() ? 0 : result.latenciesUs.back()) << "},\n"
+                << "      \"cpu_us_per_op\": " << perOp << "\n"
+                << "    }";
+        }
+
+        out << "\n  ]\n}\n";
+        return out.str();
+    }
+
+    void usage() {
+
+        std::cerr << "usage: nettle_bench [--scenario NAME] [--duration MS] [--port PORT] [--output FILE]\n"
+                  << "scenarios: tcp_request_response tcp_bulk udp_pps tcp_accept writer_connect" << std::endl;
+    }
+}
+
+int main(int argc, char **argv) {
+
+    Options options;
+
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+
+        if(arg == "--scenario") {
+            options.scenario = argv[++i];
+        } else if(arg == "--duration") {
+            options.duration = std::chrono::milliseconds(std::stoi(argv[++i]));
+        } else if(arg == "--port") {
+            options.port = std::stoi(argv[++i]);
+        } else if(arg == "--output") {
+            options.output = argv[++i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    // Each scenario listens on a port of its own, a lingering socket of one can't disturb the next
+    struct Scenario {
+        const char *name;
+        Result (*run)(const Options &, int);
+    };
+    const Scenario scenarios[] = {
+        {"tcp_request_response", tcpRequestResponse},
+        {"tcp_bulk", tcpBulk},
+        {"udp_pps", udpPacketsPerSecond},
+        {"tcp_accept", tcpAccept},
+        {"writer_connect", writerConnect},
+    };
+
+    std::vector<Result> results;
+    int port = options.port;
+    for(const Scenario &scenario : scenarios) {
+        if(options.scenario.empty() || options.scenario == scenario.name) {
+            results.push_back(scenario.run(options, port));
+        }
+        port++;
+    }
+
+    if(results.empty()) {
+        usage();
+        return 1;
+    }
+
+    std::string json = toJson(results, options);
+    if(options.output.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream(options.output) << json;
+    }
+    return 0;
+}
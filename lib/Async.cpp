@@ -0,0 +1,508 @@
+#include "Async.hpp"
+
+#include <cstring>
+#include <iostream>
+
+#ifndef _MSC_VER
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+namespace nettle
+{
+   namespace
+   {
+      //!
+      //! \brief Root of a spawned task, owns it and frees itself once it finishes
+      //!
+      struct Detached
+      {
+         struct promise_type
+         {
+            Detached get_return_object() { return Detached {std::coroutine_handle<promise_type>::from_promise(*this)}; }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_never final_suspend() noexcept { return {}; }
+            void return_void() {}
+            void unhandled_exception() {}
+         };
+
+         std::coroutine_handle<promise_type> handle;
+      };
+
+      Detached runDetached(Task<void> task)
+      {
+         try
+         {
+            co_await task;
+         }
+         catch (const std::exception &error)
+         {
+            std::cerr << "Spawned task failed : " << error.what() << std::endl;
+         }
+         catch (...)
+         {
+            std::cerr << "Spawned task failed" << std::endl;
+         }
+      }
+   }
+
+   // ---------------------------------------------------------
+   // Executor
+   // ---------------------------------------------------------
+   Executor::Executor()
+   {
+#ifndef _MSC_VER
+      epollFd = epoll_create1(EPOLL_CLOEXEC);
+      wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+      if (epollFd < 0 || wakeFd < 0)
+      {
+         return;
+      }
+
+      epoll_event wakeEvent {};
+      wakeEvent.events = EPOLLIN;
+      wakeEvent.data.fd = wakeFd;
+      epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &wakeEvent);
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // ~Executor
+   // ---------------------------------------------------------
+   Executor::~Executor()
+   {
+      if (wakeFd >= 0)
+      {
+         CLOSE_FD(wakeFd);
+      }
+
+      if (epollFd >= 0)
+      {
+         CLOSE_FD(epollFd);
+      }
+   }
+
+   // ---------------------------------------------------------
+   // isOpen
+   // ---------------------------------------------------------
+   bool Executor::isOpen() const
+   {
+      return epollFd >= 0 && wakeFd >= 0;
+   }
+
+   // ---------------------------------------------------------
+   // spawn
+   // ---------------------------------------------------------
+   void Executor::spawn(Task<void> task)
+   {
+      post(runDetached(std::move(task)).handle);
+   }
+
+   // ---------------------------------------------------------
+   // post
+   // ---------------------------------------------------------
+   void Executor::post(std::coroutine_handle<> handle)
+   {
+      bool wasIdle;
+      {
+         std::lock_guard<std::mutex> lock(readyMut);
+         wasIdle = ready.empty();
+         ready.push_back(handle);
+      }
+
+#ifndef _MSC_VER
+      // Only the first post needs to interrupt a waiting run loop
+      if (wasIdle)
+      {
+         uint64_t wake = 1;
+         if (::write(wakeFd, &wake, sizeof(wake)) < 0)
+         {
+            std::cerr << "Unable to wake executor" << std::endl;
+         }
+      }
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // stop
+   // ---------------------------------------------------------
+   void Executor::stop()
+   {
+      stopping.store(true);
+
+#ifndef _MSC_VER
+      uint64_t wake = 1;
+      if (::write(wakeFd, &wake, sizeof(wake)) < 0)
+      {
+         std::cerr << "Unable to wake executor" << std::endl;
+      }
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // run
+   // ---------------------------------------------------------
+   void Executor::run()
+   {
+#ifndef _MSC_VER
+      constexpr int MAX_EVENTS = 64;
+      epoll_event events[MAX_EVENTS];
+      std::deque<std::coroutine_handle<>> resuming;
+
+      stopping.store(false);
+
+      while (!stopping.load())
+      {
+         {
+            std::lock_guard<std::mutex> lock(readyMut);
+            resuming.insert(resuming.end(), ready.begin(), ready.end());
+            ready.clear();
+         }
+
+         while (!resuming.empty() && !stopping.load())
+         {
+            auto handle = resuming.front();
+            resuming.pop_front();
+            handle.resume();
+         }
+
+         if (stopping.load())
+         {
+            // Whatever did not get to run stays queued for the next run()
+            std::lock_guard<std::mutex> lock(readyMut);
+            ready.insert(ready.begin(), resuming.begin(), resuming.end());
+            resuming.clear();
+            break;
+         }
+
+         int timeout;
+         {
+            std::lock_guard<std::mutex> lock(readyMut);
+            timeout = ready.empty() ? -1 : 0;
+         }
+
+         int numEvents = epoll_wait(epollFd, events, MAX_EVENTS, timeout);
+         if (numEvents < 0 && errno != EINTR)
+         {
+            break;
+         }
+
+         for (int i = 0; i < numEvents; i++)
+         {
+            int fd = events[i].data.fd;
+
+            if (fd == wakeFd)
+            {
+               uint64_t drained;
+               while (::read(wakeFd, &drained, sizeof(drained)) > 0)
+               {
+               }
+               continue;
+            }
+
+            auto it = waiters.find(fd);
+            if (it == waiters.end())
+            {
+               continue;
+            }
+
+            // Hang ups and errors wake both sides so each sees the failure on its next call
+            uint32_t triggered = events[i].events;
+            std::coroutine_handle<> reader;
+            std::coroutine_handle<> writer;
+
+            if (triggered & (EPOLLIN | EPOLLHUP | EPOLLERR | EPOLLRDHUP))
+            {
+               reader = std::exchange(it->second.reader, nullptr);
+            }
+
+            if (triggered & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            {
+               writer = std::exchange(it->second.writer, nullptr);
+            }
+
+            // Armed one shot, so whoever is still waiting needs it armed again
+            rearm(fd, it->second);
+
+            if (reader)
+            {
+               resuming.push_back(reader);
+            }
+
+            if (writer)
+            {
+               resuming.push_back(writer);
+            }
+         }
+      }
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // watch
+   // ---------------------------------------------------------
+   void Executor::watch(int fd, bool write, std::coroutine_handle<> handle)
+   {
+      Waiters &waiting = waiters[fd];
+      (write ? waiting.writer : waiting.reader) = handle;
+      rearm(fd, waiting);
+   }
+
+   // ---------------------------------------------------------
+   // rearm
+   // ---------------------------------------------------------
+   void Executor::rearm(int fd, Waiters &waiting)
+   {
+#ifndef _MSC_VER
+      if (!waiting.reader && !waiting.writer)
+      {
+         return;
+      }
+
+      epoll_event event {};
+      event.events = EPOLLONESHOT | (waiting.reader ? static_cast<uint32_t>(EPOLLIN | EPOLLRDHUP) : 0u) |
+                     (waiting.writer ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+      event.data.fd = fd;
+
+      int op = waiting.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+      int result = epoll_ctl(epollFd, op, fd, &event);
+
+      // A descriptor closed without being forgotten left epoll with it, a reuse of the number starts over
+      if (result < 0 && op == EPOLL_CTL_MOD && errno == ENOENT)
+      {
+         result = epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+      }
+
+      if (result == 0)
+      {
+         waiting.registered = true;
+         return;
+      }
+
+      // Descriptors epoll can't watch are always ready, let the waiters find out
+      if (waiting.reader)
+      {
+         post(std::exchange(waiting.reader, nullptr));
+      }
+
+      if (waiting.writer)
+      {
+         post(std::exchange(waiting.writer, nullptr));
+      }
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // forget
+   // ---------------------------------------------------------
+   void Executor::forget(int fd, bool resumeWaiters)
+   {
+      auto it = waiters.find(fd);
+      if (it == waiters.end())
+      {
+         return;
+      }
+
+#ifndef _MSC_VER
+      if (it->second.registered)
+      {
+         epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+      }
+#endif
+
+      // Left suspended their frames would never be freed
+      if (resumeWaiters && it->second.reader)
+      {
+         post(it->second.reader);
+      }
+
+      if (resumeWaiters && it->second.writer)
+      {
+         post(it->second.writer);
+      }
+
+      waiters.erase(it);
+   }
+
+   // ---------------------------------------------------------
+   // AsyncSocket
+   // ---------------------------------------------------------
+   AsyncSocket::AsyncSocket(Executor &executor, std::unique_ptr<Socket> socket) : executor(executor),
+                                                                                  sock(std::move(socket))
+   {
+#ifndef _MSC_VER
+      sock->setNonBlocking(true);
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // ~AsyncSocket
+   // ---------------------------------------------------------
+   AsyncSocket::~AsyncSocket()
+   {
+      if (sock->isOpen())
+      {
+         executor.forget(sock->getSocketFd(), false);
+         sock->socketClose();
+      }
+   }
+
+   // ---------------------------------------------------------
+   // close
+   // ---------------------------------------------------------
+   void AsyncSocket::close()
+   {
+      if (sock->isOpen())
+      {
+         executor.forget(sock->getSocketFd());
+         sock->socketClose();
+      }
+   }
+
+   // ---------------------------------------------------------
+   // socket
+   // ---------------------------------------------------------
+   Socket &AsyncSocket::socket()
+   {
+      return *sock;
+   }
+
+#ifndef _MSC_VER
+   // ---------------------------------------------------------
+   // readSome
+   // ---------------------------------------------------------
+   Task<IoResult> AsyncSocket::readSome(void *buffer, std::size_t length)
+   {
+      while (true)
+      {
+         // Closed while this was waiting, the descriptor number may already be reused
+         if (!sock->isOpen())
+         {
+            co_return IoResult {IoStatus::CLOSED, 0, 0};
+         }
+
+         IoResult result = sock->readSome(buffer, length);
+         if (result.status != IoStatus::WOULD_BLOCK)
+         {
+            co_return result;
+         }
+
+         co_await executor.readable(sock->getSocketFd());
+      }
+   }
+
+   // ---------------------------------------------------------
+   // read
+   // ---------------------------------------------------------
+   Task<IoResult> AsyncSocket::read(void *buffer, std::size_t length)
+   {
+      uint8_t *cBuff = static_cast<uint8_t *>(buffer);
+      std::size_t total = 0;
+
+      while (total < length)
+      {
+         IoResult result = co_await readSome(cBuff + total, length - total);
+         total += result.bytes;
+
+         if (result.status != IoStatus::COMPLETE && result.status != IoStatus::PARTIAL)
+         {
+            co_return IoResult {result.status, total, result.error};
+         }
+      }
+
+      co_return IoResult {IoStatus::COMPLETE, total, 0};
+   }
+
+   // ---------------------------------------------------------
+   // write
+   // ---------------------------------------------------------
+   Task<IoResult> AsyncSocket::write(const void *buffer, std::size_t length)
+   {
+      const uint8_t *cBuff = static_cast<const uint8_t *>(buffer);
+      std::size_t total = 0;
+
+      while (total < length)
+      {
+         if (!sock->isOpen())
+         {
+            co_return IoResult {IoStatus::CLOSED, total, 0};
+         }
+
+         IoResult result = sock->writeSome(cBuff + total, length - total);
+         total += result.bytes;
+
+         if (result.status == IoStatus::PARTIAL || result.status == IoStatus::WOULD_BLOCK)
+         {
+            co_await executor.writable(sock->getSocketFd());
+            continue;
+         }
+
+         if (result.status != IoStatus::COMPLETE)
+         {
+            co_return IoResult {result.status, total, result.error};
+         }
+      }
+
+      co_return IoResult {IoStatus::COMPLETE, total, 0};
+   }
+
+   // ---------------------------------------------------------
+   // connectAsync
+   // ---------------------------------------------------------
+   Task<std::unique_ptr<AsyncSocket>> connectAsync(Executor &executor,
+                                                   HostPort hostPort,
+                                                   std::function<void(SocketError)> errorCb)
+   {
+      sockaddr_in serverAddr;
+      memset(&serverAddr, 0, sizeof(serverAddr));
+      serverAddr.sin_family = AF_INET;
+      serverAddr.sin_port = htons(hostPort.getPort());
+
+      if (inet_pton(AF_INET, hostPort.getAddress().c_str(), &serverAddr.sin_addr) <= 0)
+      {
+         errorCb(SocketError::SOCKET_CREATE);
+         co_return nullptr;
+      }
+
+      int fd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+      if (fd < 0)
+      {
+         errorCb(SocketError::SOCKET_CREATE);
+         co_return nullptr;
+      }
+
+      if (connect(fd, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0)
+      {
+         if (errno != EINPROGRESS)
+         {
+            errorCb(SocketError::SOCKET_CONNECT);
+            CLOSE_FD(fd);
+            co_return nullptr;
+         }
+
+         // The handshake finishes once the socket turns writable, SO_ERROR says how
+         co_await executor.writable(fd);
+         executor.forget(fd);
+
+         int error = 0;
+         socklen_t errorLen = sizeof(error);
+         if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errorLen) < 0 || error != 0)
+         {
+            errorCb(SocketError::SOCKET_CONNECT);
+            CLOSE_FD(fd);
+            co_return nullptr;
+         }
+      }
+
+      auto connected = std::make_unique<Socket>(errorCb);
+      if (!connected->setupSocket(fd, serverAddr))
+      {
+         CLOSE_FD(fd);
+         co_return nullptr;
+      }
+
+      co_return std::make_unique<AsyncSocket>(executor, std::move(connected));
+   }
+#endif
+}
@@ -0,0 +1,335 @@
+#ifndef NET_ASYNC_HPP
+#define NET_ASYNC_HPP
+
+#include "Socket.hpp"
+#include "HostPort.hpp"
+
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+//!
+//! \file Async.hpp
+//! \brief Coroutine tasks and awaitable socket operations driven by a small
+//!        epoll executor
+//!
+namespace nettle
+{
+   template <typename T>
+   class Task;
+
+   namespace detail
+   {
+      //!
+      //! \brief Promise state shared by every Task, resumes whoever awaited the
+      //!        task once it finishes
+      //!
+      struct TaskPromiseBase
+      {
+         std::coroutine_handle<> continuation;
+         std::exception_ptr error;
+
+         struct FinalAwaiter
+         {
+            bool await_ready() noexcept { return false; }
+
+            template <typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept
+            {
+               auto continuation = finished.promise().continuation;
+               return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() noexcept {}
+         };
+
+         std::suspend_always initial_suspend() noexcept { return {}; }
+         FinalAwaiter final_suspend() noexcept { return {}; }
+         void unhandled_exception() { error = std::current_exception(); }
+      };
+
+      template <typename T>
+      struct TaskPromise : TaskPromiseBase
+      {
+         std::optional<T> value;
+
+         Task<T> get_return_object();
+         void return_value(T result) { value.emplace(std::move(result)); }
+
+         T take()
+         {
+            if (error)
+            {
+               std::rethrow_exception(error);
+            }
+            return std::move(*value);
+         }
+      };
+
+      template <>
+      struct TaskPromise<void> : TaskPromiseBase
+      {
+         Task<void> get_return_object();
+         void return_void() {}
+
+         void take()
+         {
+            if (error)
+            {
+               std::rethrow_exception(error);
+            }
+         }
+      };
+   }
+
+   //!
+   //! \class Task
+   //! \brief A lazily started coroutine producing a T. Runs when awaited, or
+   //!        when handed to Executor::spawn
+   //!
+   template <typename T = void>
+   class Task
+   {
+   public:
+      using promise_type = detail::TaskPromise<T>;
+
+      Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+      Task &operator=(Task &&other) noexcept
+      {
+         if (this != &other)
+         {
+            if (handle)
+            {
+               handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+         }
+         return *this;
+      }
+
+      Task(const Task &) = delete;
+      Task &operator=(const Task &) = delete;
+
+      ~Task()
+      {
+         if (handle)
+         {
+            handle.destroy();
+         }
+      }
+
+      bool await_ready() const noexcept { return !handle || handle.done(); }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+      {
+         handle.promise().continuation = awaiting;
+         return handle;
+      }
+
+      T await_resume() { return handle.promise().take(); }
+
+   private:
+      friend promise_type;
+
+      explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+      std::coroutine_handle<promise_type> handle;
+   };
+
+   namespace detail
+   {
+      template <typename T>
+      Task<T> TaskPromise<T>::get_return_object()
+      {
+         return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+      }
+
+      inline Task<void> TaskPromise<void>::get_return_object()
+      {
+         return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+      }
+   }
+
+   //!
+   //! \class Executor
+   //! \brief Runs coroutines on the thread that calls run(), suspending them on
+   //!        socket readiness (epoll) instead of blocking a thread per connection
+   //! \note Coroutines still suspended when the executor is destroyed are never resumed
+   //!
+   class Executor
+   {
+   public:
+      Executor();
+      ~Executor();
+
+      Executor(const Executor &) = delete;
+      Executor &operator=(const Executor &) = delete;
+
+      //!
+      //! \retval true iff the executor could be set up
+      //!
+      bool isOpen() const;
+
+      //!
+      //! \brief Start a task on the executor, it owns the task until it finishes
+      //! \note Thread safe. Exceptions escaping the task are reported to cerr
+      //!
+      void spawn(Task<void> task);
+
+      //!
+      //! \brief Resume coroutines as they become ready until stop is called
+      //!
+      void run();
+
+      //!
+      //! \brief Make run return once the coroutine it is resuming suspends
+      //! \note Thread safe
+      //!
+      void stop();
+
+      //!
+      //! \brief Await a descriptor becoming readable (or hung up / errored)
+      //!
+      auto readable(int fd) { return ReadinessAwaiter {*this, fd, false}; }
+
+      //!
+      //! \brief Await a descriptor becoming writable (or hung up / errored)
+      //!
+      auto writable(int fd) { return ReadinessAwaiter {*this, fd, true}; }
+
+      //!
+      //! \brief Requeue the awaiting coroutine behind everything else that is ready
+      //!
+      auto yield() { return YieldAwaiter {*this}; }
+
+      //!
+      //! \brief Drop a descriptor from the executor, call before closing it
+      //! \param resumeWaiters Queue coroutines still awaiting the descriptor so
+      //!        they find it closed, rather than dropping them suspended
+      //!
+      void forget(int fd, bool resumeWaiters = true);
+
+   private:
+      struct ReadinessAwaiter
+      {
+         Executor &executor;
+         int fd;
+         bool write;
+
+         bool await_ready() const noexcept { return false; }
+         void await_suspend(std::coroutine_handle<> awaiting) { executor.watch(fd, write, awaiting); }
+         void await_resume() const noexcept {}
+      };
+
+      struct YieldAwaiter
+      {
+         Executor &executor;
+
+         bool await_ready() const noexcept { return false; }
+         void await_suspend(std::coroutine_handle<> awaiting) { executor.post(awaiting); }
+         void await_resume() const noexcept {}
+      };
+
+      struct Waiters
+      {
+         std::coroutine_handle<> reader;
+         std::coroutine_handle<> writer;
+         bool registered = false;
+      };
+
+      int epollFd {-1};
+      int wakeFd {-1};
+      std::atomic<bool> stopping {false};
+
+      std::mutex readyMut;
+      std::deque<std::coroutine_handle<>> ready;
+
+      // Only touched from the thread inside run()
+      std::unordered_map<int, Waiters> waiters;
+
+      void post(std::coroutine_handle<> handle);
+      void watch(int fd, bool write, std::coroutine_handle<> handle);
+      void rearm(int fd, Waiters &waiting);
+   };
+
+   //!
+   //! \class AsyncSocket
+   //! \brief A non-blocking Socket whose transfers suspend the calling coroutine
+   //!        while the socket is not ready
+   //!
+   class AsyncSocket
+   {
+   public:
+      //!
+      //! \brief Take over a set up socket and switch it to non-blocking mode
+      //! \param executor Executor the socket's operations are awaited on
+      //! \param socket The socket to drive
+      //!
+      AsyncSocket(Executor &executor, std::unique_ptr<Socket> socket);
+
+      //!
+      //! \brief Drops the socket from the executor and closes it
+      //! \note Operations still awaiting the socket are not resumed, they would
+      //!       find it gone. Destroy it only once nothing awaits it, or close it
+      //!       first and let them finish
+      //!
+      ~AsyncSocket();
+
+      AsyncSocket(const AsyncSocket &) = delete;
+      AsyncSocket &operator=(const AsyncSocket &) = delete;
+
+      //!
+      //! \brief Read whatever arrives first, up to length bytes
+      //! \returns COMPLETE / PARTIAL once bytes arrive, CLOSED or FAILED otherwise
+      //!
+      Task<IoResult> readSome(void *buffer, std::size_t length);
+
+      //!
+      //! \brief Read exactly length bytes
+      //! \returns COMPLETE, or CLOSED / FAILED with the bytes read until then
+      //!
+      Task<IoResult> read(void *buffer, std::size_t length);
+
+      //!
+      //! \brief Write all length bytes
+      //! \returns COMPLETE, or CLOSED / FAILED with the bytes written until then
+      //!
+      Task<IoResult> write(const void *buffer, std::size_t length);
+
+      //!
+      //! \brief Close the socket early
+      //! \note Operations awaiting the socket resume and return CLOSED, the
+      //!       socket has to outlive them
+      //!
+      void close();
+
+      //!
+      //! \retval The underlying socket
+      //!
+      Socket &socket();
+
+   private:
+      Executor &executor;
+      std::unique_ptr<Socket> sock;
+   };
+
+   //!
+   //! \brief Connect to a TCP endpoint without blocking the executor
+   //! \param executor Executor to await the connection on
+   //! \param hostPort Endpoint to connect to
+   //! \param errorCb The error callback - Defaults to ErrorSink
+   //! \returns The connected socket, nullptr if the connection failed
+   //!
+   Task<std::unique_ptr<AsyncSocket>> connectAsync(Executor &executor,
+                                                   HostPort hostPort,
+                                                   std::function<void(SocketError)> errorCb = ErrorSink);
+}
+
+#endif
@@ -0,0 +1,348 @@
+#include "AsyncWriter.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__linux__)
+#include <netinet/tcp.h>
+#endif
+
+namespace nettle
+{
+#ifndef _MSC_VER
+   // -------------------------------------------------------
+   // AsyncWriter
+   // -------------------------------------------------------
+
+   AsyncWriter::AsyncWriter(Socket &socket, AsyncWriterConfig config) : socket(socket),
+                                                                        config(std::move(config))
+   {
+      // Both buffers settle at the batch size, producers rarely trigger a reallocation
+      filling.reserve(this->config.flush.maxBytes);
+      draining.reserve(this->config.flush.maxBytes);
+
+      flusher = std::thread(&AsyncWriter::run, this);
+   }
+
+   // -------------------------------------------------------
+   // ~AsyncWriter
+   // -------------------------------------------------------
+
+   AsyncWriter::~AsyncWriter()
+   {
+      close();
+   }
+
+   // -------------------------------------------------------
+   // enqueue
+   // -------------------------------------------------------
+
+   bool AsyncWriter::enqueue(const void *buffer, std::size_t length)
+   {
+      iovec message {const_cast<void *>(buffer), length};
+      return enqueue(std::span<const iovec>(&message, 1));
+   }
+
+   bool AsyncWriter::enqueue(std::span<const iovec> buffers)
+   {
+      std::size_t length = 0;
+      for (const iovec &buffer : buffers)
+      {
+         length += buffer.iov_len;
+      }
+
+      std::unique_lock<std::mutex> lock(mut);
+
+      if (!admit(lock, length))
+      {
+         return false;
+      }
+
+      bool wasEmpty = filling.empty();
+      if (wasEmpty)
+      {
+         firstQueued = std::chrono::steady_clock::now();
+      }
+
+      for (const iovec &buffer : buffers)
+      {
+         const uint8_t *bytes = static_cast<const uint8_t *>(buffer.iov_base);
+         filling.insert(filling.end(), bytes, bytes + buffer.iov_len);
+      }
+
+      fillingMessages++;
+      queuedTotal += length;
+      counters.messages++;
+
+      // The flusher is either idle, or asleep until the delay runs out and only needs
+      // waking early once a size or count trigger is crossed
+      bool full = filling.size() >= config.flush.maxBytes ||
+                  (config.flush.maxMessages > 0 && fillingMessages >= config.flush.maxMessages);
+      if (wasEmpty || full)
+      {
+         queued.notify_one();
+      }
+      return true;
+   }
+
+   // -------------------------------------------------------
+   // flush
+   // -------------------------------------------------------
+
+   bool AsyncWriter::flush(std::chrono::milliseconds timeout)
+   {
+      std::unique_lock<std::mutex> lock(mut);
+
+      uint64_t target = queuedTotal;
+      if (writtenTotal < target)
+      {
+         flushTarget = std::max(flushTarget, target);
+         queued.notify_one();
+
+         drained.wait_for(lock, timeout, [this, target] { return writtenTotal >= target; });
+      }
+      return writtenTotal >= target && !failed;
+   }
+
+   // -------------------------------------------------------
+   // close
+   // -------------------------------------------------------
+
+   void AsyncWriter::close()
+   {
+      {
+         std::lock_guard<std::mutex> lock(mut);
+         stopping = true;
+      }
+      queued.notify_one();
+      drained.notify_all();
+
+      if (flusher.joinable())
+      {
+         flusher.join();
+      }
+   }
+
+   // -------------------------------------------------------
+   // buffered
+   // -------------------------------------------------------
+
+   std::size_t AsyncWriter::buffered() const
+   {
+      std::lock_guard<std::mutex> lock(mut);
+      return filling.size() + inFlight;
+   }
+
+   bool AsyncWriter::hasError() const
+   {
+      std::lock_guard<std::mutex> lock(mut);
+      return failed;
+   }
+
+   IoResult AsyncWriter::lastError() const
+   {
+      std::lock_guard<std::mutex> lock(mut);
+      return failure;
+   }
+
+   AsyncWriterStats AsyncWriter::stats() const
+   {
+      std::lock_guard<std::mutex> lock(mut);
+      return counters;
+   }
+
+   // -------------------------------------------------------
+   // admit
+   // -------------------------------------------------------
+
+   bool AsyncWriter::admit(std::unique_lock<std::mutex> &lock, std::size_t length)
+   {
+      auto full = [this, length] { return filling.size() + inFlight + length > config.maxBuffered; };
+
+      if (!stopping && !failed && length <= config.maxBuffered && full())
+      {
+         if (!pressured)
+         {
+            pressured = true;
+            reportPressure(lock);
+         }
+
+         if (config.overloadPolicy == OverloadPolicy::BLOCK)
+         {
+            drained.wait(lock, [this, &full] { return stopping || failed || !full(); });
+         }
+      }
+
+      if (stopping || failed || length > config.maxBuffered || full())
+      {
+         counters.rejected++;
+         return false;
+      }
+      return true;
+   }
+
+   // -------------------------------------------------------
+   // reportPressure
+   // -------------------------------------------------------
+
+   void AsyncWriter::reportPressure(std::unique_lock<std::mutex> &lock)
+   {
+      // Producers raise pressure and the flusher clears it, one thread at a time hands
+      // on the latest state so a clear can never overtake the raise it follows
+      if (!config.onPressure || deliveringPressure)
+      {
+         return;
+      }
+
+      deliveringPressure = true;
+      while (reportedPressure != pressured)
+      {
+         reportedPressure = pressured;
+         bool state = reportedPressure;
+
+         lock.unlock();
+         config.onPressure(state);
+         lock.lock();
+      }
+      deliveringPressure = false;
+   }
+
+   // -------------------------------------------------------
+   // flushDue
+   // -------------------------------------------------------
+
+   bool AsyncWriter::flushDue(std::chrono::steady_clock::time_point now) const
+   {
+      return filling.size() >= config.flush.maxBytes ||
+             (config.flush.maxMessages > 0 && fillingMessages >= config.flush.maxMessages) ||
+             flushTarget > writtenTotal ||
+             stopping || failed ||
+             now - firstQueued >= config.flush.maxDelay;
+   }
+
+   // -------------------------------------------------------
+   // run
+   // -------------------------------------------------------
+
+   void AsyncWriter::run()
+   {
+      std::unique_lock<std::mutex> lock(mut);
+
+      while (true)
+      {
+         if (filling.empty())
+         {
+            if (stopping)
+            {
+               break;
+            }
+
+            queued.wait(lock, [this] { return stopping || !filling.empty(); });
+            continue;
+         }
+
+         if (!flushDue(std::chrono::steady_clock::now()))
+         {
+            queued.wait_until(lock, firstQueued + config.flush.maxDelay);
+            continue;
+         }
+
+         // Once a write failed the stream is broken, whatever was queued behind it is dropped
+         if (failed)
+         {
+            writtenTotal += filling.size();
+            filling.clear();
+            fillingMessages = 0;
+            drained.notify_all();
+            continue;
+         }
+
+         std::swap(filling, draining);
+         fillingMessages = 0;
+         inFlight = draining.size();
+
+         lock.unlock();
+         IoResult result = writeBatch();
+         lock.lock();
+
+         writtenTotal += inFlight;
+         inFlight = 0;
+         draining.clear();
+
+         counters.bytes += result.bytes;
+         counters.flushes++;
+
+         if (result.status != IoStatus::COMPLETE)
+         {
+            failed = true;
+            failure = result;
+         }
+
+         bool uncork = corked && filling.empty();
+         bool relieved = pressured && filling.size() < config.maxBuffered / 2;
+         if (relieved)
+         {
+            pressured = false;
+         }
+
+         drained.notify_all();
+
+         if (uncork)
+         {
+            lock.unlock();
+            setCork(false);
+            lock.lock();
+         }
+         if (relieved)
+         {
+            reportPressure(lock);
+         }
+      }
+
+      if (corked)
+      {
+         setCork(false);
+      }
+   }
+
+   // -------------------------------------------------------
+   // writeBatch
+   // -------------------------------------------------------
+
+   IoResult AsyncWriter::writeBatch()
+   {
+      if (config.flush.cork && !corked)
+      {
+         setCork(true);
+      }
+
+      std::size_t sent = 0;
+      while (sent < draining.size())
+      {
+         IoResult result = socket.writeSome(draining.data() + sent, draining.size() - sent);
+         sent += result.bytes;
+
+         if (result.status != IoStatus::COMPLETE && result.status != IoStatus::PARTIAL)
+         {
+            return IoResult{result.status, sent, result.error};
+         }
+      }
+      return IoResult{IoStatus::COMPLETE, sent, 0};
+   }
+
+   // -------------------------------------------------------
+   // setCork
+   // -------------------------------------------------------
+
+   void AsyncWriter::setCork(bool enable)
+   {
+#if defined(TCP_CORK)
+      int value = enable ? 1 : 0;
+      if (setsockopt(socket.getSocketFd(), IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) == 0)
+      {
+         corked = enable;
+      }
+#endif
+   }
+#endif
+}
@@ -0,0 +1,176 @@
+#ifndef NET_ASYNC_WRITER_HPP
+#define NET_ASYNC_WRITER_HPP
+
+#include "BoundedQueue.hpp"
+#include "Socket.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+//!
+//! \file AsyncWriter.hpp
+//! \brief A send queue drained by a background thread that coalesces many
+//!        small messages into few large writes
+//!
+namespace nettle
+{
+#ifndef _MSC_VER
+   //!
+   //! \brief When queued bytes are handed to the socket, whichever trigger fires first
+   //!
+   struct FlushPolicy
+   {
+      std::size_t maxBytes = 64 * 1024;          //! Flush once this many bytes are queued
+      std::size_t maxMessages = 0;               //! Flush once this many messages are queued, 0 to ignore the count
+      std::chrono::microseconds maxDelay {1000}; //! Longest a queued message waits for a flush
+      bool cork = true;                          //! Hold partial segments back (TCP_CORK) while batches keep
+                                                 //! coming, released as soon as the queue runs empty
+   };
+
+   //!
+   //! \brief Settings of an AsyncWriter
+   //!
+   struct AsyncWriterConfig
+   {
+      FlushPolicy flush;                                      //! When to write
+      std::size_t maxBuffered = 4 * 1024 * 1024;              //! Bytes queued or being written before producers are pushed back
+      OverloadPolicy overloadPolicy = OverloadPolicy::REJECT; //! REJECT or BLOCK when full. Messages already
+                                                              //! queued are part of the stream and never shed,
+                                                              //! so SHED_OLDEST behaves as REJECT
+      std::function<void(bool)> onPressure;                   //! Called with true when a message finds the queue
+                                                              //! full, with false once it has drained below half.
+                                                              //! Calls never overlap and always alternate, a change
+                                                              //! undone before it was reported is skipped
+   };
+
+   //!
+   //! \brief Counters of an AsyncWriter since it was created
+   //!
+   struct AsyncWriterStats
+   {
+      uint64_t messages = 0; //! Messages queued
+      uint64_t bytes = 0;    //! Bytes written to the socket
+      uint64_t flushes = 0;  //! Batches written, each a single send
+      uint64_t rejected = 0; //! Messages refused for lack of room
+   };
+
+   //!
+   //! \class AsyncWriter
+   //! \brief Lets any number of producer threads queue messages on a connected
+   //!        socket without waiting on the network. A flusher thread copies them
+   //!        into one contiguous batch and writes it with a single send
+   //! \note The socket must stay in blocking mode and outlive the writer, and
+   //!       nothing else may write to it meanwhile
+   //!
+   class AsyncWriter
+   {
+   public:
+      //!
+      //! \brief Start the flusher
+      //! \param socket Connected socket to write to
+      //! \param config Flush policy and limits
+      //!
+      AsyncWriter(Socket &socket, AsyncWriterConfig config = AsyncWriterConfig());
+
+      //!
+      //! \brief Flushes whatever is queued (bounded by the socket send timeout) and
+      //!        stops the flusher
+      //!
+      ~AsyncWriter();
+
+      AsyncWriter(const AsyncWriter &) = delete;
+      AsyncWriter &operator=(const AsyncWriter &) = delete;
+
+      //!
+      //! \brief Queue a message
+      //! \retval false if it was refused: no room (REJECT), larger than maxBuffered,
+      //!         or the writer has failed or is closing
+      //! \note Thread safe. The bytes are copied, the buffer can be reused at once
+      //!
+      bool enqueue(const void *buffer, std::size_t length);
+
+      //!
+      //! \brief Queue the buffers back to back as one message
+      //!
+      bool enqueue(std::span<const iovec> buffers);
+
+      //!
+      //! \brief Write everything queued so far without waiting for a trigger
+      //! \param timeout Longest wait for it to reach the socket
+      //! \retval true iff everything queued before the call was written
+      //!
+      bool flush(std::chrono::milliseconds timeout);
+
+      //!
+      //! \brief Flush and stop the flusher, later messages are refused
+      //!
+      void close();
+
+      //!
+      //! \retval Bytes queued or being written
+      //!
+      std::size_t buffered() const;
+
+      //!
+      //! \retval true iff a write failed, everything queued after it is dropped
+      //!
+      bool hasError() const;
+
+      //!
+      //! \retval How the failed write ended
+      //!
+      IoResult lastError() const;
+
+      //!
+      //! \retval Counters since creation
+      //!
+      AsyncWriterStats stats() const;
+
+   private:
+      Socket &socket;
+      AsyncWriterConfig config;
+
+      mutable std::mutex mut;
+      std::condition_variable queued;  // Flusher waits for work
+      std::condition_variable drained; // Producers and flush callers wait for progress
+
+      // Producers append to filling, the flusher swaps it out and writes it unlocked
+      std::vector<uint8_t> filling;
+      std::vector<uint8_t> draining;
+      std::size_t fillingMessages {0};
+      std::size_t inFlight {0};
+      std::chrono::steady_clock::time_point firstQueued;
+
+      uint64_t queuedTotal {0};  // Bytes ever queued
+      uint64_t writtenTotal {0}; // Bytes ever written (or dropped after a failure)
+      uint64_t flushTarget {0};  // Bytes an explicit flush wants written
+
+      bool stopping {false};
+      bool failed {false};
+      bool pressured {false};
+      bool reportedPressure {false};   // Last state handed to onPressure
+      bool deliveringPressure {false}; // A thread is inside onPressure, it reports any further change
+      bool corked {false}; // Flusher thread only
+      IoResult failure {IoStatus::COMPLETE, 0, 0};
+      AsyncWriterStats counters;
+
+      std::thread flusher;
+
+      bool admit(std::unique_lock<std::mutex> &lock, std::size_t length);
+      bool flushDue(std::chrono::steady_clock::time_point now) const;
+      void reportPressure(std::unique_lock<std::mutex> &lock);
+      void run();
+      IoResult writeBatch();
+      void setCork(bool enable);
+   };
+#endif
+}
+
+#endif
@@ -0,0 +1,235 @@
+#ifndef NET_BOUNDED_QUEUE_HPP
+#define NET_BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+//!
+//! \file BoundedQueue.hpp
+//! \brief A fixed capacity multi-producer multi-consumer queue
+//!
+namespace nettle
+{
+   //!
+   //! \brief What to do with new work when a bounded queue is full
+   //!
+   enum class OverloadPolicy
+   {
+      REJECT,     //! Drop the new item
+      BLOCK,      //! Wait for room to free up
+      SHED_OLDEST //! Drop the oldest queued item to make room
+   };
+
+   //!
+   //! \class BoundedQueue
+   //! \brief A blocking MPMC queue backed by a preallocated ring
+   //!
+   template <typename T>
+   class BoundedQueue
+   {
+   public:
+      //!
+      //! \brief Construct a queue
+      //! \param capacity Maximum number of queued items (at least 1)
+      //!
+      BoundedQueue(std::size_t capacity) : slots((capacity > 0) ? capacity : 1),
+                                           head(0),
+                                           count(0),
+                                           closed(false)
+      {
+      }
+
+      //!
+      //! \brief Queue an item if there is room
+      //! \retval true iff the item was queued
+      //!
+      bool tryPush(T item)
+      {
+         std::lock_guard<std::mutex> lock(mut);
+
+         if (closed || count == slots.size())
+         {
+            return false;
+         }
+
+         enqueue(std::move(item));
+         return true;
+      }
+
+      //!
+      //! \brief Queue an item, waiting for room if the queue is full
+      //! \retval true iff the item was queued, false if the queue was closed
+      //!
+      bool push(T item)
+      {
+         std::unique_lock<std::mutex> lock(mut);
+
+         notFull.wait(lock, [this] { return closed || count < slots.size(); });
+
+         if (closed)
+         {
+            return false;
+         }
+
+         enqueue(std::move(item));
+         return true;
+      }
+
+      //!
+      //! \brief Queue an item, dropping the oldest item if the queue is full
+      //! \returns The item that was dropped to make room, if any. When the queue
+      //!          is closed the given item is handed straight back
+      //!
+      std::optional<T> pushEvict(T item)
+      {
+         std::lock_guard<std::mutex> lock(mut);
+
+         if (closed)
+         {
+            return std::optional<T>(std::move(item));
+         }
+
+         std::optional<T> evicted;
+         if (count == slots.size())
+         {
+            evicted = dequeue();
+         }
+
+         enqueue(std::move(item));
+         return evicted;
+      }
+
+      //!
+      //! \brief Queue an item following the given overload policy
+      //! \returns The item that did not make it into the queue, if any
+      //!
+      std::optional<T> push(T item, OverloadPolicy policy)
+      {
+         switch (policy)
+         {
+         case OverloadPolicy::BLOCK:
+         {
+            // Keep a copy to hand back in case the queue closes while waiting
+            T keep = item;
+            if (push(std::move(item)))
+            {
+               return std::nullopt;
+            }
+            return std::optional<T>(std::move(keep));
+         }
+         case OverloadPolicy::SHED_OLDEST:
+            return pushEvict(std::move(item));
+         case OverloadPolicy::REJECT:
+         default:
+         {
+            T keep = item;
+            if (tryPush(std::move(item)))
+            {
+               return std::nullopt;
+            }
+            return std::optional<T>(std::move(keep));
+         }
+         }
+      }
+
+      //!
+      //! \brief Take the oldest item, waiting for one to arrive
+      //! \param item Set to the dequeued item
+      //! \retval true iff an item was taken, false once the queue is closed
+      //!
+      bool pop(T &item)
+      {
+         std::unique_lock<std::mutex> lock(mut);
+
+         notEmpty.wait(lock, [this] { return closed || count > 0; });
+
+         if (closed)
+         {
+            return false;
+         }
+
+         item = dequeue();
+         return true;
+      }
+
+      //!
+      //! \brief Take the oldest item without waiting, works on a closed queue
+      //! \retval true iff an item was taken
+      //!
+      bool tryPop(T &item)
+      {
+         std::lock_guard<std::mutex> lock(mut);
+
+         if (count == 0)
+         {
+            return false;
+         }
+
+         item = dequeue();
+         return true;
+      }
+
+      //!
+      //! \brief Close the queue, waking every waiting producer and consumer
+      //! \post Pushes fail and pop returns false. Left over items can be
+      //!       collected with tryPop
+      //!
+      void close()
+      {
+         {
+            std::lock_guard<std::mutex> lock(mut);
+            closed = true;
+         }
+         notFull.notify_all();
+         notEmpty.notify_all();
+      }
+
+      //!
+      //! \retval Number of queued items
+      //!
+      std::size_t size() const
+      {
+         std::lock_guard<std::mutex> lock(mut);
+         return count;
+      }
+
+      //!
+      //! \retval Maximum number of queued items
+      //!
+      std::size_t capacity() const
+      {
+         return slots.size();
+      }
+
+   private:
+      std::vector<T> slots;
+      std::size_t head;
+      std::size_t count;
+      bool closed;
+
+      mutable std::mutex mut;
+      std::condition_variable notFull;
+      std::condition_variable notEmpty;
+
+      void enqueue(T item)
+      {
+         slots[(head + count) % slots.size()] = std::move(item);
+         count++;
+         notEmpty.notify_one();
+      }
+
+      T dequeue()
+      {
+         T item = std::move(slots[head]);
+         head = (head + 1) % slots.size();
+         count--;
+         notFull.notify_one();
+         return item;
+      }
+   };
+}
+
+#endif
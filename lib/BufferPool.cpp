@@ -0,0 +1,162 @@
+#include "BufferPool.hpp"
+
+#include <cstring>
+#include <utility>
+
+namespace nettle
+{
+   // -------------------------------------------------------
+   // DatagramBuffer
+   // -------------------------------------------------------
+
+   DatagramBuffer::DatagramBuffer() : length(0),
+                                      pool(nullptr),
+                                      buffer(nullptr)
+   {
+      memset(&source, 0, sizeof(source));
+   }
+
+   DatagramBuffer::DatagramBuffer(std::shared_ptr<BufferPool> pool, uint8_t *buffer) : length(0),
+                                                                                       pool(std::move(pool)),
+                                                                                       buffer(buffer)
+   {
+      memset(&source, 0, sizeof(source));
+   }
+
+   DatagramBuffer::DatagramBuffer(DatagramBuffer &&other) noexcept : length(other.length),
+                                                                     source(other.source),
+                                                                     timestamp(other.timestamp),
+                                                                     pool(std::move(other.pool)),
+                                                                     buffer(std::exchange(other.buffer, nullptr))
+   {
+      other.length = 0;
+   }
+
+   DatagramBuffer &DatagramBuffer::operator=(DatagramBuffer &&other) noexcept
+   {
+      if (this != &other)
+      {
+         release();
+
+         length = std::exchange(other.length, 0);
+         source = other.source;
+         timestamp = other.timestamp;
+         pool = std::move(other.pool);
+         buffer = std::exchange(other.buffer, nullptr);
+      }
+      return *this;
+   }
+
+   // -------------------------------------------------------
+   // ~DatagramBuffer
+   // -------------------------------------------------------
+
+   DatagramBuffer::~DatagramBuffer()
+   {
+      release();
+   }
+
+   uint8_t *DatagramBuffer::data() const
+   {
+      return buffer;
+   }
+
+   std::size_t DatagramBuffer::capacity() const
+   {
+      return (pool) ? pool->bufferSize() : 0;
+   }
+
+   void DatagramBuffer::release()
+   {
+      if (buffer && pool)
+      {
+         pool->recycle(buffer);
+      }
+
+      buffer = nullptr;
+      length = 0;
+      pool.reset();
+   }
+
+   DatagramBuffer::operator bool() const
+   {
+      return buffer != nullptr;
+   }
+
+   // -------------------------------------------------------
+   // BufferPool
+   // -------------------------------------------------------
+
+   BufferPool::BufferPool(std::size_t bufferSize) : size(bufferSize)
+   {
+   }
+
+   std::shared_ptr<BufferPool> BufferPool::create(std::size_t bufferSize, std::size_t preallocate)
+   {
+      // Constructor is private, so make_shared can't reach it
+      std::shared_ptr<BufferPool> pool(new BufferPool(bufferSize));
+
+      pool->storage.reserve(preallocate);
+      pool->freeBuffers.reserve(preallocate);
+
+      for (std::size_t i = 0; i < preallocate; i++)
+      {
+         pool->storage.emplace_back(new uint8_t[bufferSize]);
+         pool->freeBuffers.push_back(pool->storage.back().get());
+      }
+
+      return pool;
+   }
+
+   // -------------------------------------------------------
+   // acquire
+   // -------------------------------------------------------
+
+   DatagramBuffer BufferPool::acquire()
+   {
+      uint8_t *buffer;
+      {
+         std::lock_guard<std::mutex> lock(mut);
+
+         if (freeBuffers.empty())
+         {
+            storage.emplace_back(new uint8_t[size]);
+            buffer = storage.back().get();
+         }
+         else
+         {
+            buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+         }
+      }
+
+      return DatagramBuffer(shared_from_this(), buffer);
+   }
+
+   // -------------------------------------------------------
+   // recycle
+   // -------------------------------------------------------
+
+   void BufferPool::recycle(uint8_t *buffer)
+   {
+      std::lock_guard<std::mutex> lock(mut);
+      freeBuffers.push_back(buffer);
+   }
+
+   std::size_t BufferPool::bufferSize() const
+   {
+      return size;
+   }
+
+   std::size_t BufferPool::available() const
+   {
+      std::lock_guard<std::mutex> lock(mut);
+      return freeBuffers.size();
+   }
+
+   std::size_t BufferPool::allocated() const
+   {
+      std::lock_guard<std::mutex> lock(mut);
+      return storage.size();
+   }
+}
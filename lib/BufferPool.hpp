@@ -0,0 +1,129 @@
+#ifndef NET_BUFFER_POOL_HPP
+#define NET_BUFFER_POOL_HPP
+
+#include "Socket.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//!
+//! \file BufferPool.hpp
+//! \brief Reusable fixed size buffers for received datagrams
+//!
+namespace nettle
+{
+   class BufferPool;
+
+   //!
+   //! \class DatagramBuffer
+   //! \brief A pooled buffer and what was received into it. Move-only, the buffer
+   //!        goes back to its pool when the last owner releases or destroys it
+   //!
+   class DatagramBuffer
+   {
+   public:
+      //!
+      //! \brief Construct an empty buffer that holds no storage
+      //!
+      DatagramBuffer();
+
+      DatagramBuffer(DatagramBuffer &&other) noexcept;
+      DatagramBuffer &operator=(DatagramBuffer &&other) noexcept;
+
+      DatagramBuffer(const DatagramBuffer &) = delete;
+      DatagramBuffer &operator=(const DatagramBuffer &) = delete;
+
+      //!
+      //! \brief Returns the buffer to its pool
+      //!
+      ~DatagramBuffer();
+
+      //!
+      //! \retval Start of the buffer, nullptr if empty
+      //!
+      uint8_t *data() const;
+
+      //!
+      //! \retval Size of the buffer in bytes
+      //!
+      std::size_t capacity() const;
+
+      //!
+      //! \brief Hand the storage back to the pool early
+      //! \post The buffer is empty
+      //!
+      void release();
+
+      //!
+      //! \retval true iff the buffer holds storage
+      //!
+      explicit operator bool() const;
+
+      std::size_t length;                              //! Bytes received into the buffer
+      sockaddr_in source;                              //! Sender of the datagram
+      std::chrono::system_clock::time_point timestamp; //! When the datagram was received
+
+   private:
+      friend class BufferPool;
+
+      DatagramBuffer(std::shared_ptr<BufferPool> pool, uint8_t *buffer);
+
+      std::shared_ptr<BufferPool> pool;
+      uint8_t *buffer;
+   };
+
+   //!
+   //! \class BufferPool
+   //! \brief Thread safe pool of equally sized buffers, sized at runtime
+   //!
+   class BufferPool : public std::enable_shared_from_this<BufferPool>
+   {
+   public:
+      //!
+      //! \brief Create a pool
+      //! \param bufferSize Size of every buffer in bytes
+      //! \param preallocate Number of buffers to allocate up front
+      //! \note The pool grows when it runs dry and keeps everything it hands out
+      //!       for reuse, so it settles at the peak number of buffers in flight
+      //!
+      static std::shared_ptr<BufferPool> create(std::size_t bufferSize, std::size_t preallocate);
+
+      //!
+      //! \brief Take a buffer from the pool, allocating one if none are free
+      //!
+      DatagramBuffer acquire();
+
+      //!
+      //! \retval Size of every buffer in bytes
+      //!
+      std::size_t bufferSize() const;
+
+      //!
+      //! \retval Buffers sitting in the pool ready for reuse
+      //!
+      std::size_t available() const;
+
+      //!
+      //! \retval Buffers the pool has allocated in total
+      //!
+      std::size_t allocated() const;
+
+   private:
+      friend class DatagramBuffer;
+
+      BufferPool(std::size_t bufferSize);
+
+      void recycle(uint8_t *buffer);
+
+      std::size_t size;
+      mutable std::mutex mut;
+      std::vector<uint8_t *> freeBuffers;
+      std::vector<std::unique_ptr<uint8_t[]>> storage;
+   };
+}
+
+#endif
@@ -6,6 +6,10 @@
 #define NETTLE_SOCKETHANDLER_HPP
 
 #include "Socket.hpp"
+#include "BufferPool.hpp"
+
+#include <cstdint>
+#include <span>
 
 //!
 //! \file ConnectionHandler.hpp
@@ -22,11 +26,40 @@ namespace nettle
         virtual void serverStopped()  = 0;
 
         //! \brief Retrieve a new connection
+        //! \param connection Handed over by move, it is closed when the
+        //!        handler destroys it. Move it into a queue or event loop
+        //!        of the handler's own to keep it past the call
         //! \note This call is not handled asynchronously and will be 
         //!       blocking the tcp server. It is up to the callee to 
         //!       manage any asynchronous work to ensure that the 
-        //!       server is non blocking 
+        //!       server is non blocking. The connection counts into the
+        //!       server's metrics until it is closed, which is when it
+        //!       is counted closed, and it may outlive the server. The
+        //!       server's connection deadline only runs until the call
+        //!       returns
         virtual void newConnection(nettle::Socket connection) = 0;
+
+        //! \brief Data is ready to be read on a connection owned by a
+        //!        server running in TcpServeMode::EVENT_LOOP
+        //! \note This is called on the event loop thread that owns the
+        //!       connection. Blocking here stalls every other connection
+        //!       on that loop, so the connection is non-blocking: read it
+        //!       with readSome, which reports WOULD_BLOCK once it is drained
+        //! \returns true to keep the connection open, false to have the
+        //!          server close it
+        virtual bool connectionReady([[maybe_unused]] nettle::Socket &connection) { return false; }
+
+        //! \brief An event loop connection is about to be closed by the server
+        virtual void connectionClosed([[maybe_unused]] nettle::Socket &connection) { }
+    };
+
+    //!
+    //! \brief A received datagram, only valid for the duration of the callback
+    //!
+    struct Datagram {
+        uint8_t *data;      //! Datagram bytes
+        std::size_t length; //! Number of bytes received, capped at the buffer size
+        sockaddr_in source; //! Address the datagram came from
     };
 
     //!
@@ -39,6 +72,41 @@ namespace nettle
         virtual void serverStopping() = 0;
         virtual void serverStopped()  = 0;
         virtual void newData(uint8_t data[N]) = 0;
+
+        //! \brief Retrieve every datagram pulled in by one receive call
+        //! \note The default hands each datagram to newData in order
+        virtual void newBatch(std::span<const Datagram> batch) {
+
+            for(auto &datagram : batch) {
+                newData(datagram.data);
+            }
+        }
+    };
+
+    //!
+    //! \class UdpDatagramHandler
+    //! \brief Length aware UDP handler fed from a runtime sized buffer pool
+    //!
+    class UdpDatagramHandler {
+    public:
+        virtual void serverStarted()  = 0;
+        virtual void serverStopping() = 0;
+        virtual void serverStopped()  = 0;
+
+        //! \brief Retrieve a datagram
+        //! \note To keep the buffer past the callback move it out of the given
+        //!       reference, it returns to the pool whenever it is released or
+        //!       destroyed. Anything left in place is reused by the server
+        virtual void newDatagram(nettle::DatagramBuffer &datagram) = 0;
+
+        //! \brief Retrieve every datagram pulled in by one receive call
+        //! \note The default hands each datagram to newDatagram in order
+        virtual void newBatch(std::span<nettle::DatagramBuffer> batch) {
+
+            for(auto &datagram : batch) {
+                newDatagram(datagram);
+            }
+        }
     };
 }
 
@@ -0,0 +1,382 @@
+#include "Framing.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+#include <utility>
+
+namespace nettle
+{
+   // -------------------------------------------------------
+   // FrameFormat
+   // -------------------------------------------------------
+
+   FrameFormat FrameFormat::lengthPrefixed(std::size_t prefixBytes, std::size_t maxFrameSize)
+   {
+      return FrameFormat{FrameKind::LENGTH_PREFIXED, prefixBytes, {}, 0, maxFrameSize};
+   }
+
+   FrameFormat FrameFormat::delimited(std::string delimiter, std::size_t maxFrameSize)
+   {
+      return FrameFormat{FrameKind::DELIMITED, 0, std::move(delimiter), 0, maxFrameSize};
+   }
+
+   FrameFormat FrameFormat::fixedSize(std::size_t frameSize)
+   {
+      return FrameFormat{FrameKind::FIXED_SIZE, 0, {}, frameSize, frameSize};
+   }
+
+#ifndef _MSC_VER
+   namespace
+   {
+      bool validPrefix(std::size_t prefixBytes)
+      {
+         return prefixBytes == 1 || prefixBytes == 2 || prefixBytes == 4 || prefixBytes == 8;
+      }
+
+      FrameResult brokenStream(int error)
+      {
+         return FrameResult{IoStatus::FAILED, {}, error};
+      }
+
+      // Steps past bytes written from iov[index] on, trimming a buffer written in part.
+      // Returns the index of the first buffer with anything left
+      std::size_t skipWritten(std::vector<iovec> &iov, std::size_t index, std::size_t bytes)
+      {
+         while (index < iov.size() && bytes >= iov[index].iov_len)
+         {
+            bytes -= iov[index].iov_len;
+            index++;
+         }
+
+         if (index < iov.size())
+         {
+            iov[index].iov_base = static_cast<uint8_t *>(iov[index].iov_base) + bytes;
+            iov[index].iov_len -= bytes;
+         }
+         return index;
+      }
+   }
+
+   // -------------------------------------------------------
+   // FrameReader
+   // -------------------------------------------------------
+
+   FrameReader::FrameReader(Socket &socket, FrameFormat format, std::size_t bufferSize) :
+         socket(socket),
+         format(std::move(format)),
+         buffer(new uint8_t[std::max<std::size_t>(bufferSize, 1)]),
+         capacity(std::max<std::size_t>(bufferSize, 1))
+   {
+   }
+
+   // -------------------------------------------------------
+   // next
+   // -------------------------------------------------------
+
+   FrameResult FrameReader::next()
+   {
+      FrameResult result{IoStatus::WOULD_BLOCK, {}, 0};
+
+      while (!extract(result))
+      {
+         makeRoom();
+
+         IoResult received = socket.readSome(buffer.get() + end, capacity - end);
+         if (received.bytes == 0)
+         {
+            return FrameResult{received.status, {}, received.error};
+         }
+
+         end += received.bytes;
+      }
+      return result;
+   }
+
+   // -------------------------------------------------------
+   // tryNext
+   // -------------------------------------------------------
+
+   FrameResult FrameReader::tryNext()
+   {
+      FrameResult result{IoStatus::WOULD_BLOCK, {}, 0};
+      extract(result);
+      return result;
+   }
+
+   // -------------------------------------------------------
+   // buffered
+   // -------------------------------------------------------
+
+   std::size_t FrameReader::buffered() const
+   {
+      return end - start;
+   }
+
+   // -------------------------------------------------------
+   // extract
+   // -------------------------------------------------------
+
+   bool FrameReader::extract(FrameResult &result)
+   {
+      const std::size_t available = end - start;
+      const uint8_t *data = buffer.get() + start;
+
+      std::size_t header = 0;
+      std::size_t length = 0;
+      std::size_t trailer = 0;
+
+      switch (format.kind)
+      {
+      case FrameKind::LENGTH_PREFIXED:
+      {
+         if (!validPrefix(format.prefixBytes))
+         {
+            result = brokenStream(EINVAL);
+            return true;
+         }
+
+         if (available < format.prefixBytes)
+         {
+            wanted = 0;
+            return false;
+         }
+
+         for (std::size_t i = 0; i < format.prefixBytes; i++)
+         {
+            length = (length << 8) | data[i];
+         }
+         header = format.prefixBytes;
+
+         if (length > format.maxFrameSize)
+         {
+            result = brokenStream(EMSGSIZE);
+            return true;
+         }
+         break;
+      }
+      case FrameKind::FIXED_SIZE:
+      {
+         if (format.frameSize == 0)
+         {
+            result = brokenStream(EINVAL);
+            return true;
+         }
+         length = format.frameSize;
+         break;
+      }
+      case FrameKind::DELIMITED:
+      {
+         const std::string &delimiter = format.delimiter;
+         if (delimiter.empty())
+         {
+            result = brokenStream(EINVAL);
+            return true;
+         }
+
+         // Only bytes that arrived since the last search (plus a possibly split delimiter) are scanned again
+         std::size_t from = std::max(scanned, start);
+         std::string_view window(reinterpret_cast<const char *>(buffer.get()) + from, end - from);
+         std::size_t found = window.find(delimiter);
+
+         if (found == std::string_view::npos)
+         {
+            scanned = std::max(start, end - std::min(end, delimiter.size() - 1));
+            wanted = 0;
+
+            if (available > format.maxFrameSize + delimiter.size())
+            {
+               result = brokenStream(EMSGSIZE);
+               return true;
+            }
+            return false;
+         }
+
+         length = from + found - start;
+         trailer = delimiter.size();
+         break;
+      }
+      }
+
+      std::size_t total = header + length + trailer;
+      if (available < total)
+      {
+         wanted = total;
+         return false;
+      }
+
+      result = FrameResult{IoStatus::COMPLETE, std::span<const uint8_t>(data + header, length), 0};
+      start += total;
+      scanned = start;
+      wanted = 0;
+      return true;
+   }
+
+   // -------------------------------------------------------
+   // makeRoom
+   // -------------------------------------------------------
+
+   void FrameReader::makeRoom()
+   {
+      if (start == end)
+      {
+         start = end = scanned = 0;
+      }
+
+      // Bytes are only moved once the tail is used up, or the frame being waited on can't fit behind start
+      bool full = (end == capacity);
+      if (start > 0 && (full || start + wanted > capacity))
+      {
+         memmove(buffer.get(), buffer.get() + start, end - start);
+         end -= start;
+         scanned -= start;
+         start = 0;
+      }
+
+      if (end == capacity || wanted > capacity)
+      {
+         std::size_t grown = std::max(capacity * 2, wanted);
+         std::unique_ptr<uint8_t[]> larger(new uint8_t[grown]);
+         memcpy(larger.get(), buffer.get(), end);
+
+         buffer = std::move(larger);
+         capacity = grown;
+      }
+   }
+
+   // -------------------------------------------------------
+   // FrameWriter
+   // -------------------------------------------------------
+
+   FrameWriter::FrameWriter(Socket &socket, FrameFormat format) : socket(socket),
+                                                                  format(std::move(format))
+   {
+   }
+
+   // -------------------------------------------------------
+   // queue
+   // -------------------------------------------------------
+
+   bool FrameWriter::queue(std::span<const uint8_t> payload)
+   {
+      Queued queued;
+      queued.payload = payload;
+
+      switch (format.kind)
+      {
+      case FrameKind::LENGTH_PREFIXED:
+      {
+         if (!validPrefix(format.prefixBytes) || payload.size() > format.maxFrameSize)
+         {
+            return false;
+         }
+
+         if (format.prefixBytes < 8 && (payload.size() >> (8 * format.prefixBytes)) != 0)
+         {
+            return false;
+         }
+
+         std::size_t length = payload.size();
+         for (std::size_t i = format.prefixBytes; i > 0; i--)
+         {
+            queued.prefix[i - 1] = static_cast<uint8_t>(length & 0xFF);
+            length >>= 8;
+         }
+         break;
+      }
+      case FrameKind::FIXED_SIZE:
+         if (payload.size() != format.frameSize)
+         {
+            return false;
+         }
+         break;
+      case FrameKind::DELIMITED:
+         if (format.delimiter.empty() || payload.size() > format.maxFrameSize)
+         {
+            return false;
+         }
+         break;
+      }
+
+      frames.push_back(queued);
+      return true;
+   }
+
+   // -------------------------------------------------------
+   // flush
+   // -------------------------------------------------------
+
+   IoResult FrameWriter::flush()
+   {
+      iov.clear();
+
+      for (Queued &queued : frames)
+      {
+         if (format.kind == FrameKind::LENGTH_PREFIXED)
+         {
+            iov.push_back(iovec{queued.prefix, format.prefixBytes});
+         }
+
+         if (!queued.payload.empty())
+         {
+            iov.push_back(iovec{const_cast<uint8_t *>(queued.payload.data()), queued.payload.size()});
+         }
+
+         if (format.kind == FrameKind::DELIMITED)
+         {
+            iov.push_back(iovec{format.delimiter.data(), format.delimiter.size()});
+         }
+      }
+
+      std::size_t index = skipWritten(iov, 0, written);
+      std::size_t bytes = 0;
+      IoResult result {IoStatus::COMPLETE, 0, 0};
+
+      while (index < iov.size())
+      {
+         result = socket.writeSome(std::span<const iovec>(iov).subspan(index));
+         bytes += result.bytes;
+         index = skipWritten(iov, index, result.bytes);
+
+         // A short write goes on with the rest, the socket says when it is full
+         if (result.status != IoStatus::PARTIAL || result.bytes == 0)
+         {
+            break;
+         }
+      }
+
+      if (index == iov.size() || result.status == IoStatus::CLOSED || result.status == IoStatus::FAILED)
+      {
+         frames.clear();
+         written = 0;
+         return IoResult{(index == iov.size()) ? IoStatus::COMPLETE : result.status, bytes, result.error};
+      }
+
+      written += bytes;
+      bool progressed = result.status == IoStatus::WOULD_BLOCK && bytes > 0;
+      return IoResult{progressed ? IoStatus::PARTIAL : result.status, bytes, 0};
+   }
+
+   // -------------------------------------------------------
+   // write
+   // -------------------------------------------------------
+
+   IoResult FrameWriter::write(std::span<const uint8_t> payload)
+   {
+      if (!queue(payload))
+      {
+         return IoResult{IoStatus::FAILED, 0, EMSGSIZE};
+      }
+      return flush();
+   }
+
+   // -------------------------------------------------------
+   // pending
+   // -------------------------------------------------------
+
+   std::size_t FrameWriter::pending() const
+   {
+      return frames.size();
+   }
+#endif
+}
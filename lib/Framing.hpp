@@ -0,0 +1,182 @@
+#ifndef NET_FRAMING_HPP
+#define NET_FRAMING_HPP
+
+#include "Socket.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+//!
+//! \file Framing.hpp
+//! \brief Buffered message framing over a connected Socket
+//!
+namespace nettle
+{
+   constexpr std::size_t FRAME_READ_BUFFER_SIZE = 64 * 1024;  //! Initial receive buffer of a FrameReader
+   constexpr std::size_t FRAME_MAX_SIZE = 16 * 1024 * 1024;   //! Default largest frame accepted
+
+   //!
+   //! \brief How frames are delimited on the wire
+   //!
+   enum class FrameKind
+   {
+      LENGTH_PREFIXED, //! A big endian length followed by that many bytes
+      DELIMITED,       //! Bytes up to a delimiter sequence
+      FIXED_SIZE       //! Every frame has the same size
+   };
+
+   //!
+   //! \brief Wire format of a framed stream
+   //!
+   struct FrameFormat
+   {
+      FrameKind kind;
+      std::size_t prefixBytes;  //! LENGTH_PREFIXED - Width of the length, 1, 2, 4 or 8
+      std::string delimiter;    //! DELIMITED - Sequence ending each frame, not part of the frame
+      std::size_t frameSize;    //! FIXED_SIZE - Size of every frame
+      std::size_t maxFrameSize; //! Largest frame accepted before the stream is treated as broken
+
+      static FrameFormat lengthPrefixed(std::size_t prefixBytes = 4, std::size_t maxFrameSize = FRAME_MAX_SIZE);
+      static FrameFormat delimited(std::string delimiter, std::size_t maxFrameSize = FRAME_MAX_SIZE);
+      static FrameFormat fixedSize(std::size_t frameSize);
+   };
+
+   //!
+   //! \brief A frame handed out by a FrameReader
+   //!
+   struct FrameResult
+   {
+      IoStatus status;                 //! COMPLETE with a frame, otherwise why none is available
+      std::span<const uint8_t> frame;  //! Frame payload, without prefix or delimiter
+      int error;                       //! errno behind a FAILED read, EMSGSIZE for an oversized frame
+   };
+
+#ifndef _MSC_VER
+   //!
+   //! \class FrameReader
+   //! \brief Splits the byte stream of a socket into frames. Reads as much as
+   //!        the socket has into an internal buffer and hands frames out as
+   //!        views into it, so several small messages cost one recv and no copies
+   //!
+   class FrameReader
+   {
+   public:
+      //!
+      //! \brief Create a reader
+      //! \param socket Connected socket to read from, must outlive the reader
+      //! \param format Wire format of the stream
+      //! \param bufferSize Initial receive buffer, grows to fit larger frames
+      //!
+      FrameReader(Socket &socket, FrameFormat format, std::size_t bufferSize = FRAME_READ_BUFFER_SIZE);
+
+      FrameReader(const FrameReader &) = delete;
+      FrameReader &operator=(const FrameReader &) = delete;
+
+      //!
+      //! \brief Take the next frame, reading from the socket only when none is buffered
+      //! \returns COMPLETE with the frame, or the status of the read that came up
+      //!          short: WOULD_BLOCK (non-blocking) / TIMEOUT (blocking), CLOSED
+      //!          once the peer hung up, FAILED on error or an oversized frame
+      //! \note The frame is valid until next is called again, tryNext leaves it in
+      //!       place so a batch of frames can be collected before handling them.
+      //!       Bytes of an incomplete frame are kept, next can simply be retried
+      //!
+      FrameResult next();
+
+      //!
+      //! \brief Take the next frame only if it is already buffered, never touches the socket
+      //! \returns COMPLETE with the frame, WOULD_BLOCK if no full frame is buffered
+      //!
+      FrameResult tryNext();
+
+      //!
+      //! \retval Bytes received but not yet handed out as frames
+      //!
+      std::size_t buffered() const;
+
+   private:
+      Socket &socket;
+      FrameFormat format;
+
+      std::unique_ptr<uint8_t[]> buffer;
+      std::size_t capacity;
+      std::size_t start {0};   // First byte not handed out
+      std::size_t end {0};     // One past the last byte received
+      std::size_t scanned {0}; // Delimiter search resumes here
+      std::size_t wanted {0};  // Size of the frame being waited on, 0 if unknown
+
+      bool extract(FrameResult &result);
+      void makeRoom();
+   };
+
+   //!
+   //! \class FrameWriter
+   //! \brief Frames messages and writes a batch of them with one gathered write
+   //! \note Payloads are not copied, they must stay valid until a flush has written
+   //!       them completely
+   //!
+   class FrameWriter
+   {
+   public:
+      //!
+      //! \brief Create a writer
+      //! \param socket Connected socket to write to, must outlive the writer
+      //! \param format Wire format of the stream
+      //!
+      FrameWriter(Socket &socket, FrameFormat format);
+
+      FrameWriter(const FrameWriter &) = delete;
+      FrameWriter &operator=(const FrameWriter &) = delete;
+
+      //!
+      //! \brief Queue a frame for the next flush
+      //! \retval false if the payload does not fit the format (too large, or the
+      //!         wrong size for FIXED_SIZE), nothing is queued then
+      //! \note DELIMITED payloads are not searched, they must not contain the delimiter
+      //!
+      bool queue(std::span<const uint8_t> payload);
+
+      //!
+      //! \brief Write every queued frame in order, picking up where an earlier flush stopped
+      //! \returns The bytes this call wrote and
+      //!          - COMPLETE once every queued frame is out, the queue is empty then
+      //!          - TIMEOUT on a blocking socket, WOULD_BLOCK / PARTIAL on a non-blocking one
+      //!            if the socket stopped taking data. The rest stays queued for the next flush
+      //!          - CLOSED if the peer has gone away, FAILED on any other error. The
+      //!            queue is dropped, nothing more can be written
+      //!
+      IoResult flush();
+
+      //!
+      //! \brief Queue a frame and flush
+      //!
+      IoResult write(std::span<const uint8_t> payload);
+
+      //!
+      //! \retval Frames queued and not yet flushed
+      //!
+      std::size_t pending() const;
+
+   private:
+      struct Queued
+      {
+         std::span<const uint8_t> payload;
+         uint8_t prefix[8];
+      };
+
+      Socket &socket;
+      FrameFormat format;
+
+      // Both kept between flushes so a warmed up writer does not allocate
+      std::vector<Queued> frames;
+      std::vector<iovec> iov;
+      std::size_t written {0}; // Bytes of the queued frames an earlier flush got out
+   };
+#endif
+}
+
+#endif
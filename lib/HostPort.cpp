@@ -25,4 +25,10 @@ namespace nettle
       return port;
    }
 
+   bool HostPort::operator==(const HostPort &other) const
+   {
+
+      return port == other.port && address == other.address;
+   }
+
 }
\ No newline at end of file
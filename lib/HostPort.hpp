@@ -5,6 +5,7 @@
 #ifndef NETTLE_HOSTPORT_HPP
 #define NETTLE_HOSTPORT_HPP
 
+#include <functional>
 #include <string>
 
 namespace nettle
@@ -17,10 +18,21 @@ namespace nettle
       std::string getAddress() const;
       short getPort() const;
 
+      bool operator==(const HostPort &other) const;
+
    private:
       std::string address;
       short port;
    };
 }
 
+template <>
+struct std::hash<nettle::HostPort>
+{
+   std::size_t operator()(const nettle::HostPort &hostPort) const noexcept
+   {
+      return std::hash<std::string>()(hostPort.getAddress()) ^ (static_cast<std::size_t>(hostPort.getPort()) << 1);
+   }
+};
+
 #endif // NETTLE_HOSTPORT_HPP
@@ -0,0 +1,421 @@
+#include "IoUring.hpp"
+
+#if defined(__linux__)
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+namespace nettle
+{
+   namespace
+   {
+      int ioUringSetup(unsigned entries, io_uring_params *params)
+      {
+         return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+      }
+
+      int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void *arg, std::size_t argSize)
+      {
+         return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+      }
+
+      int ioUringRegister(int fd, unsigned opcode, void *arg, unsigned args)
+      {
+         return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, args));
+      }
+
+      // Multishot recvmsg arrived in 6.0, the last feature the engine needs
+      bool kernelAtLeast(int major, int minor)
+      {
+         utsname name;
+         int runningMajor = 0;
+         int runningMinor = 0;
+         if (uname(&name) != 0 || sscanf(name.release, "%d.%d", &runningMajor, &runningMinor) != 2)
+         {
+            return false;
+         }
+         return runningMajor > major || (runningMajor == major && runningMinor >= minor);
+      }
+
+      bool probeRing()
+      {
+         if (!kernelAtLeast(6, 0))
+         {
+            return false;
+         }
+
+         // Seccomp filters and sysctls (kernel.io_uring_disabled) can refuse rings outright
+         IoUring ring(8);
+         if (!ring.isOpen())
+         {
+            return false;
+         }
+
+         std::vector<uint8_t> probeStorage(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+         io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probeStorage.data());
+         if (ioUringRegister(ring.fd(), IORING_REGISTER_PROBE, probe, 256) < 0)
+         {
+            return false;
+         }
+
+         for (int op : {IORING_OP_ACCEPT, IORING_OP_RECVMSG, IORING_OP_SEND, IORING_OP_POLL_ADD,
+                        IORING_OP_POLL_REMOVE, IORING_OP_ASYNC_CANCEL})
+         {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            {
+               return false;
+            }
+         }
+
+         BufferRing buffers(ring, 0, 1, 64);
+         return buffers.isOpen();
+      }
+   }
+
+   // ---------------------------------------------------------
+   // supported
+   // ---------------------------------------------------------
+   bool IoUring::supported()
+   {
+      static std::once_flag probed;
+      static bool available = false;
+
+      std::call_once(probed, []() { available = probeRing(); });
+
+      return available;
+   }
+
+   // ---------------------------------------------------------
+   // IoUring
+   // ---------------------------------------------------------
+   IoUring::IoUring(unsigned entries)
+   {
+      // Deferring completion work to the next enter saves interrupting the
+      // submitter, older kernels reject the flags so retry without them
+      params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+      ringFd = ioUringSetup(entries, &params);
+      if (ringFd < 0 && errno == EINVAL)
+      {
+         memset(&params, 0, sizeof(params));
+         ringFd = ioUringSetup(entries, &params);
+      }
+
+      if (ringFd < 0)
+      {
+         return;
+      }
+
+      if (!(params.features & IORING_FEAT_EXT_ARG))
+      {
+         teardown();
+         return;
+      }
+
+      sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+      cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+      if (params.features & IORING_FEAT_SINGLE_MMAP)
+      {
+         sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+      }
+
+      sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+      if (sqRing == MAP_FAILED)
+      {
+         sqRing = nullptr;
+         teardown();
+         return;
+      }
+
+      if (params.features & IORING_FEAT_SINGLE_MMAP)
+      {
+         cqRing = sqRing;
+      }
+      else
+      {
+         cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+         if (cqRing == MAP_FAILED)
+         {
+            cqRing = nullptr;
+            teardown();
+            return;
+         }
+      }
+
+      sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+      void *sqeMemory = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+      if (sqeMemory == MAP_FAILED)
+      {
+         teardown();
+         return;
+      }
+      sqes = static_cast<io_uring_sqe *>(sqeMemory);
+
+      uint8_t *sq = static_cast<uint8_t *>(sqRing);
+      sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+      sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+      sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+
+      // Entries are always used in order so the indirection array is fixed
+      unsigned *sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+      for (unsigned i = 0; i < params.sq_entries; i++)
+      {
+         sqArray[i] = i;
+      }
+
+      uint8_t *cq = static_cast<uint8_t *>(cqRing);
+      cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+      cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+      cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+      cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+      sqeTail = sqeSubmitted = *sqTail;
+   }
+
+   // ---------------------------------------------------------
+   // ~IoUring
+   // ---------------------------------------------------------
+   IoUring::~IoUring()
+   {
+      teardown();
+   }
+
+   // ---------------------------------------------------------
+   // teardown
+   // ---------------------------------------------------------
+   void IoUring::teardown()
+   {
+      if (sqes)
+      {
+         munmap(sqes, sqesSize);
+         sqes = nullptr;
+      }
+
+      if (cqRing && cqRing != sqRing)
+      {
+         munmap(cqRing, cqRingSize);
+      }
+      cqRing = nullptr;
+
+      if (sqRing)
+      {
+         munmap(sqRing, sqRingSize);
+         sqRing = nullptr;
+      }
+
+      if (ringFd >= 0)
+      {
+         close(ringFd);
+         ringFd = -1;
+      }
+   }
+
+   // ---------------------------------------------------------
+   // isOpen
+   // ---------------------------------------------------------
+   bool IoUring::isOpen() const
+   {
+      return ringFd >= 0;
+   }
+
+   // ---------------------------------------------------------
+   // fd
+   // ---------------------------------------------------------
+   int IoUring::fd() const
+   {
+      return ringFd;
+   }
+
+   // ---------------------------------------------------------
+   // getSqe
+   // ---------------------------------------------------------
+   io_uring_sqe *IoUring::getSqe()
+   {
+      if (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= params.sq_entries)
+      {
+         submit();
+
+         if (sqeTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= params.sq_entries)
+         {
+            return nullptr;
+         }
+      }
+
+      io_uring_sqe *sqe = &sqes[sqeTail & sqMask];
+      memset(sqe, 0, sizeof(*sqe));
+      sqeTail++;
+      return sqe;
+   }
+
+   // ---------------------------------------------------------
+   // submit
+   // ---------------------------------------------------------
+   int IoUring::submit(unsigned waitFor, int timeoutMs)
+   {
+      unsigned toSubmit = sqeTail - sqeSubmitted;
+      __atomic_store_n(sqTail, sqeTail, __ATOMIC_RELEASE);
+      sqeSubmitted = sqeTail;
+
+      unsigned flags = 0;
+      io_uring_getevents_arg waitArgs {};
+      __kernel_timespec timeout {};
+
+      if (waitFor > 0)
+      {
+         flags |= IORING_ENTER_GETEVENTS;
+
+         if (timeoutMs >= 0)
+         {
+            timeout.tv_sec = timeoutMs / 1000;
+            timeout.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+            waitArgs.ts = reinterpret_cast<uint64_t>(&timeout);
+         }
+      }
+
+      if (toSubmit == 0 && waitFor == 0)
+      {
+         return 0;
+      }
+
+      while (true)
+      {
+         int result = ioUringEnter(ringFd, toSubmit, waitFor, flags | IORING_ENTER_EXT_ARG, &waitArgs, sizeof(waitArgs));
+         if (result >= 0)
+         {
+            return result;
+         }
+
+         if (errno != EINTR)
+         {
+            return -errno;
+         }
+
+         // Everything was consumed by the interrupted call, only the wait remains
+         toSubmit = 0;
+      }
+   }
+
+   // ---------------------------------------------------------
+   // registerBufferRing
+   // ---------------------------------------------------------
+   int IoUring::registerBufferRing(io_uring_buf_reg &registration)
+   {
+      return ioUringRegister(ringFd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0 ? -errno : 0;
+   }
+
+   // ---------------------------------------------------------
+   // unregisterBufferRing
+   // ---------------------------------------------------------
+   void IoUring::unregisterBufferRing(uint16_t groupId)
+   {
+      io_uring_buf_reg registration {};
+      registration.bgid = groupId;
+      ioUringRegister(ringFd, IORING_UNREGISTER_PBUF_RING, &registration, 1);
+   }
+
+   // ---------------------------------------------------------
+   // BufferRing
+   // ---------------------------------------------------------
+   BufferRing::BufferRing(IoUring &ring, uint16_t groupId, unsigned count, std::size_t bufferSize) : ring(ring),
+                                                                                                      groupId(groupId),
+                                                                                                      count(count),
+                                                                                                      size(bufferSize)
+   {
+      if (!ring.isOpen() || count == 0 || (count & (count - 1)) != 0 || count > 32768)
+      {
+         return;
+      }
+
+      // The kernel wants the ring itself page aligned
+      bufRingSize = count * sizeof(io_uring_buf);
+      void *memory = mmap(nullptr, bufRingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (memory == MAP_FAILED)
+      {
+         return;
+      }
+      bufRing = static_cast<io_uring_buf_ring *>(memory);
+
+      io_uring_buf_reg registration {};
+      registration.ring_addr = reinterpret_cast<uint64_t>(bufRing);
+      registration.ring_entries = count;
+      registration.bgid = groupId;
+
+      if (ring.registerBufferRing(registration) < 0)
+      {
+         return;
+      }
+      registered = true;
+
+      storage = std::make_unique<uint8_t[]>(count * size);
+      for (unsigned i = 0; i < count; i++)
+      {
+         recycle(static_cast<uint16_t>(i));
+      }
+   }
+
+   // ---------------------------------------------------------
+   // ~BufferRing
+   // ---------------------------------------------------------
+   BufferRing::~BufferRing()
+   {
+      if (registered)
+      {
+         ring.unregisterBufferRing(groupId);
+      }
+
+      if (bufRing)
+      {
+         munmap(bufRing, bufRingSize);
+      }
+   }
+
+   // ---------------------------------------------------------
+   // isOpen
+   // ---------------------------------------------------------
+   bool BufferRing::isOpen() const
+   {
+      return registered;
+   }
+
+   // ---------------------------------------------------------
+   // buffer
+   // ---------------------------------------------------------
+   uint8_t *BufferRing::buffer(uint16_t id) const
+   {
+      return storage.get() + static_cast<std::size_t>(id) * size;
+   }
+
+   // ---------------------------------------------------------
+   // bufferSize
+   // ---------------------------------------------------------
+   std::size_t BufferRing::bufferSize() const
+   {
+      return size;
+   }
+
+   // ---------------------------------------------------------
+   // recycle
+   // ---------------------------------------------------------
+   void BufferRing::recycle(uint16_t id)
+   {
+      // Indexed by hand, in C++ the header's flexible array member sits past an
+      // empty struct and no longer lines up with the tail it is overlaid on
+      io_uring_buf &entry = reinterpret_cast<io_uring_buf *>(bufRing)[tail & (count - 1)];
+      entry.addr = reinterpret_cast<uint64_t>(buffer(id));
+      entry.len = static_cast<uint32_t>(size);
+      entry.bid = id;
+
+      tail++;
+      __atomic_store_n(&bufRing->tail, tail, __ATOMIC_RELEASE);
+   }
+}
+#endif
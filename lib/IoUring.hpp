@@ -0,0 +1,196 @@
+#ifndef NET_IO_URING_HPP
+#define NET_IO_URING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#endif
+
+//!
+//! \file IoUring.hpp
+//! \brief Minimal io_uring plumbing (no liburing) used by the servers and sockets
+//!        when they are built for the IO_URING engine
+//!
+namespace nettle
+{
+   //!
+   //! \brief Which kernel interface drives a server's I/O
+   //!
+   enum class IoEngine
+   {
+      POSIX,   //! One syscall per operation (accept, recvmmsg, epoll_wait ..)
+      IO_URING //! Operations queued on an io_uring and submitted / reaped in batches,
+               //! falls back to POSIX when the kernel can't support it
+   };
+
+#if defined(__linux__)
+   //!
+   //! \class IoUring
+   //! \brief A single io_uring instance, not thread safe. Submission entries are
+   //!        queued with getSqe and handed to the kernel in one go by submit
+   //!
+   class IoUring
+   {
+   public:
+      //!
+      //! \brief Check once whether the running kernel offers everything the
+      //!        IO_URING engine relies on (multishot accept / recv, provided
+      //!        buffer rings, waits with a timeout)
+      //! \retval true iff rings can be created and used
+      //!
+      static bool supported();
+
+      //!
+      //! \brief Create a ring
+      //! \param entries Submission queue depth, rounded up to a power of two by the kernel
+      //!
+      explicit IoUring(unsigned entries = 256);
+
+      ~IoUring();
+
+      IoUring(const IoUring &) = delete;
+      IoUring &operator=(const IoUring &) = delete;
+
+      //!
+      //! \retval true iff the ring was set up
+      //!
+      bool isOpen() const;
+
+      //!
+      //! \retval The ring file descriptor
+      //!
+      int fd() const;
+
+      //!
+      //! \brief Take the next free, zeroed submission entry
+      //! \note Submits whatever is queued when the queue is full
+      //! \returns nullptr if no entry could be freed
+      //!
+      io_uring_sqe *getSqe();
+
+      //!
+      //! \brief Hand every queued entry to the kernel and optionally wait for completions
+      //! \param waitFor Completions to wait for
+      //! \param timeoutMs Longest wait, negative waits forever
+      //! \returns Entries submitted, -errno on failure (-ETIME when the wait timed out)
+      //!
+      int submit(unsigned waitFor = 0, int timeoutMs = -1);
+
+      //!
+      //! \brief Call back on every completion that is ready then release them all at once
+      //! \param callback Called with each io_uring_cqe
+      //! \returns Number of completions handled
+      //!
+      template <typename Callback>
+      unsigned forEachCompletion(Callback &&callback)
+      {
+         unsigned head = *cqHead;
+         unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+         unsigned count = 0;
+
+         for (; head != tail; head++, count++)
+         {
+            callback(cqes[head & cqMask]);
+         }
+
+         __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+         return count;
+      }
+
+      //!
+      //! \brief Register a provided buffer ring with the kernel
+      //! \returns 0 on success, -errno otherwise
+      //!
+      int registerBufferRing(io_uring_buf_reg &registration);
+
+      //!
+      //! \brief Unregister a provided buffer ring
+      //!
+      void unregisterBufferRing(uint16_t groupId);
+
+   private:
+      int ringFd {-1};
+      io_uring_params params {};
+
+      void *sqRing {nullptr};
+      void *cqRing {nullptr};
+      std::size_t sqRingSize {0};
+      std::size_t cqRingSize {0};
+      io_uring_sqe *sqes {nullptr};
+      std::size_t sqesSize {0};
+
+      unsigned *sqHead {nullptr};
+      unsigned *sqTail {nullptr};
+      unsigned sqMask {0};
+      unsigned sqeTail {0};
+      unsigned sqeSubmitted {0};
+
+      unsigned *cqHead {nullptr};
+      unsigned *cqTail {nullptr};
+      unsigned cqMask {0};
+      io_uring_cqe *cqes {nullptr};
+
+      void teardown();
+   };
+
+   //!
+   //! \class BufferRing
+   //! \brief Buffers provided to the kernel for multishot receives to pick from
+   //!        (IORING_REGISTER_PBUF_RING). Completions name the buffer they used,
+   //!        which must be handed back with recycle once consumed
+   //!
+   class BufferRing
+   {
+   public:
+      //!
+      //! \brief Allocate and register the buffers
+      //! \param ring Ring the buffers are registered with, must outlive this
+      //! \param groupId Buffer group selected by submission entries
+      //! \param count Number of buffers, a power of two no larger than 32768
+      //! \param bufferSize Size of each buffer
+      //!
+      BufferRing(IoUring &ring, uint16_t groupId, unsigned count, std::size_t bufferSize);
+
+      ~BufferRing();
+
+      BufferRing(const BufferRing &) = delete;
+      BufferRing &operator=(const BufferRing &) = delete;
+
+      //!
+      //! \retval true iff the kernel accepted the buffers
+      //!
+      bool isOpen() const;
+
+      //!
+      //! \retval Start of the buffer with the given id
+      //!
+      uint8_t *buffer(uint16_t id) const;
+
+      //!
+      //! \retval Size of every buffer
+      //!
+      std::size_t bufferSize() const;
+
+      //!
+      //! \brief Give a consumed buffer back to the kernel
+      //!
+      void recycle(uint16_t id);
+
+   private:
+      IoUring &ring;
+      uint16_t groupId;
+      unsigned count;
+      std::size_t size;
+      io_uring_buf_ring *bufRing {nullptr};
+      std::size_t bufRingSize {0};
+      std::unique_ptr<uint8_t[]> storage;
+      uint16_t tail {0};
+      bool registered {false};
+   };
+#endif
+}
+
+#endif
@@ -0,0 +1,239 @@
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <sstream>
+
+namespace nettle
+{
+   namespace
+   {
+      const char *COUNTER_NAMES[COUNTER_COUNT] = {
+          "accepts_total",
+          "accept_failures_total",
+          "connections_rejected_total",
+          "connections_opened_total",
+          "connections_closed_total",
+          "bytes_in_total",
+          "bytes_out_total",
+          "datagrams_in_total",
+          "datagrams_out_total",
+          "syscalls_total",
+          "empty_receives_total",
+          "receive_waits_total",
+          "receive_spins_total",
+          "datagrams_dropped_total",
+          "receive_errors_total",
+          "datagrams_truncated_total"};
+
+      const char *ERROR_NAMES[SOCKET_ERROR_COUNT] = {
+          "SET_SOCK_OPT_RECV_TO",
+          "SET_SOCK_OPT_SEND_TO",
+          "SOCKET_WRITE",
+          "ATTEMPT_INIT_SETUP_SOCKET",
+          "SOCKET_CREATE",
+          "SOCKET_BIND",
+          "SOCKET_LISTEN",
+          "SOCKET_REUSEADDR",
+          "SOCKET_REUSEPORT",
+          "WSAStartup",
+          "SOCKET_CONNECT"};
+
+      std::atomic<std::size_t> nextStripe {0};
+   }
+
+   // -------------------------------------------------------
+   // quantileUs
+   // -------------------------------------------------------
+
+   uint64_t HistogramSnapshot::quantileUs(double q) const
+   {
+      if (count == 0)
+      {
+         return 0;
+      }
+
+      // The observation at rank ceil(q * count), counting from 1, so q = 1 is the largest
+      double wanted = std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(count));
+      uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(wanted), 1);
+      uint64_t seen = 0;
+      for (std::size_t i = 0; i < DURATION_BUCKETS; i++)
+      {
+         seen += buckets[i];
+         if (seen >= rank)
+         {
+            return uint64_t(1) << i;
+         }
+      }
+      return uint64_t(1) << (DURATION_BUCKETS - 1);
+   }
+
+   // -------------------------------------------------------
+   // MetricsSnapshot
+   // -------------------------------------------------------
+
+   uint64_t MetricsSnapshot::get(Counter counter) const
+   {
+      return counters[static_cast<std::size_t>(counter)];
+   }
+
+   uint64_t MetricsSnapshot::errorCount(SocketError error) const
+   {
+      return errors[static_cast<std::size_t>(error)];
+   }
+
+   uint64_t MetricsSnapshot::activeConnections() const
+   {
+      uint64_t opened = get(Counter::CONNECTIONS_OPENED);
+      uint64_t closed = get(Counter::CONNECTIONS_CLOSED);
+
+      // Stripes are read one after the other, a close can be seen before its open
+      return (opened > closed) ? opened - closed : 0;
+   }
+
+   // -------------------------------------------------------
+   // toText
+   // -------------------------------------------------------
+
+   std::string toText(const MetricsSnapshot &snapshot, const std::string &prefix)
+   {
+      std::ostringstream out;
+
+      for (std::size_t i = 0; i < COUNTER_COUNT; i++)
+      {
+         out << "# TYPE " << prefix << "_" << COUNTER_NAMES[i] << " counter\n"
+             << prefix << "_" << COUNTER_NAMES[i] << " " << snapshot.counters[i] << "\n";
+      }
+
+      out << "# TYPE " << prefix << "_active_connections gauge\n"
+          << prefix << "_active_connections " << snapshot.activeConnections() << "\n";
+
+      // Info style gauge, the strategy is the label and the value always 1
+      if (!snapshot.waitStrategy.empty())
+      {
+         out << "# TYPE " << prefix << "_wait_strategy gauge\n"
+             << prefix << "_wait_strategy{strategy=\"" << snapshot.waitStrategy << "\"} 1\n";
+      }
+
+      out << "# TYPE " << prefix << "_socket_errors_total counter\n";
+      for (std::size_t i = 0; i < SOCKET_ERROR_COUNT; i++)
+      {
+         out << prefix << "_socket_errors_total{error=\"" << ERROR_NAMES[i] << "\"} " << snapshot.errors[i] << "\n";
+      }
+
+      // Buckets are cumulative in the exposition format, the last one is +Inf
+      const HistogramSnapshot &histogram = snapshot.handlerDuration;
+      std::string name = prefix + "_handler_duration_us";
+
+      out << "# TYPE " << name << " histogram\n";
+      uint64_t cumulative = 0;
+      for (std::size_t i = 0; i + 1 < DURATION_BUCKETS; i++)
+      {
+         cumulative += histogram.buckets[i];
+         out << name << "_bucket{le=\"" << (uint64_t(1) << i) << "\"} " << cumulative << "\n";
+      }
+      out << name << "_bucket{le=\"+Inf\"} " << histogram.count << "\n"
+          << name << "_sum " << histogram.sumUs << "\n"
+          << name << "_count " << histogram.count << "\n";
+
+      return out.str();
+   }
+
+   // -------------------------------------------------------
+   // error
+   // -------------------------------------------------------
+
+   void Metrics::error(SocketError error)
+   {
+      local().errors[static_cast<std::size_t>(error)].fetch_add(1, std::memory_order_relaxed);
+   }
+
+   // -------------------------------------------------------
+   // observe
+   // -------------------------------------------------------
+
+   void Metrics::observe(std::chrono::steady_clock::duration duration)
+   {
+      auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+      uint64_t micros = (us > 0) ? static_cast<uint64_t>(us) : 0;
+
+      // Bucket i holds (2^(i-1), 2^i] to match its le label, bucket 0 everything up
+      // to 1us. bit_width finds it without a loop
+      std::size_t bucket = (micros > 1) ? std::min<std::size_t>(std::bit_width(micros - 1), DURATION_BUCKETS - 1) : 0;
+
+      Stripe &stripe = local();
+      stripe.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+      stripe.observed.fetch_add(1, std::memory_order_relaxed);
+      stripe.sumUs.fetch_add(micros, std::memory_order_relaxed);
+   }
+
+   // -------------------------------------------------------
+   // snapshot
+   // -------------------------------------------------------
+
+   MetricsSnapshot Metrics::snapshot() const
+   {
+      MetricsSnapshot snapshot;
+
+      for (const Stripe &stripe : stripes)
+      {
+         for (std::size_t i = 0; i < COUNTER_COUNT; i++)
+         {
+            snapshot.counters[i] += stripe.counters[i].load(std::memory_order_relaxed);
+         }
+         for (std::size_t i = 0; i < SOCKET_ERROR_COUNT; i++)
+         {
+            snapshot.errors[i] += stripe.errors[i].load(std::memory_order_relaxed);
+         }
+         for (std::size_t i = 0; i < DURATION_BUCKETS; i++)
+         {
+            snapshot.handlerDuration.buckets[i] += stripe.buckets[i].load(std::memory_order_relaxed);
+         }
+         snapshot.handlerDuration.count += stripe.observed.load(std::memory_order_relaxed);
+         snapshot.handlerDuration.sumUs += stripe.sumUs.load(std::memory_order_relaxed);
+      }
+
+      return snapshot;
+   }
+
+   // -------------------------------------------------------
+   // stripeIndex
+   // -------------------------------------------------------
+
+   std::size_t Metrics::stripeIndex()
+   {
+      // Handed out round robin as threads first count, the same for every Metrics
+      thread_local std::size_t index = nextStripe.fetch_add(1, std::memory_order_relaxed) % STRIPES;
+      return index;
+   }
+
+   // -------------------------------------------------------
+   // countingErrors
+   // -------------------------------------------------------
+
+   std::function<void(SocketError)> countingErrors(Metrics &metrics, std::function<void(SocketError)> errorCb)
+   {
+      return [&metrics, errorCb](SocketError error)
+      {
+         metrics.error(error);
+         if (errorCb)
+         {
+            errorCb(error);
+         }
+      };
+   }
+
+   std::function<void(SocketError)> countingErrors(std::shared_ptr<Metrics> metrics,
+                                                   std::function<void(SocketError)> errorCb)
+   {
+      return [metrics = std::move(metrics), errorCb](SocketError error)
+      {
+         metrics->error(error);
+         if (errorCb)
+         {
+            errorCb(error);
+         }
+      };
+   }
+}
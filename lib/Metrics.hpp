@@ -0,0 +1,176 @@
+#ifndef NET_METRICS_HPP
+#define NET_METRICS_HPP
+
+#include "Socket.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+//!
+//! \file Metrics.hpp
+//! \brief Counters and handler latency histograms for servers and sockets,
+//!        cheap to update from any thread and merged when read
+//!
+namespace nettle
+{
+   //!
+   //! \brief What a Metrics counter counts
+   //!
+   enum class Counter
+   {
+      ACCEPTS,              //! Connections accepted
+      ACCEPT_FAILURES,      //! Accepts that failed for a reason other than a timeout
+      CONNECTIONS_REJECTED, //! Accepted connections turned away by a full queue
+      CONNECTIONS_OPENED,   //! Connections set up and handed to the handler
+      CONNECTIONS_CLOSED,   //! Connections closed again
+      BYTES_IN,             //! Bytes received
+      BYTES_OUT,            //! Bytes sent
+      DATAGRAMS_IN,         //! Datagrams received
+      DATAGRAMS_OUT,        //! Datagrams sent
+      SYSCALLS,             //! Send / receive system calls made
+      EMPTY_RECEIVES,       //! Receive calls that came back without data
+      RECEIVE_WAITS,        //! Times a receive loop blocked until traffic or a stop woke it
+      RECEIVE_SPINS,        //! Empty receives a spinning wait strategy went straight back to the socket after
+      DATAGRAMS_DROPPED,    //! Datagrams received but turned away by a full handoff ring
+      RECEIVE_ERRORS,       //! Receive calls that failed for a reason other than no data
+      DATAGRAMS_TRUNCATED   //! Datagrams larger than the receive buffer, discarded rather than delivered cut short
+   };
+
+   constexpr std::size_t COUNTER_COUNT = static_cast<std::size_t>(Counter::DATAGRAMS_TRUNCATED) + 1; //! Number of counters
+   constexpr std::size_t SOCKET_ERROR_COUNT = static_cast<std::size_t>(SocketError::SOCKET_CONNECT) + 1; //! Number of SocketErrors
+   constexpr std::size_t DURATION_BUCKETS = 24;                                                    //! Histogram buckets, powers of two of a microsecond
+
+   //!
+   //! \brief Distribution of handler durations
+   //!
+   struct HistogramSnapshot
+   {
+      std::array<uint64_t, DURATION_BUCKETS> buckets {}; //! buckets[i] counts durations over 2^(i-1) and up to 2^i us, the last one everything longer
+      uint64_t count = 0;                                //! Durations observed
+      uint64_t sumUs = 0;                                //! Their sum in microseconds
+
+      //!
+      //! \brief Upper bound of the bucket the q quantile (0 - 1) falls in
+      //! \returns Microseconds, 0 without observations. Durations in the last
+      //!          bucket report its lower bound, the histogram can't tell more
+      //!
+      uint64_t quantileUs(double q) const;
+   };
+
+   //!
+   //! \brief Counters merged across threads at one point in time
+   //!
+   struct MetricsSnapshot
+   {
+      std::array<uint64_t, COUNTER_COUNT> counters {};    //! Indexed by Counter
+      std::array<uint64_t, SOCKET_ERROR_COUNT> errors {}; //! Indexed by SocketError
+      HistogramSnapshot handlerDuration;                  //! Time spent in handler callbacks
+      std::string waitStrategy;                           //! Receive wait strategy in effect, empty for servers without one
+
+      //!
+      //! \retval Value of a counter
+      //!
+      uint64_t get(Counter counter) const;
+
+      //!
+      //! \retval Times an error was reported
+      //!
+      uint64_t errorCount(SocketError error) const;
+
+      //!
+      //! \retval Connections opened and not closed yet
+      //!
+      uint64_t activeConnections() const;
+   };
+
+   //!
+   //! \brief Render a snapshot in the Prometheus text exposition format
+   //! \param snapshot Values to render
+   //! \param prefix Prepended to every metric name
+   //!
+   std::string toText(const MetricsSnapshot &snapshot, const std::string &prefix = "nettle");
+
+   //!
+   //! \class Metrics
+   //! \brief Counters spread over cache line sized stripes, a thread always
+   //!        updates the same stripe with relaxed adds so concurrent threads
+   //!        never share a line. snapshot() sums the stripes
+   //! \note A snapshot taken while threads keep counting is not atomic as a
+   //!       whole, every single value in it is
+   //!
+   class Metrics
+   {
+   public:
+      Metrics() = default;
+
+      Metrics(const Metrics &) = delete;
+      Metrics &operator=(const Metrics &) = delete;
+
+      //!
+      //! \brief Add to a counter
+      //!
+      void add(Counter counter, uint64_t amount = 1)
+      {
+         local().counters[static_cast<std::size_t>(counter)].fetch_add(amount, std::memory_order_relaxed);
+      }
+
+      //!
+      //! \brief Count a reported error
+      //!
+      void error(SocketError error);
+
+      //!
+      //! \brief Record how long a handler callback took
+      //!
+      void observe(std::chrono::steady_clock::duration duration);
+
+      //!
+      //! \retval The counters summed over every thread
+      //!
+      MetricsSnapshot snapshot() const;
+
+   private:
+      static constexpr std::size_t STRIPES = 16;
+
+      struct alignas(64) Stripe
+      {
+         std::array<std::atomic<uint64_t>, COUNTER_COUNT> counters {};
+         std::array<std::atomic<uint64_t>, SOCKET_ERROR_COUNT> errors {};
+         std::array<std::atomic<uint64_t>, DURATION_BUCKETS> buckets {};
+         std::atomic<uint64_t> observed {0};
+         std::atomic<uint64_t> sumUs {0};
+      };
+
+      std::array<Stripe, STRIPES> stripes;
+
+      static std::size_t stripeIndex();
+
+      Stripe &local()
+      {
+         return stripes[stripeIndex()];
+      }
+   };
+
+   //!
+   //! \brief Wrap an error callback so every error it gets is counted first
+   //! \param metrics Counts the errors, must outlive the callback
+   //! \param errorCb Called after counting
+   //!
+   std::function<void(SocketError)> countingErrors(Metrics &metrics, std::function<void(SocketError)> errorCb);
+
+   //!
+   //! \brief Wrap an error callback so every error it gets is counted first
+   //! \param metrics Counts the errors, kept alive by the callback
+   //! \param errorCb Called after counting
+   //!
+   std::function<void(SocketError)> countingErrors(std::shared_ptr<Metrics> metrics,
+                                                   std::function<void(SocketError)> errorCb);
+}
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef NET_RING_HPP
+#define NET_RING_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+//!
+//! \file Ring.hpp
+//! \brief A fixed capacity lock-free multi-producer multi-consumer ring
+//!
+namespace nettle
+{
+   //!
+   //! \brief Occupancy and overflow of a Ring
+   //!
+   struct RingStats
+   {
+      std::size_t capacity = 0;  //! Items the ring holds
+      std::size_t depth = 0;     //! Items queued when read
+      std::size_t highWater = 0; //! Most items ever queued at once
+      uint64_t dropped = 0;      //! Pushes turned away because the ring was full
+   };
+
+   //!
+   //! \class Ring
+   //! \brief A bounded MPMC ring without locks. Each slot carries a sequence number
+   //!        telling producers and consumers whose turn it is, so a push is one CAS
+   //!        on the shared tail and a pop of a whole batch one CAS on the head
+   //! \note Never blocks, waiting for items or room is up to the caller
+   //!
+   template <typename T>
+   class Ring
+   {
+   public:
+      //!
+      //! \brief Construct a ring
+      //! \param capacity Items it holds, rounded up to a power of two (at least 2)
+      //!
+      explicit Ring(std::size_t capacity)
+      {
+         std::size_t size = 2;
+         while (size < capacity)
+         {
+            size <<= 1;
+         }
+
+         mask = size - 1;
+         cells = std::make_unique<Cell[]>(size);
+         for (std::size_t i = 0; i < size; i++)
+         {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+         }
+      }
+
+      Ring(const Ring &) = delete;
+      Ring &operator=(const Ring &) = delete;
+
+      //!
+      //! \brief Queue an item if there is room
+      //! \param item Only moved from if it was queued
+      //! \retval true iff the item was queued, a full ring counts it as dropped
+      //!
+      bool tryPush(T &&item)
+      {
+         std::size_t position = tail.load(std::memory_order_relaxed);
+         for (;;)
+         {
+            std::size_t sequence = cells[position & mask].sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<std::intptr_t>(sequence - position);
+
+            if (difference == 0)
+            {
+               if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+               {
+                  break;
+               }
+            }
+            else if (difference < 0)
+            {
+               // The slot still holds the item from one lap back
+               dropCount.fetch_add(1, std::memory_order_relaxed);
+               return false;
+            }
+            else
+            {
+               position = tail.load(std::memory_order_relaxed);
+            }
+         }
+
+         Cell &cell = cells[position & mask];
+         cell.item = std::move(item);
+         cell.sequence.store(position + 1, std::memory_order_release);
+
+         noteDepth(position + 1);
+         return true;
+      }
+
+      //!
+      //! \brief Take the oldest item if there is one
+      //! \param item Set to the item taken
+      //! \retval true iff an item was taken
+      //!
+      bool tryPop(T &item)
+      {
+         std::size_t position = head.load(std::memory_order_relaxed);
+         for (;;)
+         {
+            std::size_t sequence = cells[position & mask].sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<std::intptr_t>(sequence - (position + 1));
+
+            if (difference == 0)
+            {
+               if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+               {
+                  break;
+               }
+            }
+            else if (difference < 0)
+            {
+               return false;
+            }
+            else
+            {
+               position = head.load(std::memory_order_relaxed);
+            }
+         }
+
+         release(position, item);
+         return true;
+      }
+
+      //!
+      //! \brief Take up to max of the oldest items
+      //! \param out Container the items are push_back'ed onto
+      //! \param max Most items to take
+      //! \returns Number of items taken
+      //!
+      template <typename Container>
+      std::size_t popBatch(Container &out, std::size_t max)
+      {
+         std::size_t position = head.load(std::memory_order_relaxed);
+         std::size_t ready;
+         for (;;)
+         {
+            // The run of filled slots at the head is claimed with a single CAS
+            ready = 0;
+            while (ready < max &&
+                   cells[(position + ready) & mask].sequence.load(std::memory_order_acquire) == position + ready + 1)
+            {
+               ready++;
+            }
+
+            if (ready == 0)
+            {
+               std::size_t current = head.load(std::memory_order_relaxed);
+               if (current == position)
+               {
+                  return 0;
+               }
+               position = current;
+               continue;
+            }
+
+            if (head.compare_exchange_weak(position, position + ready, std::memory_order_relaxed))
+            {
+               break;
+            }
+         }
+
+         for (std::size_t i = 0; i < ready; i++)
+         {
+            T item;
+            release(position + i, item);
+            out.push_back(std::move(item));
+         }
+         return ready;
+      }
+
+      //!
+      //! \retval Items the ring holds
+      //!
+      std::size_t capacity() const
+      {
+         return mask + 1;
+      }
+
+      //!
+      //! \retval Occupancy now and at its highest, and the pushes dropped
+      //!
+      RingStats stats() const
+      {
+         RingStats stats;
+         stats.capacity = capacity();
+         stats.depth = distance(tail.load(std::memory_order_relaxed));
+         stats.highWater = peak.load(std::memory_order_relaxed);
+         stats.dropped = dropCount.load(std::memory_order_relaxed);
+         return stats;
+      }
+
+   private:
+      struct Cell
+      {
+         std::atomic<std::size_t> sequence;
+         T item;
+      };
+
+      std::unique_ptr<Cell[]> cells;
+      std::size_t mask;
+
+      // Producers and consumers each hammer their own position, kept a cache line apart
+      alignas(64) std::atomic<std::size_t> tail {0};
+      alignas(64) std::atomic<std::size_t> head {0};
+      alignas(64) std::atomic<std::size_t> peak {0};
+      std::atomic<uint64_t> dropCount {0};
+
+      void release(std::size_t position, T &item)
+      {
+         Cell &cell = cells[position & mask];
+         item = std::move(cell.item);
+         cell.sequence.store(position + mask + 1, std::memory_order_release);
+      }
+
+      std::size_t distance(std::size_t end) const
+      {
+         // Consumers may already be past a position a producer read a moment ago
+         std::size_t start = head.load(std::memory_order_relaxed);
+         return (end > start) ? std::min(end - start, capacity()) : 0;
+      }
+
+      void noteDepth(std::size_t end)
+      {
+         std::size_t depth = distance(end);
+         std::size_t seen = peak.load(std::memory_order_relaxed);
+         while (depth > seen && !peak.compare_exchange_weak(seen, depth, std::memory_order_relaxed))
+         {
+         }
+      }
+   };
+}
+
+#endif
@@ -1,15 +1,35 @@
 #include "Socket.hpp"
+#include "IoUring.hpp"
+#include "Metrics.hpp"
+#include <algorithm>
+#include <chrono>
+#include <climits>
 #include <cstring>
 
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#endif
+
 namespace nettle
 {
     // ---------------------------------------------------------------
     // socket
     // ---------------------------------------------------------------
 
-    Socket::Socket(std::function<void(SocketError)> infoCb) : isInitd(false),
-                                                                socketFd(-1),
-                                                                infoCb(infoCb)
+    Socket::Socket(std::function<void(SocketError)> infoCb) :
+        Socket(std::make_shared<const std::function<void(SocketError)>>(std::move(infoCb)))
+    {
+    }
+
+    // ---------------------------------------------------------------
+    // socket
+    // ---------------------------------------------------------------
+
+    Socket::Socket(std::shared_ptr<const std::function<void(SocketError)>> infoCb) : isInitd(false),
+                                                                                     socketFd(-1),
+                                                                                     sharedInfoCb(std::move(infoCb))
     {
         memset(&sockAddr, 0, sizeof(sockAddr));
 
@@ -30,22 +50,80 @@ namespace nettle
                     sockaddr_in sockAddr):
                                             isInitd(false),
                                             socketFd(-1),
-                                            infoCb(errorCallback)
+                                            sharedInfoCb(std::make_shared<const std::function<void(SocketError)>>(errorCallback))
 
     {
+        recvTimeout.tv_sec  = SOCKET_RECV_TIMEOUT_SEC;
+        recvTimeout.tv_usec = SOCKET_RECV_TIMEOUT_MS;
+        sendTimeout.tv_sec  = SOCKET_SEND_TIMEOUT_SEC;
+        sendTimeout.tv_usec = SOCKET_SEND_TIMEOUT_MS;
+
         setupSocket(socketFd, sockAddr);
     }
 
     // ---------------------------------------------------------------
-    // ~socket
+    // move
     // ---------------------------------------------------------------
 
-    Socket::~Socket()
+    Socket::Socket(Socket &&other) noexcept : isInitd(other.isInitd),
+                                              socketFd(other.socketFd),
+                                              sockAddr(other.sockAddr),
+                                              recvTimeout(other.recvTimeout),
+                                              sendTimeout(other.sendTimeout),
+                                              tuning(std::move(other.tuning)),
+                                              nonBlocking(other.nonBlocking),
+                                              sharedInfoCb(other.sharedInfoCb),
+                                              ioStats(other.ioStats),
+                                              metrics(std::move(other.metrics)),
+                                              zeroCopy(std::move(other.zeroCopy))
+    {
+        other.release();
+    }
+
+    Socket &Socket::operator=(Socket &&other) noexcept
     {
-        if(isInitd)
+        if (this != &other)
         {
-            CLOSE_FD(socketFd);
+            socketClose();
+
+            isInitd     = other.isInitd;
+            socketFd    = other.socketFd;
+            sockAddr    = other.sockAddr;
+            recvTimeout = other.recvTimeout;
+            sendTimeout = other.sendTimeout;
+            tuning      = std::move(other.tuning);
+            nonBlocking = other.nonBlocking;
+            sharedInfoCb = other.sharedInfoCb;
+            ioStats     = other.ioStats;
+            metrics     = std::move(other.metrics);
+            zeroCopy    = std::move(other.zeroCopy);
+
+            other.release();
         }
+        return *this;
+    }
+
+    // ---------------------------------------------------------------
+    // release
+    // ---------------------------------------------------------------
+
+    void Socket::release()
+    {
+        // The descriptor and its pending zero copy buffers belong to another socket now,
+        // the shared error callback stays so the socket can still be set up again
+        isInitd     = false;
+        socketFd    = -1;
+        nonBlocking = false;
+        zeroCopy    = ZeroCopyState();
+    }
+
+    // ---------------------------------------------------------------
+    // ~socket
+    // ---------------------------------------------------------------
+
+    Socket::~Socket()
+    {
+        socketClose();
     }
 
     // ---------------------------------------------------------------
@@ -89,6 +167,29 @@ namespace nettle
         return true;
     }
 
+    // ---------------------------------------------------------------
+    // adoptSocket
+    // ---------------------------------------------------------------
+
+    bool Socket::adoptSocket(int socketFd, sockaddr_in sockAddr, const Socket &listener, bool nonBlocking)
+    {
+        if(this->isInitd)
+        {
+            infoCb(SocketError::ATTEMPT_INIT_SETUP_SOCKET);
+            return false;
+        }
+
+        // accept() copies the listener's options onto the connection, the timeouts
+        // are already in place and SO_REUSEADDR means nothing to a connected socket
+        this->socketFd    = socketFd;
+        this->sockAddr    = sockAddr;
+        this->recvTimeout = listener.recvTimeout;
+        this->sendTimeout = listener.sendTimeout;
+        this->nonBlocking = nonBlocking;
+        this->isInitd     = true;
+        return true;
+    }
+
     // ---------------------------------------------------------------
     // write
     // ---------------------------------------------------------------
@@ -108,8 +209,11 @@ namespace nettle
 
             if(sizeSent == -1)
             {
+               countOut(0);
                return -1;
             }
+
+            countOut(sizeSent);
             
             cBuff     += sizeSent;
             remaining -= sizeSent;
@@ -135,6 +239,8 @@ namespace nettle
                            remaining,
                            0);
 
+            countIn((recvSize > 0) ? recvSize : 0);
+
             if(recvSize == -1)
             {
                return recvSize;
@@ -153,6 +259,691 @@ namespace nettle
         return totalRecv;
     }
 
+#ifndef _MSC_VER
+    namespace
+    {
+        // Moves every byte of the given buffers with readv/writev, rebuilding a small
+        // window of iovecs after each partial transfer so the caller's array is untouched
+        int transferVectored(int socketFd, std::span<const iovec> buffers, bool writing, std::size_t &calls)
+        {
+            constexpr std::size_t WINDOW = 64;
+            iovec window[WINDOW];
+
+            std::size_t index  = 0;
+            std::size_t offset = 0;
+            int total = 0;
+
+            while (true)
+            {
+                while (index < buffers.size() && offset == buffers[index].iov_len)
+                {
+                    index++;
+                    offset = 0;
+                }
+
+                if (index == buffers.size())
+                {
+                    break;
+                }
+
+                std::size_t count = std::min(WINDOW, buffers.size() - index);
+                for (std::size_t i = 0; i < count; i++)
+                {
+                    window[i] = buffers[index + i];
+                }
+                window[0].iov_base = static_cast<char*>(window[0].iov_base) + offset;
+                window[0].iov_len -= offset;
+
+                ssize_t moved = writing ? writev(socketFd, window, static_cast<int>(count))
+                                        : readv(socketFd, window, static_cast<int>(count));
+                calls++;
+
+                if (moved == -1)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return -1;
+                }
+
+                if (moved == 0)
+                {
+                    break;
+                }
+
+                total += static_cast<int>(moved);
+
+                std::size_t remaining = static_cast<std::size_t>(moved);
+                while (remaining > 0)
+                {
+                    std::size_t left = buffers[index].iov_len - offset;
+                    if (remaining < left)
+                    {
+                        offset += remaining;
+                        break;
+                    }
+
+                    remaining -= left;
+                    index++;
+                    offset = 0;
+                }
+            }
+
+            return total;
+        }
+    }
+
+    // ---------------------------------------------------------------
+    // writev
+    // ---------------------------------------------------------------
+
+    int Socket::socketWriteOutv(std::span<const iovec> buffers)
+    {
+        std::size_t calls = 0;
+        int sent = transferVectored(socketFd, buffers, true, calls);
+        countOut((sent > 0) ? sent : 0, 0, calls);
+        return sent;
+    }
+
+    // ---------------------------------------------------------------
+    // readv
+    // ---------------------------------------------------------------
+
+    int Socket::socketReadInv(std::span<const iovec> buffers)
+    {
+        std::size_t calls = 0;
+        int received = transferVectored(socketFd, buffers, false, calls);
+        countIn((received > 0) ? received : 0, 0, calls);
+        return received;
+    }
+
+    namespace
+    {
+        constexpr std::size_t SPLICE_CHUNK = 64 * 1024;
+
+#ifdef MSG_NOSIGNAL
+        constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+        constexpr int SEND_FLAGS = 0;
+#endif
+
+        IoResult endTransfer(std::size_t bytes, int error, bool nonBlocking = false)
+        {
+            switch (error)
+            {
+            case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+            case EWOULDBLOCK:
+#endif
+                // A blocking socket only gives up once its timeout expires
+                if (!nonBlocking)
+                {
+                    return IoResult{IoStatus::TIMEOUT, bytes, 0};
+                }
+                return IoResult{(bytes > 0) ? IoStatus::PARTIAL : IoStatus::WOULD_BLOCK, bytes, 0};
+            case EPIPE:
+            case ECONNRESET:
+                return IoResult{IoStatus::CLOSED, bytes, 0};
+            default:
+                return IoResult{IoStatus::FAILED, bytes, error};
+            }
+        }
+
+#if defined(__linux__)
+        // Splices until count bytes moved, the source ran dry or an error / timeout
+        IoResult spliceAll(int fromFd, int toFd, std::size_t count)
+        {
+            std::size_t moved = 0;
+            while (moved < count)
+            {
+                ssize_t n = splice(fromFd, nullptr, toFd, nullptr,
+                                   std::min(SPLICE_CHUNK, count - moved),
+                                   SPLICE_F_MOVE | SPLICE_F_MORE);
+                if (n < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    return endTransfer(moved, errno);
+                }
+
+                if (n == 0)
+                {
+                    return IoResult{IoStatus::CLOSED, moved, 0};
+                }
+
+                moved += n;
+            }
+            return IoResult{IoStatus::COMPLETE, moved, 0};
+        }
+#endif
+    }
+
+    // ---------------------------------------------------------------
+    // setNonBlocking
+    // ---------------------------------------------------------------
+
+    bool Socket::setNonBlocking(bool enable)
+    {
+        int flags = fcntl(socketFd, F_GETFL, 0);
+        if (flags < 0)
+        {
+            return false;
+        }
+
+        flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+        if (fcntl(socketFd, F_SETFL, flags) < 0)
+        {
+            return false;
+        }
+
+        nonBlocking = enable;
+        return true;
+    }
+
+    // ---------------------------------------------------------------
+    // isNonBlocking
+    // ---------------------------------------------------------------
+
+    bool Socket::isNonBlocking() const
+    {
+        return nonBlocking;
+    }
+
+    // ---------------------------------------------------------------
+    // readSome
+    // ---------------------------------------------------------------
+
+    IoResult Socket::readSome(void *buffer, std::size_t length)
+    {
+        while (true)
+        {
+            ssize_t received = recv(socketFd, buffer, length, 0);
+            countIn((received > 0) ? received : 0);
+
+            if (received < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return endTransfer(0, errno, nonBlocking);
+            }
+
+            if (received == 0 && length > 0)
+            {
+                return IoResult{IoStatus::CLOSED, 0, 0};
+            }
+
+            std::size_t bytes = received;
+            return IoResult{(bytes == length) ? IoStatus::COMPLETE : IoStatus::PARTIAL, bytes, 0};
+        }
+    }
+
+    // ---------------------------------------------------------------
+    // writeSome
+    // ---------------------------------------------------------------
+
+    IoResult Socket::writeSome(const void *buffer, std::size_t length)
+    {
+        while (true)
+        {
+            // A peer that has gone away is reported as CLOSED rather than raising SIGPIPE
+            ssize_t sent = send(socketFd, buffer, length, SEND_FLAGS);
+            countOut((sent > 0) ? sent : 0);
+
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return endTransfer(0, errno, nonBlocking);
+            }
+
+            std::size_t bytes = sent;
+            return IoResult{(bytes == length) ? IoStatus::COMPLETE : IoStatus::PARTIAL, bytes, 0};
+        }
+    }
+
+    IoResult Socket::writeSome(std::span<const iovec> buffers)
+    {
+        // Anything past IOV_MAX is left for the next call, the write is reported as PARTIAL
+        msghdr message {};
+        message.msg_iov    = const_cast<iovec*>(buffers.data());
+        message.msg_iovlen = std::min<std::size_t>(buffers.size(), IOV_MAX);
+
+        std::size_t length = 0;
+        for (const iovec &buffer : buffers)
+        {
+            length += buffer.iov_len;
+        }
+
+        while (true)
+        {
+            ssize_t sent = sendmsg(socketFd, &message, SEND_FLAGS);
+            countOut((sent > 0) ? sent : 0);
+
+            if (sent < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return endTransfer(0, errno, nonBlocking);
+            }
+
+            std::size_t bytes = sent;
+            return IoResult{(bytes == length) ? IoStatus::COMPLETE : IoStatus::PARTIAL, bytes, 0};
+        }
+    }
+
+    // ---------------------------------------------------------------
+    // socketWriteOutLinked
+    // ---------------------------------------------------------------
+
+    IoResult Socket::socketWriteOutLinked(std::span<const iovec> buffers)
+    {
+#if defined(__linux__)
+        constexpr unsigned CHAIN_LENGTH = 64;
+        constexpr uint64_t CANCEL_EVENT = ~0ull;
+
+        if (IoUring::supported())
+        {
+            thread_local IoUring ring(CHAIN_LENGTH);
+
+            if (ring.isOpen())
+            {
+                int waitMs = static_cast<int>(sendTimeout.tv_sec * 1000 + sendTimeout.tv_usec / 1000);
+                std::size_t total = 0;
+
+                for (std::size_t start = 0; start < buffers.size(); start += CHAIN_LENGTH)
+                {
+                    std::size_t count = std::min<std::size_t>(CHAIN_LENGTH, buffers.size() - start);
+
+                    // The whole chain goes out in one submission so the links are never split
+                    for (std::size_t i = 0; i < count; i++)
+                    {
+                        io_uring_sqe *sqe = ring.getSqe();
+                        sqe->opcode    = IORING_OP_SEND;
+                        sqe->fd        = socketFd;
+                        sqe->addr      = reinterpret_cast<uint64_t>(buffers[start + i].iov_base);
+                        sqe->len       = static_cast<uint32_t>(buffers[start + i].iov_len);
+                        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+                        sqe->flags     = (i + 1 < count) ? IOSQE_IO_LINK : 0;
+                        sqe->user_data = start + i;
+                    }
+
+                    std::size_t pending = count;
+                    int error = 0;
+                    std::size_t cancelled = 0;
+                    bool shortSend = false;
+                    bool timedOut = false;
+
+                    while (pending > 0)
+                    {
+                        // A stalled peer is given the send timeout, then the chain is cancelled
+                        int result = ring.submit(1, (waitMs > 0 && !timedOut) ? waitMs : -1);
+                        if (result == -ETIME && !timedOut)
+                        {
+                            io_uring_sqe *sqe = ring.getSqe();
+                            sqe->opcode       = IORING_OP_ASYNC_CANCEL;
+                            sqe->fd           = socketFd;
+                            sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+                            sqe->user_data    = CANCEL_EVENT;
+                            timedOut = true;
+                            continue;
+                        }
+
+                        ring.forEachCompletion([&](const io_uring_cqe &cqe)
+                        {
+                            if (cqe.user_data == CANCEL_EVENT)
+                            {
+                                return;
+                            }
+
+                            pending--;
+                            if (cqe.res > 0)
+                            {
+                                total += cqe.res;
+                                shortSend |= static_cast<std::size_t>(cqe.res) < buffers[cqe.user_data].iov_len;
+                            }
+                            else if (cqe.res == -ECANCELED)
+                            {
+                                // Everything linked behind a failed send completes as cancelled
+                                cancelled++;
+                            }
+                            else if (cqe.res < 0 && error == 0)
+                            {
+                                error = -cqe.res;
+                            }
+                        });
+                    }
+
+                    // The chain may have finished while the cancel was on its way
+                    if (timedOut && (cancelled > 0 || error != 0 || shortSend))
+                    {
+                        return IoResult{IoStatus::TIMEOUT, total, 0};
+                    }
+
+                    if (error != 0)
+                    {
+                        return endTransfer(total, error, nonBlocking);
+                    }
+
+                    if (shortSend)
+                    {
+                        return IoResult{IoStatus::CLOSED, total, 0};
+                    }
+                }
+
+                return IoResult{IoStatus::COMPLETE, total, 0};
+            }
+        }
+#endif
+        int sent = socketWriteOutv(buffers);
+        if (sent < 0)
+        {
+            return endTransfer(0, errno, nonBlocking);
+        }
+        return IoResult{IoStatus::COMPLETE, static_cast<std::size_t>(sent), 0};
+    }
+
+    // ---------------------------------------------------------------
+    // sendfile
+    // ---------------------------------------------------------------
+
+    IoResult Socket::socketSendFile(int fileFd, off_t offset, std::size_t count)
+    {
+#if defined(__linux__)
+        std::size_t sent = 0;
+        while (sent < count)
+        {
+            ssize_t n = sendfile(socketFd, fileFd, &offset, count - sent);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return endTransfer(sent, errno);
+            }
+
+            if (n == 0)
+            {
+                return IoResult{IoStatus::CLOSED, sent, 0};
+            }
+
+            sent += n;
+        }
+        return IoResult{IoStatus::COMPLETE, sent, 0};
+#else
+        return IoResult{IoStatus::FAILED, 0, ENOSYS};
+#endif
+    }
+
+    // ---------------------------------------------------------------
+    // splice
+    // ---------------------------------------------------------------
+
+    IoResult Socket::socketSpliceFromPipe(int pipeFd, std::size_t count)
+    {
+#if defined(__linux__)
+        return spliceAll(pipeFd, socketFd, count);
+#else
+        return IoResult{IoStatus::FAILED, 0, ENOSYS};
+#endif
+    }
+
+    IoResult Socket::socketSpliceToPipe(int pipeFd, std::size_t count)
+    {
+#if defined(__linux__)
+        return spliceAll(socketFd, pipeFd, count);
+#else
+        return IoResult{IoStatus::FAILED, 0, ENOSYS};
+#endif
+    }
+
+    IoResult Socket::socketSpliceTo(Socket &destination, std::size_t count)
+    {
+#if defined(__linux__)
+        int pipeFds[2];
+        if (pipe2(pipeFds, O_CLOEXEC) < 0)
+        {
+            return IoResult{IoStatus::FAILED, 0, errno};
+        }
+
+        // Every chunk pulled into the pipe is pushed out before the next one, so
+        // the pipe never fills and only the sockets' own timeouts can stall this
+        IoResult result{IoStatus::COMPLETE, 0, 0};
+        while (result.bytes < count)
+        {
+            ssize_t n;
+            do
+            {
+                n = splice(socketFd, nullptr, pipeFds[1], nullptr,
+                           std::min(SPLICE_CHUNK, count - result.bytes),
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+            } while (n < 0 && errno == EINTR);
+
+            if (n <= 0)
+            {
+                result = (n == 0) ? IoResult{IoStatus::CLOSED, result.bytes, 0} : endTransfer(result.bytes, errno);
+                break;
+            }
+
+            IoResult out = spliceAll(pipeFds[0], destination.socketFd, n);
+            result.bytes += out.bytes;
+
+            if (out.status != IoStatus::COMPLETE)
+            {
+                result.status = out.status;
+                result.error = out.error;
+                break;
+            }
+        }
+
+        CLOSE_FD(pipeFds[0]);
+        CLOSE_FD(pipeFds[1]);
+        return result;
+#else
+        return IoResult{IoStatus::FAILED, 0, ENOSYS};
+#endif
+    }
+
+    // ---------------------------------------------------------------
+    // zero copy
+    // ---------------------------------------------------------------
+
+    bool Socket::enableZeroCopy(std::size_t threshold)
+    {
+#if defined(__linux__) && defined(SO_ZEROCOPY)
+        int enable = 1;
+        if (setsockopt(socketFd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)) < 0)
+        {
+            return false;
+        }
+
+        zeroCopy.enabled   = true;
+        zeroCopy.threshold = threshold;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    int Socket::socketWriteOutZeroCopy(const void *buffer, int bufferLen, std::function<void(ZeroCopyRelease)> onComplete)
+    {
+#if defined(__linux__) && defined(MSG_ZEROCOPY)
+        if (!zeroCopy.enabled || bufferLen < 0 || static_cast<std::size_t>(bufferLen) < zeroCopy.threshold)
+        {
+            int sent = socketWriteOut(buffer, bufferLen);
+            onComplete(ZeroCopyRelease::COPIED);
+            return sent;
+        }
+
+        const char *cBuff = static_cast<const char*>(buffer);
+        std::size_t remaining = bufferLen;
+        uint32_t firstSend = zeroCopy.sends;
+        bool copiedSome = false;
+
+        while (remaining > 0)
+        {
+            ssize_t sent = send(socketFd, cBuff, remaining, MSG_ZEROCOPY);
+
+            if (sent == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+
+                // Out of pinned page budget, the rest goes out as a normal copy
+                if (errno == ENOBUFS)
+                {
+                    copiedSome = true;
+                    sent = socketWriteOut(cBuff, static_cast<int>(remaining));
+                    if (sent == -1)
+                    {
+                        break;
+                    }
+                    remaining = 0;
+                    break;
+                }
+                break;
+            }
+
+            // Every successful zero copy send takes the next id from the kernel
+            zeroCopy.sends++;
+            cBuff     += sent;
+            remaining -= sent;
+        }
+
+        if (zeroCopy.sends == firstSend)
+        {
+            // Nothing went out zero copy so the kernel holds no reference to the buffer
+            onComplete(ZeroCopyRelease::COPIED);
+        }
+        else
+        {
+            zeroCopy.pending.push_back(PendingZeroCopy{firstSend, zeroCopy.sends - 1, copiedSome, std::move(onComplete)});
+        }
+
+        return (remaining == 0) ? bufferLen : -1;
+#else
+        int sent = socketWriteOut(buffer, bufferLen);
+        onComplete(ZeroCopyRelease::COPIED);
+        return sent;
+#endif
+    }
+
+    std::size_t Socket::reapZeroCopyCompletions(int timeoutMs)
+    {
+#if defined(__linux__) && defined(SO_EE_ORIGIN_ZEROCOPY)
+        if (zeroCopy.pending.empty())
+        {
+            return 0;
+        }
+
+        // The error queue raises POLLERR whatever events are asked for
+        pollfd waitFd {socketFd, 0, 0};
+        if (poll(&waitFd, 1, timeoutMs) <= 0)
+        {
+            return 0;
+        }
+
+        while (true)
+        {
+            char control[128];
+            msghdr message {};
+            message.msg_control    = control;
+            message.msg_controllen = sizeof(control);
+
+            if (recvmsg(socketFd, &message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            {
+                break;
+            }
+
+            for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg))
+            {
+                if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                      (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
+                {
+                    continue;
+                }
+
+                sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+
+                if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                {
+                    continue;
+                }
+
+                completeZeroCopy(err.ee_info, err.ee_data, err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+            }
+        }
+
+        return releaseZeroCopy();
+#else
+        return 0;
+#endif
+    }
+
+    std::size_t Socket::pendingZeroCopy() const
+    {
+        return zeroCopy.pending.size();
+    }
+#endif
+
+    // ---------------------------------------------------------------
+    // completeZeroCopy
+    // ---------------------------------------------------------------
+
+    void Socket::completeZeroCopy(uint32_t first, uint32_t last, bool copied)
+    {
+        if (copied)
+        {
+            for (auto &pending : zeroCopy.pending)
+            {
+                if (pending.firstSend <= last && pending.lastSend >= first)
+                {
+                    pending.copied = true;
+                }
+            }
+        }
+
+        // Ranges normally complete in order, anything early waits until the gap closes
+        auto position = std::lower_bound(zeroCopy.early.begin(), zeroCopy.early.end(), std::make_pair(first, last));
+        zeroCopy.early.insert(position, std::make_pair(first, last));
+
+        while (!zeroCopy.early.empty() && zeroCopy.early.front().first <= zeroCopy.completed)
+        {
+            zeroCopy.completed = std::max(zeroCopy.completed, zeroCopy.early.front().second + 1);
+            zeroCopy.early.pop_front();
+        }
+    }
+
+    // ---------------------------------------------------------------
+    // releaseZeroCopy
+    // ---------------------------------------------------------------
+
+    std::size_t Socket::releaseZeroCopy()
+    {
+        std::size_t released = 0;
+        while (!zeroCopy.pending.empty() && zeroCopy.pending.front().lastSend < zeroCopy.completed)
+        {
+            PendingZeroCopy done = std::move(zeroCopy.pending.front());
+            zeroCopy.pending.pop_front();
+
+            done.release(done.copied ? ZeroCopyRelease::COPIED : ZeroCopyRelease::SENT);
+            released++;
+        }
+        return released;
+    }
+
     // ---------------------------------------------------------------
     // close
     // ---------------------------------------------------------------
@@ -161,8 +952,150 @@ namespace nettle
     {
         if(this->isInitd)
         {
+#if defined(__linux__)
+            // Completions can't be read once the descriptor is gone, the kernel gets a
+            // short grace period independent of the send timeout so close stays cheap
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ZEROCOPY_CLOSE_WAIT_MS);
+            while (!zeroCopy.pending.empty() && std::chrono::steady_clock::now() < deadline)
+            {
+                reapZeroCopyCompletions(10);
+            }
+#endif
+            // Never passed off as free, the owner decides what a buffer the kernel may still read is worth
+            for (auto &pending : zeroCopy.pending)
+            {
+                pending.release(ZeroCopyRelease::UNCONFIRMED);
+            }
+            zeroCopy = ZeroCopyState();
+
             CLOSE_FD(socketFd);
-            this->isInitd = false;
+            this->isInitd     = false;
+            this->nonBlocking = false;
+
+            if (metrics)
+            {
+                metrics->add(Counter::CONNECTIONS_CLOSED);
+            }
+        }
+    }
+
+    // ---------------------------------------------------------------
+    // isOpen
+    // ---------------------------------------------------------------
+
+    bool Socket::isOpen() const
+    {
+        return this->isInitd;
+    }
+
+    // ---------------------------------------------------------------
+    // getSocketFd
+    // ---------------------------------------------------------------
+
+    int Socket::getSocketFd() const
+    {
+        return socketFd;
+    }
+
+    // ---------------------------------------------------------------
+    // setTimeouts
+    // ---------------------------------------------------------------
+
+    void Socket::setTimeouts(std::chrono::milliseconds recv, std::chrono::milliseconds send)
+    {
+        recvTimeout.tv_sec  = static_cast<long>(recv.count() / 1000);
+        recvTimeout.tv_usec = static_cast<long>((recv.count() % 1000) * 1000);
+        sendTimeout.tv_sec  = static_cast<long>(send.count() / 1000);
+        sendTimeout.tv_usec = static_cast<long>((send.count() % 1000) * 1000);
+
+        if (isInitd)
+        {
+            if (setsockopt(socketFd, SOL_SOCKET, SO_RCVTIMEO, (char*)&recvTimeout, sizeof(recvTimeout)) < 0)
+            {
+                infoCb(SocketError::SET_SOCK_OPT_RECV_TO);
+            }
+
+            if (setsockopt(socketFd, SOL_SOCKET, SO_SNDTIMEO, (char*)&sendTimeout, sizeof(sendTimeout)) < 0)
+            {
+                infoCb(SocketError::SET_SOCK_OPT_SEND_TO);
+            }
+        }
+    }
+
+    // ---------------------------------------------------------------
+    // applyTuning
+    // ---------------------------------------------------------------
+
+    const TuningReport &Socket::applyTuning(const TuningProfile &profile, SocketRole role)
+    {
+        // Accepted connections inherit their timeouts from the listener
+        if ((profile.recvTimeout || profile.sendTimeout) && role != SocketRole::TCP_CONNECTION)
+        {
+            auto recv = std::chrono::milliseconds(recvTimeout.tv_sec * 1000 + recvTimeout.tv_usec / 1000);
+            auto send = std::chrono::milliseconds(sendTimeout.tv_sec * 1000 + sendTimeout.tv_usec / 1000);
+            setTimeouts(profile.recvTimeout.value_or(recv), profile.sendTimeout.value_or(send));
+        }
+
+        tuning = (socketFd >= 0) ? nettle::applyTuning(socketFd, profile, role) : TuningReport();
+        return tuning;
+    }
+
+    // ---------------------------------------------------------------
+    // tuningReport
+    // ---------------------------------------------------------------
+
+    const TuningReport &Socket::tuningReport() const
+    {
+        return tuning;
+    }
+
+    // ---------------------------------------------------------------
+    // stats
+    // ---------------------------------------------------------------
+
+    const SocketStats &Socket::stats() const
+    {
+        return ioStats;
+    }
+
+    // ---------------------------------------------------------------
+    // attachMetrics
+    // ---------------------------------------------------------------
+
+    void Socket::attachMetrics(std::shared_ptr<Metrics> metrics)
+    {
+        this->metrics = std::move(metrics);
+    }
+
+    // ---------------------------------------------------------------
+    // countIn / countOut
+    // ---------------------------------------------------------------
+
+    void Socket::countIn(std::size_t bytes, std::size_t datagrams, std::size_t calls)
+    {
+        ioStats.bytesIn += bytes;
+        ioStats.datagramsIn += datagrams;
+        ioStats.syscalls += calls;
+
+        if (metrics)
+        {
+            metrics->add(Counter::BYTES_IN, bytes);
+            metrics->add(Counter::DATAGRAMS_IN, datagrams);
+            metrics->add(Counter::SYSCALLS, calls);
+        }
+    }
+
+    void Socket::countOut(std::size_t bytes, std::size_t datagrams, std::size_t calls)
+    {
+        ioStats.bytesOut += bytes;
+        ioStats.datagramsOut += datagrams;
+        ioStats.syscalls += calls;
+
+        if (metrics)
+        {
+            metrics->add(Counter::BYTES_OUT, bytes);
+            metrics->add(Counter::DATAGRAMS_OUT, datagrams);
+            metrics->add(Counter::SYSCALLS, calls);
         }
     }
 }
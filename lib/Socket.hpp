@@ -18,13 +18,21 @@
 #include <errno.h>
 #include <unistd.h>
 #include <syslog.h>
+#include <sys/uio.h>
 
 #define CLOSE_FD(fd) close(fd)
 #endif
 
 #include <string>
 #include <functional>
+#include <cstdint>
+#include <chrono>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <span>
+
+#include "Tuning.hpp"
 
 //!
 //! \file Sockets.hpp
@@ -36,6 +44,8 @@ namespace nettle
    constexpr int SOCKET_RECV_TIMEOUT_MS = 0;   //! Socket timeout ms for recv sockets
    constexpr int SOCKET_SEND_TIMEOUT_SEC = 10; //! Socket timeout sec for send sockets
    constexpr int SOCKET_SEND_TIMEOUT_MS = 0;   //! Socket timeout ms for send sockets
+   constexpr std::size_t ZEROCOPY_THRESHOLD = 16 * 1024; //! Smallest buffer worth a zero copy send
+   constexpr int ZEROCOPY_CLOSE_WAIT_MS = 50;            //! Longest close waits for zero copy completions
 
    //!
    //! \brief A socket error type
@@ -50,10 +60,60 @@ namespace nettle
       SOCKET_BIND,               //! Socket bind fail
       SOCKET_LISTEN,             //! Socket listen fail
       SOCKET_REUSEADDR,          //! Socket reuse fail
+      SOCKET_REUSEPORT,          //! Socket port sharing fail
       WSAStartup,                //! Socket setup fail
       SOCKET_CONNECT             //! Unable to connect to remote
    };
 
+   //!
+   //! \brief How a socket transfer ended
+   //!
+   enum class IoStatus
+   {
+      COMPLETE,    //! Everything requested was transferred
+      PARTIAL,     //! Some of the request was transferred before the socket ran dry / filled up
+      WOULD_BLOCK, //! Nothing was transferred, a non-blocking socket is not ready
+      TIMEOUT,     //! The socket send/recv timeout expired first
+      CLOSED,      //! The peer hung up or the source ran out of data
+      FAILED       //! The transfer failed, see IoResult::error
+   };
+
+   //!
+   //! \brief Why a zero copy buffer was handed back to its owner
+   //!
+   enum class ZeroCopyRelease
+   {
+      SENT,       //! The kernel sent it without copying and has let go of it
+      COPIED,     //! The kernel copied some or all of it and has let go of it
+      UNCONFIRMED //! The socket closed before the kernel confirmed the release, it may still
+                  //! read the buffer until the data has left the host. Don't reuse or free it
+                  //! unless that is known to be safe
+   };
+
+   //!
+   //! \brief Outcome and progress of a socket transfer
+   //!
+   struct IoResult
+   {
+      IoStatus status;   //! How the transfer ended
+      std::size_t bytes; //! Bytes delivered before it ended
+      int error;         //! errno behind a FAILED transfer, 0 otherwise
+   };
+
+   //!
+   //! \brief Traffic through one socket since it was created
+   //!
+   struct SocketStats
+   {
+      uint64_t bytesIn = 0;      //! Bytes received
+      uint64_t bytesOut = 0;     //! Bytes sent
+      uint64_t datagramsIn = 0;  //! Datagrams received
+      uint64_t datagramsOut = 0; //! Datagrams sent
+      uint64_t syscalls = 0;     //! Send / receive system calls made
+   };
+
+   class Metrics;
+
    //!
    //! \brief A convenient socket error sink
    //!
@@ -88,6 +148,9 @@ namespace nettle
       case SocketError::SOCKET_REUSEADDR:
          std::cerr << "SOCKET_REUSEADDR" << std::endl;
          break;
+      case SocketError::SOCKET_REUSEPORT:
+         std::cerr << "SOCKET_REUSEPORT" << std::endl;
+         break;
       default:
          break;
       }
@@ -96,6 +159,7 @@ namespace nettle
    //!
    //! \class Socket
    //! \brief Socket abstraction with read/write functionality
+   //! \note Move-only, a Socket owns its descriptor and closes it when destroyed
    //!
    class Socket
    {
@@ -115,6 +179,31 @@ namespace nettle
       //!
       Socket(std::function<void(SocketError)> &errorCallback, int socketFd, sockaddr_in sockAddr);
 
+      //!
+      //! \brief Socket Constructor sharing the error callback of other sockets instead
+      //!        of copying it, e.g. a server's with every connection it accepts
+      //!        Note: init method must be called before use
+      //! \param errorCallback Function to call when an error occurs, never null
+      //!
+      explicit Socket(std::shared_ptr<const std::function<void(SocketError)>> errorCallback);
+
+      Socket(const Socket &) = delete;
+      Socket &operator=(const Socket &) = delete;
+
+      //!
+      //! \brief Take over the descriptor and state of another socket
+      //! \post other holds no descriptor, closing or destroying it does nothing. It
+      //!       keeps its error callback and can be set up again
+      //!
+      Socket(Socket &&other) noexcept;
+
+      //!
+      //! \brief Close this socket and take over the descriptor and state of another
+      //! \post other holds no descriptor, closing or destroying it does nothing. It
+      //!       keeps its error callback and can be set up again
+      //!
+      Socket &operator=(Socket &&other) noexcept;
+
       //!
       //! \brief Socket Destructor
       //!
@@ -136,6 +225,142 @@ namespace nettle
       //!
       int socketReadIn(void *buffer, int bufferLen);
 
+#ifndef _MSC_VER
+      //!
+      //! \brief Switch the socket between blocking and non-blocking mode (O_NONBLOCK)
+      //! \param enable true to make every call on the socket return immediately
+      //! \retval true iff the mode was applied
+      //! \note socketReadIn / socketWriteOut return -1 in non-blocking mode as
+      //!       soon as the socket is not ready, use readSome / writeSome instead
+      //!
+      bool setNonBlocking(bool enable);
+
+      //!
+      //! \retval true iff the socket is in non-blocking mode
+      //!
+      bool isNonBlocking() const;
+
+      //!
+      //! \brief Read whatever is available, up to length bytes, with a single recv
+      //! \param buffer The buffer to read to
+      //! \param length Length of the given buffer
+      //! \returns COMPLETE if the buffer was filled, PARTIAL if fewer bytes were
+      //!          available, WOULD_BLOCK if none were (TIMEOUT when blocking),
+      //!          CLOSED once the peer has shut down its side
+      //!
+      IoResult readSome(void *buffer, std::size_t length);
+
+      //!
+      //! \brief Write as much of the buffer as the socket takes with a single send
+      //! \param buffer The buffer to write out
+      //! \param length Length of the given buffer
+      //! \returns COMPLETE if everything was sent, PARTIAL if the send buffer
+      //!          filled up, WOULD_BLOCK if it was already full (TIMEOUT when
+      //!          blocking), CLOSED if the peer has gone away
+      //!
+      IoResult writeSome(const void *buffer, std::size_t length);
+
+      //!
+      //! \brief Gathered write of as much of the buffers as the socket takes with a single sendmsg
+      //! \param buffers The buffers to write out, left untouched
+      //! \returns The same as writeSome for the buffers' total length
+      //!
+      IoResult writeSome(std::span<const iovec> buffers);
+
+      //!
+      //! \brief Write every buffer in order as a chain of linked io_uring sends,
+      //!        submitted and reaped with one syscall per 64 buffers
+      //! \param buffers The buffers to write out, left untouched
+      //! \returns Bytes sent before the chain completed or broke. A failed send
+      //!          cancels the rest, a stalled peer ends as TIMEOUT
+      //! \note Falls back to socketWriteOutv where io_uring is unavailable.
+      //!       Uses a ring owned by the calling thread
+      //!
+      IoResult socketWriteOutLinked(std::span<const iovec> buffers);
+
+      //!
+      //! \brief Gathered write of every buffer in order with as few syscalls as possible
+      //! \param buffers The buffers to write out, left untouched
+      //! \returns Total bytes sent, -1 on error
+      //! \note Partial writes resume mid buffer, nothing is copied into a staging buffer
+      //!
+      int socketWriteOutv(std::span<const iovec> buffers);
+
+      //!
+      //! \brief Scattered read filling every buffer in order
+      //! \param buffers The buffers to read to
+      //! \returns Total bytes received, short if the peer closed, -1 on error
+      //!
+      int socketReadInv(std::span<const iovec> buffers);
+
+      //!
+      //! \brief Send part of a file without copying it through user space (sendfile)
+      //! \param fileFd File to read from
+      //! \param offset Offset in the file to start at, the file position is not moved
+      //! \param count Number of bytes to send
+      //! \returns Bytes sent and why the transfer ended. A file shorter than
+      //!          requested ends as CLOSED, a stalled peer as TIMEOUT
+      //!
+      IoResult socketSendFile(int fileFd, off_t offset, std::size_t count);
+
+      //!
+      //! \brief Move bytes from a pipe into this socket (splice)
+      //! \param pipeFd Read end of a pipe
+      //! \param count Number of bytes to move
+      //!
+      IoResult socketSpliceFromPipe(int pipeFd, std::size_t count);
+
+      //!
+      //! \brief Move bytes from this socket into a pipe (splice)
+      //! \param pipeFd Write end of a pipe
+      //! \param count Number of bytes to move
+      //! \note Blocks while the pipe is full
+      //!
+      IoResult socketSpliceToPipe(int pipeFd, std::size_t count);
+
+      //!
+      //! \brief Relay bytes from this socket to another socket through a kernel pipe
+      //! \param destination Socket to write to, may be this socket
+      //! \param count Number of bytes to relay
+      //! \returns Bytes that reached the destination
+      //!
+      IoResult socketSpliceTo(Socket &destination, std::size_t count);
+
+      //!
+      //! \brief Opt in to zero copy sends (SO_ZEROCOPY)
+      //! \param threshold Buffers smaller than this are copied as usual, pinning
+      //!        pages and reading completions costs more than copying them
+      //! \retval true iff the kernel supports zero copy on this socket
+      //!
+      bool enableZeroCopy(std::size_t threshold = ZEROCOPY_THRESHOLD);
+
+      //!
+      //! \brief Write out a buffer without copying it into the kernel (MSG_ZEROCOPY)
+      //! \param buffer The buffer to write out, it must not be modified or freed
+      //!        until onComplete runs
+      //! \param bufferLen Length of the given buffer
+      //! \param onComplete Called once the kernel no longer references the buffer,
+      //!        with COPIED if the kernel fell back to copying it anyway. Runs
+      //!        immediately for copied sends, otherwise from reapZeroCopyCompletions,
+      //!        or from socketClose with UNCONFIRMED if no completion arrived in time
+      //! \returns Number of bytes sent, -1 on error
+      //!
+      int socketWriteOutZeroCopy(const void *buffer, int bufferLen, std::function<void(ZeroCopyRelease)> onComplete);
+
+      //!
+      //! \brief Read zero copy completions off the socket error queue and run
+      //!        the callbacks of every buffer the kernel has released
+      //! \param timeoutMs Time to wait for a completion if none are ready, 0 polls
+      //! \returns Number of callbacks run
+      //!
+      std::size_t reapZeroCopyCompletions(int timeoutMs = 0);
+
+      //!
+      //! \retval Number of zero copy buffers still held by the kernel
+      //!
+      std::size_t pendingZeroCopy() const;
+#endif
+
       //!
       //! \brief Setup a socket - Errors reported via errorCallback
       //! \param socketFd Socket file desc
@@ -144,12 +369,70 @@ namespace nettle
       //!
       bool setupSocket(int socketFd, sockaddr_in sockAddr);
 
+      //!
+      //! \brief Take over a connection accepted on listener without any system call,
+      //!        its timeouts are the ones it inherited from the listener
+      //! \param socketFd Accepted socket file desc
+      //! \param sockAddr Peer address
+      //! \param listener Set up socket the connection was accepted on
+      //! \param nonBlocking The connection was accepted with SOCK_NONBLOCK
+      //! \returns true iff socket is setup
+      //!
+      bool adoptSocket(int socketFd, sockaddr_in sockAddr, const Socket &listener, bool nonBlocking = false);
+
       //!
       //! \brief Close the socket
+      //! \note Zero copy buffers still pending get up to ZEROCOPY_CLOSE_WAIT_MS to
+      //!       complete, the rest are handed back as ZeroCopyRelease::UNCONFIRMED
       //! \post Socket _COULD_ be re-setup
       //!
       void socketClose();
 
+      //!
+      //! \brief Check if the socket is setup and has not been closed
+      //! \retval true iff the socket holds an open descriptor
+      //!
+      bool isOpen() const;
+
+      //!
+      //! \retval The socket file descriptor, -1 if never set up
+      //!
+      int getSocketFd() const;
+
+      //!
+      //! \brief Change the send / recv timeouts, applied right away on a set up
+      //!        socket, otherwise by setupSocket
+      //!
+      void setTimeouts(std::chrono::milliseconds recv, std::chrono::milliseconds send);
+
+      //!
+      //! \brief Apply a tuning profile, its timeouts through setTimeouts and its other
+      //!        options straight to the descriptor if there is one. TCP_CONNECTION
+      //!        sockets skip the timeouts, they inherit them from the listener
+      //! \param profile Options to set
+      //! \param role What the socket is used for, decides which options apply
+      //! \returns Which options took effect, also kept for tuningReport
+      //!
+      const TuningReport &applyTuning(const TuningProfile &profile, SocketRole role);
+
+      //!
+      //! \retval Outcome of the last applyTuning
+      //!
+      const TuningReport &tuningReport() const;
+
+      //!
+      //! \retval Traffic counted on this socket
+      //! \note Kept by the socket's own thread, read it from there
+      //!
+      const SocketStats &stats() const;
+
+      //!
+      //! \brief Also count this socket's traffic, and its close as a closed connection,
+      //!        into shared metrics, e.g. a server's
+      //! \param metrics Kept alive by the socket, nullptr stops counting into it
+      //!
+      void attachMetrics(std::shared_ptr<Metrics> metrics);
+
    protected:
       bool isInitd;
       int socketFd;
@@ -157,8 +440,53 @@ namespace nettle
 
       struct timeval recvTimeout;
       struct timeval sendTimeout;
+      TuningReport tuning;
+
+      bool nonBlocking = false;
+
+      std::shared_ptr<const std::function<void(SocketError)>> sharedInfoCb;
+
+      //!
+      //! \brief Report an error to the error callback
+      //!
+      void infoCb(SocketError error) const
+      {
+         (*sharedInfoCb)(error);
+      }
+
+      SocketStats ioStats;
+      std::shared_ptr<Metrics> metrics;
+
+      //!
+      //! \brief Count traffic of the given number of system calls
+      //!
+      void countIn(std::size_t bytes, std::size_t datagrams = 0, std::size_t calls = 1);
+      void countOut(std::size_t bytes, std::size_t datagrams = 0, std::size_t calls = 1);
+
+   private:
+      struct PendingZeroCopy
+      {
+         uint32_t firstSend;                           //! Kernel id of the first send covering the buffer
+         uint32_t lastSend;                            //! Kernel id of the last send covering the buffer
+         bool copied;                                  //! The kernel copied some part of it
+         std::function<void(ZeroCopyRelease)> release; //! Hands the buffer back to its owner
+      };
+
+      struct ZeroCopyState
+      {
+         bool enabled = false;
+         std::size_t threshold = ZEROCOPY_THRESHOLD;
+         uint32_t sends = 0;                              //! Zero copy sends made, mirrors the kernel's counter
+         uint32_t completed = 0;                          //! Every send id below this has completed
+         std::deque<std::pair<uint32_t, uint32_t>> early; //! Completed ranges reported ahead of completed
+         std::deque<PendingZeroCopy> pending;
+      };
+
+      ZeroCopyState zeroCopy;
 
-      std::function<void(SocketError)> infoCb;
+      void release();
+      void completeZeroCopy(uint32_t first, uint32_t last, bool copied);
+      std::size_t releaseZeroCopy();
    };
 }
 
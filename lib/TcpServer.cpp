@@ -1,6 +1,178 @@
 #include "TcpServer.hpp"
 #include <cstring>
+#include <memory>
 #include <thread>
+#include <unordered_map>
+
+#ifndef _MSC_VER
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+namespace
+{
+   // ---------------------------------------------------------
+   // legacyConfig
+   // ---------------------------------------------------------
+   nettle::TcpServerConfig legacyConfig(int maxPendingRequests, int msSleepBetweenReq)
+   {
+      // Defaults for everything the older constructor has no parameter for
+      nettle::TcpServerConfig config;
+      config.maxPendingRequests = maxPendingRequests;
+      config.msSleepBetweenReq  = msSleepBetweenReq;
+      return config;
+   }
+
+#ifndef _MSC_VER
+   // Idle timeouts are coarse, a 10 ms tick keeps the loops from waking for each connection
+   constexpr std::chrono::milliseconds IDLE_TICK {10};
+
+   // How long an event loop stops accepting after running out of descriptors or
+   // memory, unless one of its connections closes first
+   constexpr std::chrono::milliseconds ACCEPT_BACKOFF {100};
+
+   // ---------------------------------------------------------
+   // acceptWaitMs
+   // ---------------------------------------------------------
+   int acceptWaitMs(const timeval &recvTimeout)
+   {
+      // A listener without a receive timeout still wakes its acceptor now and then
+      int waitMs = static_cast<int>(recvTimeout.tv_sec * 1000 + recvTimeout.tv_usec / 1000);
+      return (waitMs > 0) ? waitMs : nettle::SOCKET_RECV_TIMEOUT_SEC * 1000;
+   }
+
+   // ---------------------------------------------------------
+   // outOfResources
+   // ---------------------------------------------------------
+   bool outOfResources(int error)
+   {
+      return error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM;
+   }
+
+   // ---------------------------------------------------------
+   // waitMs
+   // ---------------------------------------------------------
+   int waitMs(const nettle::TimerWheel &wheel)
+   {
+      auto deadline = wheel.nextDeadline();
+      if (!deadline)
+      {
+         return -1;
+      }
+
+      // Rounded up, waking a little early would only find nothing expired yet
+      auto remaining = std::chrono::ceil<std::chrono::milliseconds>(*deadline - nettle::TimerWheel::Clock::now());
+      return static_cast<int>(std::max<int64_t>(remaining.count(), 0));
+   }
+#endif
+
+#if defined(__linux__)
+   // io_uring user data, connections carry their fd and a generation so a late
+   // completion for a closed descriptor is never mistaken for its reuse
+   constexpr uint64_t ACCEPT_EVENT = 1;
+   constexpr uint64_t WAKE_EVENT = 2;
+   constexpr uint64_t CANCEL_EVENT = 3;
+   constexpr uint64_t CONNECTION_EVENT = 1ull << 63;
+
+   uint64_t connectionEvent(int fd, uint32_t generation)
+   {
+      return CONNECTION_EVENT | (static_cast<uint64_t>(generation & 0x7fffffff) << 32) | static_cast<uint32_t>(fd);
+   }
+
+   // ---------------------------------------------------------
+   // armAccept
+   // ---------------------------------------------------------
+   bool armAccept(nettle::IoUring &ring, int listenFd, int flags = SOCK_CLOEXEC)
+   {
+      io_uring_sqe *sqe = ring.getSqe();
+      if (!sqe)
+      {
+         return false;
+      }
+
+      // One submission keeps accepting until it fails or is cancelled
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->fd = listenFd;
+      sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+      sqe->accept_flags = flags;
+      sqe->user_data = ACCEPT_EVENT;
+      return true;
+   }
+
+   // ---------------------------------------------------------
+   // armPoll
+   // ---------------------------------------------------------
+   bool armPoll(nettle::IoUring &ring, int fd, uint64_t event)
+   {
+      io_uring_sqe *sqe = ring.getSqe();
+      if (!sqe)
+      {
+         return false;
+      }
+
+      uint32_t mask = POLLIN | POLLRDHUP;
+#if __BYTE_ORDER == __BIG_ENDIAN
+      mask = (mask << 16) | (mask >> 16);
+#endif
+
+      // Single shot and re-armed after every wake-up, which keeps the level
+      // triggered behaviour of the epoll loop for partially read input
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = fd;
+      sqe->poll32_events = mask;
+      sqe->user_data = event;
+      return true;
+   }
+
+   // ---------------------------------------------------------
+   // cancelAccept
+   // ---------------------------------------------------------
+   void cancelAccept(nettle::IoUring &ring, bool armed)
+   {
+      if (!armed)
+      {
+         return;
+      }
+
+      io_uring_sqe *sqe = ring.getSqe();
+      if (!sqe)
+      {
+         return;
+      }
+
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = ACCEPT_EVENT;
+      sqe->user_data = CANCEL_EVENT;
+
+      // Connections accepted before the cancel landed are still owed a close
+      for (int attempt = 0; armed && attempt < 10; attempt++)
+      {
+         ring.submit(1, 100);
+         ring.forEachCompletion(
+             [&](const io_uring_cqe &cqe)
+             {
+                if (cqe.user_data != ACCEPT_EVENT)
+                {
+                   return;
+                }
+
+                if (cqe.res >= 0)
+                {
+                   CLOSE_FD(cqe.res);
+                }
+
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                {
+                   armed = false;
+                }
+             });
+      }
+   }
+#endif
+}
 
 namespace nettle
 {
@@ -11,14 +183,27 @@ namespace nettle
                         TcpConnectionHandler &connectionHandler,
                         std::function<void(SocketError)> errorCb,
                         int maxPendingRequests,
-                        int msSleepBetweenReq) : Socket(errorCb),
-                                                 errorCb(errorCb),
-                                                 connectionHandler(connectionHandler),
-                                                 hostPort(hostPort),
-                                                 maxConnectionThreads(maxConnectionThreads),
-                                                 msSleepBetweenReq(msSleepBetweenReq),
-                                                 ready(false),
-                                                 threadRunning(false)
+                        int msSleepBetweenReq) : TcpServer(hostPort,
+                                                           connectionHandler,
+                                                           legacyConfig(maxPendingRequests, msSleepBetweenReq),
+                                                           errorCb)
+   {
+   }
+
+   // ---------------------------------------------------------
+   // TcpServer
+   // ---------------------------------------------------------
+   TcpServer::TcpServer(HostPort hostPort,
+                        TcpConnectionHandler &connectionHandler,
+                        TcpServerConfig config,
+                        std::function<void(SocketError)> errorCb) : Socket(errorCb),
+                                                                    serverMetrics(std::make_shared<Metrics>()),
+                                                                    errorCb(countingErrors(serverMetrics, errorCb)),
+                                                                    connectionHandler(connectionHandler),
+                                                                    hostPort(hostPort),
+                                                                    config(config),
+                                                                    ready(false),
+                                                                    threadRunning(false)
 
    {
 
@@ -30,31 +215,60 @@ namespace nettle
          return;
       }
 #endif
-      if ((this->socketFd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
-      {
-         errorCb(SocketError::SOCKET_CREATE);
-         return;
-      }
+      // Accepted connections share the counting callback, which keeps the metrics
+      // alive for connections a handler holds on to past the server
+      this->sharedInfoCb = std::make_shared<const std::function<void(SocketError)>>(this->errorCb);
 
       memset(&this->sockAddr, 0, sizeof(this->sockAddr));
       this->sockAddr.sin_family = AF_INET;
       this->sockAddr.sin_addr.s_addr = inet_addr(this->hostPort.getAddress().c_str());
       this->sockAddr.sin_port = htons(this->hostPort.getPort());
 
-      if (::bind(this->socketFd, (sockaddr *)&this->sockAddr, sizeof(this->sockAddr)) < 0)
+      // The profile's timeouts go on every listener, setupSocket and the shards below
+      // pick them up and accepted connections inherit them from there
+      const TuningProfile &profile = this->config.tuning;
+      if (profile.recvTimeout || profile.sendTimeout)
       {
-         errorCb(SocketError::SOCKET_BIND);
-         return;
+         setTimeouts(profile.recvTimeout.value_or(std::chrono::seconds(SOCKET_RECV_TIMEOUT_SEC)),
+                     profile.sendTimeout.value_or(std::chrono::seconds(SOCKET_SEND_TIMEOUT_SEC)));
       }
 
-      // mark the socket so it will listen for incoming connections
-      if (::listen(this->socketFd, maxPendingRequests) < 0)
+      // Sharded servers bind one SO_REUSEPORT listener per shard and let the
+      // kernel spread incoming connections across them
+      bool sharded = this->config.shards > 0;
+      std::size_t numShards = sharded ? this->config.shards : 1;
+
+      if ((this->socketFd = openListener(sharded)) < 0)
       {
-         errorCb(SocketError::SOCKET_LISTEN);
          return;
       }
 
       this->setupSocket(this->socketFd, this->sockAddr);
+
+      for (std::size_t i = 0; i < numShards; i++)
+      {
+         auto shard = std::make_unique<Shard>();
+         shard->cpu = (i < this->config.shardCpus.size()) ? this->config.shardCpus[i] : -1;
+
+         if (i == 0)
+         {
+            shard->listenFd = this->socketFd;
+         }
+         else if ((shard->listenFd = openListener(true)) < 0)
+         {
+            return;
+         }
+         else
+         {
+            // Matches the timeouts setupSocket gives the first listener, the accept
+            // timeout and what its connections inherit
+            setsockopt(shard->listenFd, SOL_SOCKET, SO_RCVTIMEO, (char *)&recvTimeout, sizeof(recvTimeout));
+            setsockopt(shard->listenFd, SOL_SOCKET, SO_SNDTIMEO, (char *)&sendTimeout, sizeof(sendTimeout));
+         }
+
+         shards.push_back(std::move(shard));
+      }
+
       ready = true;
    }
 
@@ -66,9 +280,95 @@ namespace nettle
 #if defined(_MSC_VER)
       WSACleanup();
 #endif
+      for (std::size_t i = 1; i < shards.size(); i++)
+      {
+         CLOSE_FD(shards[i]->listenFd);
+      }
       this->socketClose();
    }
 
+   // ---------------------------------------------------------
+   // tuningReport
+   // ---------------------------------------------------------
+   const TuningReport &TcpServer::tuningReport() const
+   {
+      return this->tuning;
+   }
+
+   // ---------------------------------------------------------
+   // setupConnection
+   // ---------------------------------------------------------
+   bool TcpServer::setupConnection(Socket &connection, int fd, sockaddr_in addr, bool nonBlocking)
+   {
+      // Every listener carries this server's timeouts, only the options accepted
+      // connections don't inherit are set per connection
+      if (!connection.adoptSocket(fd, addr, *this, nonBlocking))
+      {
+         return false;
+      }
+
+      connection.applyTuning(config.tuning, SocketRole::TCP_CONNECTION);
+      return true;
+   }
+
+   // ---------------------------------------------------------
+   // openListener
+   // ---------------------------------------------------------
+   int TcpServer::openListener(bool reusePort)
+   {
+      int fd;
+      if ((fd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+      {
+         errorCb(SocketError::SOCKET_CREATE);
+         return -1;
+      }
+
+      // Must be set before bind to reclaim a port left in TIME_WAIT by closed connections
+      int enable = 1;
+      if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (char *)&enable, sizeof(enable)) < 0)
+      {
+         errorCb(SocketError::SOCKET_REUSEADDR);
+         CLOSE_FD(fd);
+         return -1;
+      }
+
+#ifdef SO_REUSEPORT
+      if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)
+      {
+         errorCb(SocketError::SOCKET_REUSEPORT);
+         CLOSE_FD(fd);
+         return -1;
+      }
+#else
+      if (reusePort)
+      {
+         errorCb(SocketError::SOCKET_REUSEPORT);
+         CLOSE_FD(fd);
+         return -1;
+      }
+#endif
+
+      // Listener options (buffers, fast open, deferred accept) only count if set before listen
+      this->tuning = nettle::applyTuning(fd, this->config.tuning, SocketRole::TCP_LISTENER);
+
+      if (::bind(fd, (sockaddr *)&this->sockAddr, sizeof(this->sockAddr)) < 0)
+      {
+         errorCb(SocketError::SOCKET_BIND);
+         CLOSE_FD(fd);
+         return -1;
+      }
+
+      // mark the socket so it will listen for incoming connections
+      if (::listen(fd, this->config.maxPendingRequests) < 0)
+      {
+         errorCb(SocketError::SOCKET_LISTEN);
+         CLOSE_FD(fd);
+         return -1;
+      }
+
+      return fd;
+   }
+
    // ---------------------------------------------------------
    // startThreaded
    // ---------------------------------------------------------
@@ -83,67 +383,49 @@ namespace nettle
          }
       }
 
-      threadRunning.store(true);
-
-      serverThread = std::thread(
-          [](TcpServer *server, std::atomic<uint32_t>* numThreads)
-          {
-             server->connectionHandler.serverStarted();
+      if (!ready)
+      {
+         return false;
+      }
 
-             while (server->threadRunning.load())
-             {
-                if (!server->ready)
-                {
-                   return;
-                }
+      threadRunning.store(true);
 
-                int clientFd;
-                sockaddr_in clientAddr;
-#ifdef _MSC_VER
-                int addrLen;
-#else
-                socklen_t addrLen;
+#if defined(__linux__)
+      engine = (config.engine == IoEngine::IO_URING && IoUring::supported()) ? IoEngine::IO_URING : IoEngine::POSIX;
 #endif
-                addrLen = sizeof(clientAddr);
-
-                if ((clientFd = accept(server->socketFd, (struct sockaddr *)&clientAddr, &addrLen)) < 0)
-                {
-                  std::this_thread::sleep_for(std::chrono::milliseconds(10));
-                  continue;
-                }
-
-                Socket* clientSocket = new Socket(server->errorCb);
-                if (numThreads->load() < MAX_CONNECTION_THREADS && clientSocket->setupSocket(clientFd, clientAddr))
-                {
-                  auto run_it = [](TcpServer *server, Socket* socket, std::atomic<uint32_t>* numThreads){
 
-                     // Indicate in the atomic that the thread has started
-                     numThreads->fetch_add(1);
+      if (config.mode == TcpServeMode::EVENT_LOOP)
+      {
+         return startEventLoops();
+      }
 
-                     // Let the handler do whatever it needs but as a reference so
-                     // its less likely that they accidentlly destroy the socket 
-                     server->connectionHandler.newConnection(*socket);
+      connectionHandler.serverStarted();
 
-                     // Ensure the socket was closed
-                     socket->socketClose();
+      std::size_t numWorkers = (config.workerThreads > 0) ? config.workerThreads : 1;
 
-                     // Decrement the atomic to indicate that the thread is about to die
-                     numThreads->fetch_sub(1);
+      for (auto &shard : shards)
+      {
+         // Workers are started up front so accepting a connection never pays for thread creation
+         shard->connectionQueue = std::make_unique<BoundedQueue<PendingConnection>>(config.connectionQueueDepth);
 
-                     // Cleanup the socket
-                     delete socket;
-                  };
+         for (std::size_t i = 0; i < numWorkers; i++)
+         {
+            shard->threads.emplace_back(&TcpServer::runWorker, this, std::ref(*shard));
+            pinThread(shard->threads.back(), shard->cpu);
+         }
 
-                  // Start the thread and cut it loose
-                  std::thread(run_it, server, clientSocket, numThreads).detach();
-                }
-                
-                std::this_thread::sleep_for(std::chrono::milliseconds(server->msSleepBetweenReq));
-             }
-          } // End func
-          ,
-          this,
-          &_num_threads);
+#if defined(__linux__)
+         if (engine == IoEngine::IO_URING)
+         {
+            shard->acceptor = std::thread(&TcpServer::runUringAcceptor, this, std::ref(*shard));
+         }
+         else
+#endif
+         {
+            shard->acceptor = std::thread(&TcpServer::runAcceptor, this, std::ref(*shard));
+         }
+         pinThread(shard->acceptor, shard->cpu);
+      }
 
       return true;
    }
@@ -164,10 +446,856 @@ namespace nettle
 
       connectionHandler.serverStopping();
 
-      serverThread.join();
+      if (config.mode == TcpServeMode::EVENT_LOOP)
+      {
+#ifndef _MSC_VER
+         // Never read, so the eventfd stays readable and wakes every loop
+         uint64_t wake = 1;
+         if (::write(wakeFd, &wake, sizeof(wake)) < 0)
+         {
+            std::cerr << "Unable to wake event loops" << std::endl;
+         }
+#endif
+         for (auto &shard : shards)
+         {
+            for (auto &loop : shard->threads)
+            {
+               loop.join();
+            }
+            shard->threads.clear();
+#if defined(__linux__)
+            shard->rings.clear();
+#endif
+         }
+
+         CLOSE_FD(wakeFd);
+         wakeFd = -1;
+      }
+      else
+      {
+         for (auto &shard : shards)
+         {
+            // Closing first releases an acceptor blocked on a full queue
+            shard->connectionQueue->close();
+         }
+
+         for (auto &shard : shards)
+         {
+            shard->acceptor.join();
+
+            for (auto &worker : shard->threads)
+            {
+               worker.join();
+            }
+            shard->threads.clear();
+
+            PendingConnection pending;
+            while (shard->connectionQueue->tryPop(pending))
+            {
+               CLOSE_FD(pending.fd);
+            }
+         }
+      }
 
       connectionHandler.serverStopped();
 
       return true;
    }
-}
\ No newline at end of file
+
+   // ---------------------------------------------------------
+   // shardAcceptCounts
+   // ---------------------------------------------------------
+   std::vector<uint64_t> TcpServer::shardAcceptCounts() const
+   {
+      std::vector<uint64_t> counts;
+      for (auto &shard : shards)
+      {
+         counts.push_back(shard->accepted.load(std::memory_order_relaxed));
+      }
+      return counts;
+   }
+
+   // ---------------------------------------------------------
+   // ioEngine
+   // ---------------------------------------------------------
+   IoEngine TcpServer::ioEngine() const
+   {
+      return engine;
+   }
+
+   // ---------------------------------------------------------
+   // metrics
+   // ---------------------------------------------------------
+   MetricsSnapshot TcpServer::metrics() const
+   {
+      MetricsSnapshot snapshot = serverMetrics->snapshot();
+
+      // Acceptors already count per shard, no need to count twice
+      for (const auto &shard : shards)
+      {
+         snapshot.counters[static_cast<std::size_t>(Counter::ACCEPTS)] += shard->accepted.load(std::memory_order_relaxed);
+      }
+      return snapshot;
+   }
+
+   // ---------------------------------------------------------
+   // timers
+   // ---------------------------------------------------------
+   TimerService &TcpServer::timers()
+   {
+      return timerService;
+   }
+
+   // ---------------------------------------------------------
+   // accept
+   // ---------------------------------------------------------
+   Task<std::unique_ptr<AsyncSocket>> TcpServer::accept(Executor &executor)
+   {
+#ifdef _MSC_VER
+      co_return nullptr;
+#else
+      if (!ready)
+      {
+         co_return nullptr;
+      }
+
+      // A blocking listener would stall the executor, switch it over on first use
+      if (!listenerNonBlocking)
+      {
+         int flags = fcntl(this->socketFd, F_GETFL, 0);
+         if (flags < 0 || fcntl(this->socketFd, F_SETFL, flags | O_NONBLOCK) < 0)
+         {
+            co_return nullptr;
+         }
+         listenerNonBlocking = true;
+      }
+
+      while (true)
+      {
+         sockaddr_in clientAddr;
+         socklen_t addrLen = sizeof(clientAddr);
+
+         // Flags of the listener aren't inherited, so the connection comes out non-blocking either way
+         int clientFd = accept4(this->socketFd, (struct sockaddr *)&clientAddr, &addrLen, SOCK_CLOEXEC | SOCK_NONBLOCK);
+         if (clientFd < 0)
+         {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+               continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+               co_return nullptr;
+            }
+
+            co_await executor.readable(this->socketFd);
+            continue;
+         }
+
+         shards.front()->accepted.fetch_add(1, std::memory_order_relaxed);
+
+         auto clientSocket = std::make_unique<Socket>(sharedInfoCb);
+         if (!setupConnection(*clientSocket, clientFd, clientAddr))
+         {
+            CLOSE_FD(clientFd);
+            co_return nullptr;
+         }
+
+         co_return std::make_unique<AsyncSocket>(executor, std::move(clientSocket));
+      }
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // runAcceptor
+   // ---------------------------------------------------------
+   void TcpServer::runAcceptor(Shard &shard)
+   {
+#ifdef _MSC_VER
+      while (threadRunning.load())
+      {
+         sockaddr_in clientAddr;
+         int addrLen = sizeof(clientAddr);
+         int clientFd;
+
+         if ((clientFd = ::accept(shard.listenFd, (struct sockaddr *)&clientAddr, &addrLen)) < 0)
+         {
+            // Running into the accept timeout is how an idle acceptor polls threadRunning
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+               serverMetrics->add(Counter::ACCEPT_FAILURES);
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+         }
+
+         enqueueConnection(shard, PendingConnection{clientFd, clientAddr});
+         std::this_thread::sleep_for(std::chrono::milliseconds(config.msSleepBetweenReq));
+      }
+#else
+      // A non-blocking listener lets one wake-up drain the accept queue, the
+      // connections accept4 hands out stay blocking for the handlers
+      int flags = fcntl(shard.listenFd, F_GETFL, 0);
+      bool drain = flags >= 0 && fcntl(shard.listenFd, F_SETFL, flags | O_NONBLOCK) == 0;
+
+      // The accept timeout bounds the wait so an idle acceptor still sees threadRunning
+      int waitMs = acceptWaitMs(recvTimeout);
+      pollfd listener {shard.listenFd, POLLIN, 0};
+
+      while (threadRunning.load())
+      {
+         if (poll(&listener, 1, waitMs) <= 0)
+         {
+            continue;
+         }
+
+         bool more = true;
+         while (more)
+         {
+            sockaddr_in clientAddr;
+            socklen_t addrLen = sizeof(clientAddr);
+
+            int clientFd = accept4(shard.listenFd, (struct sockaddr *)&clientAddr, &addrLen, SOCK_CLOEXEC);
+            if (clientFd < 0)
+            {
+               if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+               {
+                  // Out of descriptors leaves the listener readable, back off instead of spinning
+                  serverMetrics->add(Counter::ACCEPT_FAILURES);
+                  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+               }
+               break;
+            }
+
+            enqueueConnection(shard, PendingConnection{clientFd, clientAddr});
+            more = drain;
+         }
+
+         if (config.msSleepBetweenReq > 0)
+         {
+            std::this_thread::sleep_for(std::chrono::milliseconds(config.msSleepBetweenReq));
+         }
+      }
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // enqueueConnection
+   // ---------------------------------------------------------
+   void TcpServer::enqueueConnection(Shard &shard, PendingConnection pending)
+   {
+      shard.accepted.fetch_add(1, std::memory_order_relaxed);
+
+      // Anything the queue turns away (rejected, shed or queue closed) is
+      // closed here so that no descriptor is ever leaked
+      auto dropped = shard.connectionQueue->push(pending, config.overloadPolicy);
+      if (dropped)
+      {
+         serverMetrics->add(Counter::CONNECTIONS_REJECTED);
+         CLOSE_FD(dropped->fd);
+      }
+   }
+
+   // ---------------------------------------------------------
+   // runWorker
+   // ---------------------------------------------------------
+   void TcpServer::runWorker(Shard &shard)
+   {
+      PendingConnection pending;
+      while (shard.connectionQueue->pop(pending))
+      {
+#ifndef _MSC_VER
+         // Multishot accepts don't report the peer, look it up off the acceptor thread
+         if (pending.addr.sin_family == 0)
+         {
+            socklen_t addrLen = sizeof(pending.addr);
+            getpeername(pending.fd, (struct sockaddr *)&pending.addr, &addrLen);
+         }
+#endif
+         // Connections share the listener's error callback rather than each copying it
+         Socket socket(sharedInfoCb);
+         if (!setupConnection(socket, pending.fd, pending.addr))
+         {
+            CLOSE_FD(pending.fd);
+            continue;
+         }
+
+         // Counted closed by the socket itself, whenever the handler is done with it.
+         // Connections awaited through accept(Executor) are left out of the metrics
+         socket.attachMetrics(serverMetrics);
+         serverMetrics->add(Counter::CONNECTIONS_OPENED);
+
+#ifndef _MSC_VER
+         // The deadline shuts down a duplicate of the descriptor, which stays open
+         // until the timer is gone, the handler's may be closed and reused by then
+         TimerId deadline = NO_TIMER;
+         if (config.connectionDeadline.count() > 0)
+         {
+            std::shared_ptr<int> watched(new int(dup(pending.fd)),
+                                         [](int *fd)
+                                         {
+                                            CLOSE_FD(*fd);
+                                            delete fd;
+                                         });
+            if (*watched >= 0)
+            {
+               deadline = timerService.schedule(config.connectionDeadline,
+                                                [watched] { shutdown(*watched, SHUT_RDWR); });
+            }
+         }
+#endif
+
+         // The handler owns the connection from here on and closes it by
+         // destroying it, unless it moves it somewhere else first
+         auto started = std::chrono::steady_clock::now();
+         connectionHandler.newConnection(std::move(socket));
+         serverMetrics->observe(std::chrono::steady_clock::now() - started);
+
+#ifndef _MSC_VER
+         // The deadline only covers the call, a connection kept past it is the handler's to time out
+         timerService.cancel(deadline);
+#endif
+      }
+   }
+
+   // ---------------------------------------------------------
+   // startEventLoops
+   // ---------------------------------------------------------
+   bool TcpServer::startEventLoops()
+   {
+#ifdef _MSC_VER
+      threadRunning.store(false);
+      return false;
+#else
+      // Loops drain the accept queue until it would block
+      for (auto &shard : shards)
+      {
+         int flags = fcntl(shard->listenFd, F_GETFL, 0);
+         if (flags < 0 || fcntl(shard->listenFd, F_SETFL, flags | O_NONBLOCK) < 0)
+         {
+            threadRunning.store(false);
+            return false;
+         }
+      }
+
+      if ((wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+      {
+         threadRunning.store(false);
+         return false;
+      }
+
+      // A sharded server runs one loop per listener, otherwise every loop shares the one listener
+      std::size_t loopsPerShard = (config.shards > 0 || config.eventLoopThreads == 0) ? 1 : config.eventLoopThreads;
+
+      struct Loop
+      {
+         Shard *shard;
+         int epollFd;
+         IoUring *ring;
+      };
+
+      std::vector<Loop> loops;
+      bool failed = false;
+
+      for (auto &shard : shards)
+      {
+         for (std::size_t i = 0; i < loopsPerShard && !failed; i++)
+         {
+#if defined(__linux__)
+            if (engine == IoEngine::IO_URING)
+            {
+               auto ring = std::make_unique<IoUring>();
+               if (!ring->isOpen())
+               {
+                  failed = true;
+                  break;
+               }
+               loops.push_back(Loop{shard.get(), -1, ring.get()});
+               shard->rings.push_back(std::move(ring));
+               continue;
+            }
+#endif
+            int epollFd = epoll_create1(EPOLL_CLOEXEC);
+            if (epollFd < 0)
+            {
+               failed = true;
+               break;
+            }
+            loops.push_back(Loop{shard.get(), epollFd, nullptr});
+
+            // Exclusive wake-ups keep every loop from racing on a single new connection
+            epoll_event listenEvent {};
+            listenEvent.events = EPOLLIN | EPOLLEXCLUSIVE;
+            listenEvent.data.fd = shard->listenFd;
+
+            epoll_event wakeEvent {};
+            wakeEvent.events = EPOLLIN;
+            wakeEvent.data.fd = wakeFd;
+
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, shard->listenFd, &listenEvent) < 0 ||
+                epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &wakeEvent) < 0)
+            {
+               failed = true;
+            }
+         }
+      }
+
+      if (failed)
+      {
+         for (auto &loop : loops)
+         {
+            if (loop.epollFd >= 0)
+            {
+               CLOSE_FD(loop.epollFd);
+            }
+         }
+#if defined(__linux__)
+         for (auto &shard : shards)
+         {
+            shard->rings.clear();
+         }
+#endif
+         CLOSE_FD(wakeFd);
+         wakeFd = -1;
+         threadRunning.store(false);
+         return false;
+      }
+
+      connectionHandler.serverStarted();
+
+      for (auto &loop : loops)
+      {
+         Shard &shard = *loop.shard;
+#if defined(__linux__)
+         if (loop.ring)
+         {
+            shard.threads.emplace_back(&TcpServer::runUringEventLoop, this, std::ref(shard), std::ref(*loop.ring));
+         }
+         else
+#endif
+         {
+            shard.threads.emplace_back(&TcpServer::runEventLoop, this, std::ref(shard), loop.epollFd);
+         }
+         pinThread(shard.threads.back(), shard.cpu);
+      }
+
+      return true;
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // runEventLoop
+   // ---------------------------------------------------------
+   void TcpServer::runEventLoop(Shard &shard, int epollFd)
+   {
+#ifndef _MSC_VER
+      struct Connection
+      {
+         std::unique_ptr<Socket> socket;
+         TimerId idle;
+      };
+
+      // Connections are owned by the loop that accepted them, so none of this is shared
+      std::unordered_map<int, Connection> connections;
+      std::vector<epoll_event> events((config.maxEventsPerWait > 0) ? config.maxEventsPerWait : 1);
+      TimerWheel idleTimers(IDLE_TICK);
+      bool reapIdle = config.idleTimeout.count() > 0;
+
+      // Out of descriptors or memory the level triggered listener would wake the loop
+      // again right away, it is taken out until a connection closes or the backoff passed
+      bool accepting = true;
+      TimerId acceptBackoff = NO_TIMER;
+
+      auto resumeAccepting = [&]()
+      {
+         if (accepting)
+         {
+            return;
+         }
+
+         idleTimers.cancel(acceptBackoff);
+         acceptBackoff = NO_TIMER;
+
+         epoll_event listenEvent {};
+         listenEvent.events = EPOLLIN | EPOLLEXCLUSIVE;
+         listenEvent.data.fd = shard.listenFd;
+         accepting = epoll_ctl(epollFd, EPOLL_CTL_ADD, shard.listenFd, &listenEvent) == 0;
+      };
+
+      auto pauseAccepting = [&]()
+      {
+         // EPOLLEXCLUSIVE can't be modified, only removed and added again
+         epoll_ctl(epollFd, EPOLL_CTL_DEL, shard.listenFd, nullptr);
+         accepting = false;
+         acceptBackoff = idleTimers.schedule(ACCEPT_BACKOFF, [&resumeAccepting] { resumeAccepting(); });
+      };
+
+      auto closeConnection = [&](int fd)
+      {
+         auto it = connections.find(fd);
+         if (it == connections.end())
+         {
+            return;
+         }
+
+         connectionHandler.connectionClosed(*it->second.socket);
+         epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+         it->second.socket->socketClose();
+         idleTimers.cancel(it->second.idle);
+         connections.erase(it);
+         resumeAccepting();
+      };
+
+      while (threadRunning.load())
+      {
+         int numEvents = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), waitMs(idleTimers));
+
+         if (numEvents < 0)
+         {
+            if (errno == EINTR)
+            {
+               continue;
+            }
+            break;
+         }
+
+         for (int i = 0; i < numEvents; i++)
+         {
+            int fd = events[i].data.fd;
+
+            if (fd == wakeFd)
+            {
+               continue;
+            }
+
+            if (fd == shard.listenFd)
+            {
+               while (true)
+               {
+                  sockaddr_in clientAddr;
+                  socklen_t addrLen = sizeof(clientAddr);
+
+                  // Handlers share the loop, a read that would block must come back right away
+                  int clientFd = accept4(shard.listenFd, (struct sockaddr *)&clientAddr, &addrLen,
+                                         SOCK_CLOEXEC | SOCK_NONBLOCK);
+                  if (clientFd < 0)
+                  {
+                     if (errno == EINTR || errno == ECONNABORTED)
+                     {
+                        continue;
+                     }
+
+                     if (errno != EAGAIN && errno != EWOULDBLOCK)
+                     {
+                        serverMetrics->add(Counter::ACCEPT_FAILURES);
+                        if (outOfResources(errno))
+                        {
+                           pauseAccepting();
+                        }
+                     }
+                     break;
+                  }
+
+                  shard.accepted.fetch_add(1, std::memory_order_relaxed);
+
+                  auto clientSocket = std::make_unique<Socket>(sharedInfoCb);
+                  if (!setupConnection(*clientSocket, clientFd, clientAddr, true))
+                  {
+                     CLOSE_FD(clientFd);
+                     continue;
+                  }
+
+                  epoll_event clientEvent {};
+                  clientEvent.events = EPOLLIN | EPOLLRDHUP;
+                  clientEvent.data.fd = clientFd;
+
+                  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, clientFd, &clientEvent) < 0)
+                  {
+                     continue;
+                  }
+
+                  TimerId idle = NO_TIMER;
+                  if (reapIdle)
+                  {
+                     idle = idleTimers.schedule(config.idleTimeout, [&closeConnection, clientFd] { closeConnection(clientFd); });
+                  }
+
+                  clientSocket->attachMetrics(serverMetrics);
+                  connections.emplace(clientFd, Connection{std::move(clientSocket), idle});
+                  serverMetrics->add(Counter::CONNECTIONS_OPENED);
+               }
+               continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end())
+            {
+               continue;
+            }
+
+            bool keepOpen = false;
+            if (events[i].events & EPOLLIN)
+            {
+               idleTimers.reschedule(it->second.idle, config.idleTimeout);
+               auto started = std::chrono::steady_clock::now();
+               keepOpen = connectionHandler.connectionReady(*it->second.socket);
+               serverMetrics->observe(std::chrono::steady_clock::now() - started);
+            }
+
+            // The handler had its chance to answer a half closed peer, reading
+            // again would only spin on the level triggered hang up
+            if (!keepOpen || !it->second.socket->isOpen() ||
+                (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+            {
+               closeConnection(fd);
+            }
+         }
+
+         // After the events, a connection that just spoke has had its timer pushed out
+         idleTimers.advance();
+      }
+
+      while (!connections.empty())
+      {
+         closeConnection(connections.begin()->first);
+      }
+
+      CLOSE_FD(epollFd);
+#endif
+   }
+
+#if defined(__linux__)
+   // ---------------------------------------------------------
+   // runUringAcceptor
+   // ---------------------------------------------------------
+   void TcpServer::runUringAcceptor(Shard &shard)
+   {
+      IoUring ring(64);
+      if (!ring.isOpen())
+      {
+         runAcceptor(shard);
+         return;
+      }
+
+      bool armed = armAccept(ring, shard.listenFd);
+      bool unsupported = false;
+      int waitMs = acceptWaitMs(recvTimeout);
+
+      while (threadRunning.load() && !unsupported)
+      {
+         if (!armed)
+         {
+            armed = armAccept(ring, shard.listenFd);
+         }
+
+         // Waits for the first connection (bounded by the accept timeout) and
+         // takes every other connection accepted by then in the same call
+         ring.submit(1, waitMs);
+
+         ring.forEachCompletion(
+             [&](const io_uring_cqe &cqe)
+             {
+                if (cqe.user_data != ACCEPT_EVENT)
+                {
+                   return;
+                }
+
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                {
+                   armed = false;
+                }
+
+                if (cqe.res < 0)
+                {
+                   unsupported = (cqe.res == -EINVAL);
+                   serverMetrics->add(Counter::ACCEPT_FAILURES, (cqe.res != -ECANCELED) ? 1 : 0);
+                   return;
+                }
+
+                enqueueConnection(shard, PendingConnection{cqe.res, sockaddr_in{}});
+             });
+
+         if (config.msSleepBetweenReq > 0)
+         {
+            std::this_thread::sleep_for(std::chrono::milliseconds(config.msSleepBetweenReq));
+         }
+      }
+
+      cancelAccept(ring, armed);
+
+      // The kernel refused multishot accept after all
+      if (unsupported)
+      {
+         runAcceptor(shard);
+      }
+   }
+
+   // ---------------------------------------------------------
+   // runUringEventLoop
+   // ---------------------------------------------------------
+   void TcpServer::runUringEventLoop(Shard &shard, IoUring &ring)
+   {
+      struct Connection
+      {
+         std::unique_ptr<Socket> socket;
+         uint64_t event;
+         TimerId idle;
+      };
+
+      // Connections are owned by the loop that accepted them, so none of this is shared
+      std::unordered_map<int, Connection> connections;
+      uint32_t generation = 0;
+      TimerWheel idleTimers(IDLE_TICK);
+      bool reapIdle = config.idleTimeout.count() > 0;
+
+      // Set while the accept stays unarmed after running out of descriptors or memory
+      TimerId acceptBackoff = NO_TIMER;
+
+      auto closeConnection = [&](int fd)
+      {
+         auto it = connections.find(fd);
+         if (it == connections.end())
+         {
+            return;
+         }
+
+         connectionHandler.connectionClosed(*it->second.socket);
+         it->second.socket->socketClose();
+         idleTimers.cancel(it->second.idle);
+         connections.erase(it);
+
+         idleTimers.cancel(acceptBackoff);
+         acceptBackoff = NO_TIMER;
+      };
+
+      // The poll armed on an idle connection holds on to its file, closing the
+      // descriptor would not end the connection. A shutdown completes the poll
+      // with a hang up and it gets closed like any other
+      auto expireConnection = [&](int fd)
+      {
+         shutdown(fd, SHUT_RDWR);
+      };
+
+      // Handlers share the loop, a read that would block must come back right away
+      constexpr int ACCEPT_FLAGS = SOCK_CLOEXEC | SOCK_NONBLOCK;
+
+      bool armed = armAccept(ring, shard.listenFd, ACCEPT_FLAGS);
+      armPoll(ring, wakeFd, WAKE_EVENT);
+
+      while (threadRunning.load())
+      {
+         if (!armed && acceptBackoff == NO_TIMER)
+         {
+            armed = armAccept(ring, shard.listenFd, ACCEPT_FLAGS);
+         }
+
+         // Every poll re-armed while handling the last batch goes out with this wait
+         int result = ring.submit(1, waitMs(idleTimers));
+         if (result < 0 && result != -EINTR && result != -EAGAIN && result != -EBUSY && result != -ETIME)
+         {
+            break;
+         }
+
+         ring.forEachCompletion(
+             [&](const io_uring_cqe &cqe)
+             {
+                if (cqe.user_data == ACCEPT_EVENT)
+                {
+                   if (!(cqe.flags & IORING_CQE_F_MORE))
+                   {
+                      armed = false;
+                   }
+
+                   if (cqe.res < 0)
+                   {
+                      serverMetrics->add(Counter::ACCEPT_FAILURES, (cqe.res != -ECANCELED) ? 1 : 0);
+
+                      // Re-arming at once would only fail again, wait for a close or the backoff
+                      if (!armed && outOfResources(-cqe.res) && acceptBackoff == NO_TIMER)
+                      {
+                         acceptBackoff = idleTimers.schedule(ACCEPT_BACKOFF, [&acceptBackoff] { acceptBackoff = NO_TIMER; });
+                      }
+                      return;
+                   }
+
+                   int clientFd = cqe.res;
+                   shard.accepted.fetch_add(1, std::memory_order_relaxed);
+
+                   sockaddr_in clientAddr {};
+                   socklen_t addrLen = sizeof(clientAddr);
+                   getpeername(clientFd, (struct sockaddr *)&clientAddr, &addrLen);
+
+                   auto clientSocket = std::make_unique<Socket>(sharedInfoCb);
+                   if (!setupConnection(*clientSocket, clientFd, clientAddr, true))
+                   {
+                      CLOSE_FD(clientFd);
+                      return;
+                   }
+
+                   uint64_t event = connectionEvent(clientFd, ++generation);
+                   if (!armPoll(ring, clientFd, event))
+                   {
+                      return;
+                   }
+
+                   TimerId idle = NO_TIMER;
+                   if (reapIdle)
+                   {
+                      idle = idleTimers.schedule(config.idleTimeout, [&expireConnection, clientFd] { expireConnection(clientFd); });
+                   }
+
+                   clientSocket->attachMetrics(serverMetrics);
+                   connections.emplace(clientFd, Connection{std::move(clientSocket), event, idle});
+                   serverMetrics->add(Counter::CONNECTIONS_OPENED);
+                   return;
+                }
+
+                if (!(cqe.user_data & CONNECTION_EVENT))
+                {
+                   return;
+                }
+
+                int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+                auto it = connections.find(fd);
+                if (it == connections.end() || it->second.event != cqe.user_data)
+                {
+                   return;
+                }
+
+                if (cqe.res < 0)
+                {
+                   closeConnection(fd);
+                   return;
+                }
+
+                bool keepOpen = false;
+                if (cqe.res & POLLIN)
+                {
+                   idleTimers.reschedule(it->second.idle, config.idleTimeout);
+                   auto started = std::chrono::steady_clock::now();
+                   keepOpen = connectionHandler.connectionReady(*it->second.socket);
+                   serverMetrics->observe(std::chrono::steady_clock::now() - started);
+                }
+
+                // Same as the epoll loop, a half closed peer only gets one more read
+                if (!keepOpen || !it->second.socket->isOpen() ||
+                    (cqe.res & (POLLRDHUP | POLLHUP | POLLERR)) ||
+                    !armPoll(ring, fd, it->second.event))
+                {
+                   closeConnection(fd);
+                }
+             });
+
+         idleTimers.advance();
+      }
+
+      while (!connections.empty())
+      {
+         closeConnection(connections.begin()->first);
+      }
+
+      cancelAccept(ring, armed);
+   }
+#endif
+}
@@ -1,14 +1,21 @@
 #ifndef NET_TCP_SERVER_HPP
 #define NET_TCP_SERVER_HPP
 
+#include "Async.hpp"
 #include "HostPort.hpp"
 #include "Socket.hpp"
 #include "ConnectionHandler.hpp"
+#include "BoundedQueue.hpp"
+#include "IoUring.hpp"
+#include "Metrics.hpp"
+#include "TimerWheel.hpp"
 #include <string>
 
 #include <atomic>
+#include <memory>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 //!
 //! \file TcpServer.hpp
@@ -17,6 +24,39 @@
 //!
 namespace nettle
 {
+   //!
+   //! \brief How a TcpServer hands connections to its handler
+   //!
+   enum class TcpServeMode
+   {
+      THREADED,  //! Blocking acceptor, each connection given to newConnection on its own thread
+      EVENT_LOOP //! Non-blocking listener and epoll reactors, connectionReady called on readiness
+   };
+
+   //!
+   //! \brief Construction time configuration of a TcpServer
+   //!
+   struct TcpServerConfig
+   {
+      TcpServeMode mode = TcpServeMode::THREADED; //! How connections are served
+      int maxPendingRequests = 10;                //! Listen backlog
+      int msSleepBetweenReq = 0;                  //! Sleep after each batch of accepted connections (THREADED)
+      std::size_t workerThreads = 20;             //! Pre-started handler threads (THREADED)
+      std::size_t connectionQueueDepth = 64;      //! Accepted connections waiting on a worker (THREADED)
+      OverloadPolicy overloadPolicy = OverloadPolicy::REJECT; //! What to do when the queue is full (THREADED)
+      std::size_t shards = 0;                     //! SO_REUSEPORT listeners, each with its own acceptor and dispatch (0 = one shared listener)
+      std::vector<int> shardCpus;                 //! CPU each shard's threads are pinned to, -1 or absent leaves it unpinned
+      std::size_t eventLoopThreads = 1;           //! Number of epoll reactor threads (EVENT_LOOP)
+      int maxEventsPerWait = 128;                 //! Events handled per epoll wake-up (EVENT_LOOP)
+      IoEngine engine = IoEngine::POSIX;          //! IO_URING accepts with multishot accept and, in EVENT_LOOP
+                                                  //! mode, replaces epoll with polls batched on a ring per loop
+      TuningProfile tuning;                       //! Socket options for the listener and every accepted connection
+      std::chrono::milliseconds idleTimeout {0};  //! Close connections silent for this long, 0 never (EVENT_LOOP)
+      std::chrono::milliseconds connectionDeadline {0}; //! Shut a connection down once its handler had it this long,
+                                                        //! unblocking a stuck read, 0 never (THREADED). Only runs
+                                                        //! while newConnection does, not for connections kept past it
+   };
+
    //!
    //! \class TcpServer
    //! \brief A Tcp server used to listen for connections and callback on
@@ -37,6 +77,18 @@ namespace nettle
                 int maxPendingRequests = 10,
                 int msSleepBetweenReq = 0);
 
+      //!
+      //! \brief Construct a TcpServer from a configuration
+      //! \param hostPort The host and port information to run the tcp server
+      //! \param connectionHandler The connection handler that handles in-bound sockets
+      //! \param config Serving mode and tuning of the server
+      //! \param errorCb The error callback function - defaults to a cerr sink
+      //!
+      TcpServer(HostPort hostPort,
+                TcpConnectionHandler &connectionHandler,
+                TcpServerConfig config,
+                std::function<void(SocketError)> errorCb = ErrorSink);
+
       //!
       //! \brief Destructs a server
       //!
@@ -52,20 +104,95 @@ namespace nettle
       //!
       bool stop();
 
+      //!
+      //! \brief Number of connections accepted by each shard since construction
+      //! \note An unsharded server reports a single entry
+      //!
+      std::vector<uint64_t> shardAcceptCounts() const;
+
+      //!
+      //! \brief Which options of the tuning profile took effect on the listener
+      //! \note Accepted connections report their own through Socket::tuningReport
+      //!
+      const TuningReport &tuningReport() const;
+
+      //!
+      //! \brief The engine the server runs on, IO_URING falls back to POSIX
+      //!        when the kernel does not support it
+      //! \note Settled by serve()
+      //!
+      IoEngine ioEngine() const;
+
+      //!
+      //! \brief Await the next connection on an executor instead of calling serve()
+      //! \param executor Executor to suspend on while no connection is pending
+      //! \returns The accepted connection, nullptr if accepting failed
+      //! \note Don't mix with serve(), both take connections off the same listener.
+      //!       Only the first listener of a sharded server is accepted from
+      //!
+      Task<std::unique_ptr<AsyncSocket>> accept(Executor &executor);
+
+      //!
+      //! \brief Timers for handlers to arm their own deadlines with
+      //! \note Callbacks run on the timer thread, which starts with the first timer
+      //!
+      TimerService &timers();
+
+      //!
+      //! \brief Counters of the server and the connections it serves, merged
+      //!        across its threads
+      //! \note Render with toText for scraping
+      //!
+      MetricsSnapshot metrics() const;
+
    private:
+      std::shared_ptr<Metrics> serverMetrics;
       std::function<void(SocketError)> errorCb;
       TcpConnectionHandler &connectionHandler;
       HostPort hostPort;
-      int maxConnectionThreads;
-      int msSleepBetweenReq;
+      TcpServerConfig config;
       bool ready;
+      IoEngine engine {IoEngine::POSIX};
+      bool listenerNonBlocking {false};
 
       std::atomic<bool> threadRunning;
       std::mutex threadMut;
-      std::thread serverThread;
-      static constexpr uint32_t MAX_CONNECTION_THREADS = 20;
-      std::atomic<uint32_t> _num_threads {0};
+
+      struct PendingConnection
+      {
+         int fd;
+         sockaddr_in addr;
+      };
+
+      struct Shard
+      {
+         int listenFd {-1};
+         int cpu {-1};
+         std::atomic<uint64_t> accepted {0};
+         std::unique_ptr<BoundedQueue<PendingConnection>> connectionQueue;
+         std::thread acceptor;
+         std::vector<std::thread> threads;
+#if defined(__linux__)
+         std::vector<std::unique_ptr<IoUring>> rings;
+#endif
+      };
+
+      std::vector<std::unique_ptr<Shard>> shards;
+      int wakeFd {-1};
+      TimerService timerService;
+
+      int openListener(bool reusePort);
+      bool setupConnection(Socket &connection, int fd, sockaddr_in addr, bool nonBlocking = false);
+      void runAcceptor(Shard &shard);
+      void enqueueConnection(Shard &shard, PendingConnection pending);
+      void runWorker(Shard &shard);
+      bool startEventLoops();
+      void runEventLoop(Shard &shard, int epollFd);
+#if defined(__linux__)
+      void runUringAcceptor(Shard &shard);
+      void runUringEventLoop(Shard &shard, IoUring &ring);
+#endif
    };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,460 @@
+#include "TimerWheel.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace nettle
+{
+   namespace
+   {
+      constexpr unsigned MAX_BITS = 36; // LEVELS * SLOT_BITS, the span of the top level
+
+      TimerId makeId(uint32_t index, uint32_t generation)
+      {
+         return (static_cast<uint64_t>(generation) << 32) | (static_cast<uint64_t>(index) + 1);
+      }
+   }
+
+   // -------------------------------------------------------
+   // TimerWheel
+   // -------------------------------------------------------
+
+   TimerWheel::TimerWheel(std::chrono::milliseconds tick, Clock::time_point start) : tick(std::max(tick, std::chrono::milliseconds(1))),
+                                                                                     origin(start)
+   {
+      heads.fill(NIL);
+   }
+
+   // -------------------------------------------------------
+   // schedule
+   // -------------------------------------------------------
+
+   TimerId TimerWheel::schedule(std::chrono::milliseconds delay, std::function<void()> callback, Clock::time_point now)
+   {
+      uint32_t index;
+      if (freeHead != NIL)
+      {
+         index = freeHead;
+         freeHead = nodes[index].next;
+      }
+      else
+      {
+         index = static_cast<uint32_t>(nodes.size());
+         nodes.emplace_back();
+      }
+
+      Node &node = nodes[index];
+      node.callback = std::move(callback);
+      node.expiry = expiryTick(delay, now);
+      node.active = true;
+      link(index);
+      pending++;
+
+      return makeId(index, node.generation);
+   }
+
+   // -------------------------------------------------------
+   // cancel
+   // -------------------------------------------------------
+
+   bool TimerWheel::cancel(TimerId id)
+   {
+      Node *node = find(id);
+      if (!node)
+      {
+         return false;
+      }
+
+      uint32_t index = static_cast<uint32_t>(node - nodes.data());
+      unlink(index);
+      release(index);
+      return true;
+   }
+
+   // -------------------------------------------------------
+   // reschedule
+   // -------------------------------------------------------
+
+   bool TimerWheel::reschedule(TimerId id, std::chrono::milliseconds delay, Clock::time_point now)
+   {
+      Node *node = find(id);
+      if (!node)
+      {
+         return false;
+      }
+
+      uint64_t expiry = expiryTick(delay, now);
+      if (expiry != node->expiry)
+      {
+         uint32_t index = static_cast<uint32_t>(node - nodes.data());
+         unlink(index);
+         node->expiry = expiry;
+         link(index);
+      }
+      return true;
+   }
+
+   // -------------------------------------------------------
+   // advance
+   // -------------------------------------------------------
+
+   std::size_t TimerWheel::advance(Clock::time_point now)
+   {
+      return advance(now, [](std::function<void()> &&callback) {
+         if (callback)
+         {
+            callback();
+         }
+      });
+   }
+
+   // -------------------------------------------------------
+   // nextDeadline
+   // -------------------------------------------------------
+
+   std::optional<TimerWheel::Clock::time_point> TimerWheel::nextDeadline() const
+   {
+      if (pending == 0)
+      {
+         return std::nullopt;
+      }
+      uint64_t next = nextEventTick(current);
+      if (next == UINT64_MAX)
+      {
+         return std::nullopt;
+      }
+      return origin + tick * next;
+   }
+
+   std::size_t TimerWheel::size() const
+   {
+      return pending;
+   }
+
+   // -------------------------------------------------------
+   // ticksAt
+   // -------------------------------------------------------
+
+   uint64_t TimerWheel::ticksAt(Clock::time_point now) const
+   {
+      if (now <= origin)
+      {
+         return 0;
+      }
+      return static_cast<uint64_t>((now - origin) / tick);
+   }
+
+   // -------------------------------------------------------
+   // expiryTick
+   // -------------------------------------------------------
+
+   uint64_t TimerWheel::expiryTick(std::chrono::milliseconds delay, Clock::time_point now) const
+   {
+      // Rounded up so a timer never fires early, and at least a tick out so a
+      // callback rescheduling itself can't keep advance going forever
+      auto sinceOrigin = std::max(now + std::max(delay, std::chrono::milliseconds(0)) - origin, Clock::duration::zero());
+      uint64_t ticks = static_cast<uint64_t>((sinceOrigin + tick - Clock::duration(1)) / tick);
+
+      return std::max({ticks, ticksAt(now) + 1, current});
+   }
+
+   // -------------------------------------------------------
+   // find
+   // -------------------------------------------------------
+
+   TimerWheel::Node *TimerWheel::find(TimerId id)
+   {
+      uint64_t index = (id & UINT32_MAX);
+      if (index == 0 || index > nodes.size())
+      {
+         return nullptr;
+      }
+
+      Node &node = nodes[index - 1];
+      if (!node.active || node.generation != static_cast<uint32_t>(id >> 32))
+      {
+         return nullptr;
+      }
+      return &node;
+   }
+
+   // -------------------------------------------------------
+   // link
+   // -------------------------------------------------------
+
+   void TimerWheel::link(uint32_t index)
+   {
+      Node &node = nodes[index];
+
+      // The level is the one whose slots still tell the expiry apart from the current tick
+      uint64_t differs = node.expiry ^ current;
+      unsigned level = differs == 0 ? 0 : (63 - std::countl_zero(differs)) / SLOT_BITS;
+      if (level >= LEVELS)
+      {
+         node.expiry = current | ((uint64_t(1) << MAX_BITS) - 1);
+         level = LEVELS - 1;
+      }
+
+      unsigned slot = (node.expiry >> (level * SLOT_BITS)) & (SLOTS - 1);
+      uint32_t &head = heads[level * SLOTS + slot];
+
+      node.slot = static_cast<uint16_t>(level * SLOTS + slot);
+      node.prev = NIL;
+      node.next = head;
+      if (head != NIL)
+      {
+         nodes[head].prev = index;
+      }
+      head = index;
+      occupied[level] |= uint64_t(1) << slot;
+   }
+
+   // -------------------------------------------------------
+   // unlink
+   // -------------------------------------------------------
+
+   void TimerWheel::unlink(uint32_t index)
+   {
+      Node &node = nodes[index];
+
+      if (node.prev != NIL)
+      {
+         nodes[node.prev].next = node.next;
+      }
+      else
+      {
+         heads[node.slot] = node.next;
+         if (node.next == NIL)
+         {
+            occupied[node.slot / SLOTS] &= ~(uint64_t(1) << (node.slot % SLOTS));
+         }
+      }
+      if (node.next != NIL)
+      {
+         nodes[node.next].prev = node.prev;
+      }
+
+      node.prev = NIL;
+      node.next = NIL;
+   }
+
+   // -------------------------------------------------------
+   // release
+   // -------------------------------------------------------
+
+   void TimerWheel::release(uint32_t index)
+   {
+      Node &node = nodes[index];
+      node.callback = nullptr;
+      node.active = false;
+      node.generation++;
+      node.next = freeHead;
+      freeHead = index;
+      pending--;
+   }
+
+   // -------------------------------------------------------
+   // arrive
+   // -------------------------------------------------------
+
+   void TimerWheel::arrive(uint64_t tick)
+   {
+      current = tick;
+
+      // Each level whose period starts at this tick hands the slot for it down
+      for (unsigned level = 1; level < LEVELS; level++)
+      {
+         if ((current & ((uint64_t(1) << (level * SLOT_BITS)) - 1)) != 0)
+         {
+            break;
+         }
+
+         unsigned slot = (current >> (level * SLOT_BITS)) & (SLOTS - 1);
+         uint32_t index = heads[level * SLOTS + slot];
+         heads[level * SLOTS + slot] = NIL;
+         occupied[level] &= ~(uint64_t(1) << slot);
+
+         while (index != NIL)
+         {
+            uint32_t next = nodes[index].next;
+            link(index);
+            index = next;
+         }
+      }
+   }
+
+   // -------------------------------------------------------
+   // nextEventTick
+   // -------------------------------------------------------
+
+   uint64_t TimerWheel::nextEventTick(uint64_t from) const
+   {
+      uint64_t next = UINT64_MAX;
+
+      // Level 0 only holds timers of the current tick's block of 64
+      if ((from >> SLOT_BITS) == (current >> SLOT_BITS))
+      {
+         uint64_t due = occupied[0] & (~uint64_t(0) << (from & (SLOTS - 1)));
+         if (due)
+         {
+            return (from & ~uint64_t(SLOTS - 1)) + std::countr_zero(due);
+         }
+      }
+
+      // Higher levels need attention at the start of the first occupied slot ahead
+      for (unsigned level = 1; level < LEVELS; level++)
+      {
+         unsigned shift = level * SLOT_BITS;
+         unsigned position = (current >> shift) & (SLOTS - 1);
+         uint64_t ahead = position == SLOTS - 1 ? 0 : occupied[level] & (~uint64_t(0) << (position + 1));
+         if (ahead)
+         {
+            uint64_t base = current & ~((uint64_t(1) << (shift + SLOT_BITS)) - 1);
+            next = std::min(next, base + (uint64_t(std::countr_zero(ahead)) << shift));
+         }
+      }
+      return next;
+   }
+
+   // -------------------------------------------------------
+   // popExpired
+   // -------------------------------------------------------
+
+   bool TimerWheel::popExpired(uint64_t target, std::function<void()> &callback)
+   {
+      while (current <= target)
+      {
+         uint32_t index = heads[current & (SLOTS - 1)];
+         if (index != NIL)
+         {
+            unlink(index);
+            callback = std::move(nodes[index].callback);
+            release(index);
+            return true;
+         }
+
+         // Nothing left at this tick, skip the idle ticks up to the next one that matters
+         uint64_t next = nextEventTick(current + 1);
+         arrive(std::min(next, target + 1));
+      }
+      return false;
+   }
+
+   // -------------------------------------------------------
+   // TimerService
+   // -------------------------------------------------------
+
+   TimerService::TimerService(std::chrono::milliseconds tick) : wheel(tick)
+   {
+   }
+
+   TimerService::~TimerService()
+   {
+      {
+         std::lock_guard<std::mutex> lock(mut);
+         stopping = true;
+      }
+      changed.notify_one();
+
+      if (runner.joinable())
+      {
+         runner.join();
+      }
+   }
+
+   // -------------------------------------------------------
+   // schedule
+   // -------------------------------------------------------
+
+   TimerId TimerService::schedule(std::chrono::milliseconds delay, std::function<void()> callback)
+   {
+      std::lock_guard<std::mutex> lock(mut);
+
+      TimerId id = wheel.schedule(delay, std::move(callback));
+      if (!runner.joinable())
+      {
+         runner = std::thread(&TimerService::run, this);
+      }
+      wakeIfSooner();
+      return id;
+   }
+
+   bool TimerService::cancel(TimerId id)
+   {
+      std::lock_guard<std::mutex> lock(mut);
+      return wheel.cancel(id);
+   }
+
+   bool TimerService::reschedule(TimerId id, std::chrono::milliseconds delay)
+   {
+      std::lock_guard<std::mutex> lock(mut);
+
+      // Later expiries never need the runner woken, it finds them when it gets there
+      bool found = wheel.reschedule(id, delay);
+      if (found)
+      {
+         wakeIfSooner();
+      }
+      return found;
+   }
+
+   std::size_t TimerService::size() const
+   {
+      std::lock_guard<std::mutex> lock(mut);
+      return wheel.size();
+   }
+
+   // -------------------------------------------------------
+   // wakeIfSooner
+   // -------------------------------------------------------
+
+   void TimerService::wakeIfSooner()
+   {
+      auto deadline = wheel.nextDeadline();
+      if (deadline && (!wakeAt || *deadline < *wakeAt))
+      {
+         changed.notify_one();
+      }
+   }
+
+   // -------------------------------------------------------
+   // run
+   // -------------------------------------------------------
+
+   void TimerService::run()
+   {
+      std::vector<std::function<void()>> expired;
+      std::unique_lock<std::mutex> lock(mut);
+
+      while (!stopping)
+      {
+         wakeAt = wheel.nextDeadline();
+         if (!wakeAt)
+         {
+            changed.wait(lock);
+         }
+         else if (*wakeAt > TimerWheel::Clock::now())
+         {
+            changed.wait_until(lock, *wakeAt);
+         }
+
+         wheel.advance(TimerWheel::Clock::now(), [&expired](std::function<void()> &&callback) {
+            expired.push_back(std::move(callback));
+         });
+
+         if (!expired.empty())
+         {
+            lock.unlock();
+            for (std::function<void()> &callback : expired)
+            {
+               if (callback)
+               {
+                  callback();
+               }
+            }
+            expired.clear();
+            lock.lock();
+         }
+      }
+   }
+}
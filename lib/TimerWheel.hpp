@@ -0,0 +1,203 @@
+#ifndef NET_TIMER_WHEEL_HPP
+#define NET_TIMER_WHEEL_HPP
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+//!
+//! \file TimerWheel.hpp
+//! \brief Hierarchical timer wheel for idle timeouts and deadlines
+//!
+namespace nettle
+{
+   //!
+   //! \brief Handle of a scheduled timer, never 0
+   //!
+   using TimerId = uint64_t;
+
+   constexpr TimerId NO_TIMER = 0; //! A handle that never names a timer
+
+   //!
+   //! \class TimerWheel
+   //! \brief Timers bucketed by expiry tick on six levels of 64 slots, each level
+   //!        64 times coarser than the one below. Scheduling, rescheduling and
+   //!        cancelling are O(1), timers are only moved down a level as their
+   //!        expiry draws near. Not thread safe, meant to be owned by one loop
+   //! \note Timers fire no earlier than asked, and at most one tick late once
+   //!       advance is called. Delays are capped at 2^36 ticks
+   //!
+   class TimerWheel
+   {
+   public:
+      using Clock = std::chrono::steady_clock;
+
+      //!
+      //! \brief Create a wheel
+      //! \param tick Resolution of the wheel
+      //! \param start Time tick 0 starts at
+      //!
+      explicit TimerWheel(std::chrono::milliseconds tick = std::chrono::milliseconds(1),
+                          Clock::time_point start = Clock::now());
+
+      TimerWheel(const TimerWheel &) = delete;
+      TimerWheel &operator=(const TimerWheel &) = delete;
+
+      //!
+      //! \brief Run callback once delay has passed, as seen by advance
+      //! \returns Handle to cancel or reschedule the timer with
+      //!
+      TimerId schedule(std::chrono::milliseconds delay, std::function<void()> callback, Clock::time_point now = Clock::now());
+
+      //!
+      //! \brief Drop a timer before it fires
+      //! \retval true iff the timer was pending
+      //!
+      bool cancel(TimerId id);
+
+      //!
+      //! \brief Push a pending timer's expiry out to delay from now, e.g. on activity
+      //! \retval true iff the timer was pending
+      //!
+      bool reschedule(TimerId id, std::chrono::milliseconds delay, Clock::time_point now = Clock::now());
+
+      //!
+      //! \brief Fire every timer that expired by now, in expiry order
+      //! \returns Number of timers fired
+      //! \note Callbacks may schedule and cancel timers, timers they schedule
+      //!       fire on a later call at the earliest
+      //!
+      std::size_t advance(Clock::time_point now = Clock::now());
+
+      //!
+      //! \brief Hand the callback of every timer that expired by now to expired
+      //!        instead of running it, e.g. to run them outside a lock
+      //!
+      template <typename Expired>
+      std::size_t advance(Clock::time_point now, Expired &&expired)
+      {
+         std::size_t fired = 0;
+         uint64_t target = ticksAt(now);
+
+         std::function<void()> callback;
+         while (popExpired(target, callback))
+         {
+            expired(std::move(callback));
+            fired++;
+         }
+         return fired;
+      }
+
+      //!
+      //! \brief Earliest time advance has work to do, nullopt without pending timers
+      //! \note Can be ahead of the earliest expiry when a timer has to be moved
+      //!       down a level first, use it to bound a poll / wait
+      //!
+      std::optional<Clock::time_point> nextDeadline() const;
+
+      //!
+      //! \retval Number of pending timers
+      //!
+      std::size_t size() const;
+
+   private:
+      static constexpr unsigned LEVELS = 6;
+      static constexpr unsigned SLOT_BITS = 6;
+      static constexpr unsigned SLOTS = 1u << SLOT_BITS;
+      static constexpr uint32_t NIL = UINT32_MAX;
+
+      struct Node
+      {
+         std::function<void()> callback;
+         uint64_t expiry = 0;
+         uint32_t prev = NIL;
+         uint32_t next = NIL;
+         uint32_t generation = 1;
+         uint16_t slot = 0;
+         bool active = false;
+      };
+
+      std::chrono::milliseconds tick;
+      Clock::time_point origin;
+      uint64_t current {0}; // Every timer due before this tick has fired
+
+      // Nodes are recycled through a free list, handles carry a generation to spot stale ones
+      std::vector<Node> nodes;
+      uint32_t freeHead {NIL};
+      std::size_t pending {0};
+
+      std::array<uint32_t, LEVELS * SLOTS> heads;
+      std::array<uint64_t, LEVELS> occupied {}; // Bit per non empty slot
+
+      uint64_t ticksAt(Clock::time_point now) const;
+      uint64_t expiryTick(std::chrono::milliseconds delay, Clock::time_point now) const;
+      Node *find(TimerId id);
+
+      void link(uint32_t index);
+      void unlink(uint32_t index);
+      void release(uint32_t index);
+      void arrive(uint64_t tick);
+      uint64_t nextEventTick(uint64_t from) const;
+      bool popExpired(uint64_t target, std::function<void()> &callback);
+   };
+
+   //!
+   //! \class TimerService
+   //! \brief A thread safe TimerWheel driven by its own thread, started on the
+   //!        first schedule. Callbacks run on that thread, outside the lock
+   //! \note Timers still pending when the service is destroyed never fire
+   //!
+   class TimerService
+   {
+   public:
+      //!
+      //! \param tick Resolution of the timers
+      //!
+      explicit TimerService(std::chrono::milliseconds tick = std::chrono::milliseconds(1));
+
+      ~TimerService();
+
+      TimerService(const TimerService &) = delete;
+      TimerService &operator=(const TimerService &) = delete;
+
+      //!
+      //! \brief Run callback on the timer thread once delay has passed
+      //!
+      TimerId schedule(std::chrono::milliseconds delay, std::function<void()> callback);
+
+      //!
+      //! \retval true iff the timer was pending, false if it already fired (or is firing)
+      //!
+      bool cancel(TimerId id);
+
+      //!
+      //! \retval true iff the pending timer now expires delay from now
+      //!
+      bool reschedule(TimerId id, std::chrono::milliseconds delay);
+
+      //!
+      //! \retval Number of pending timers
+      //!
+      std::size_t size() const;
+
+   private:
+      mutable std::mutex mut;
+      std::condition_variable changed;
+      TimerWheel wheel;
+      std::optional<TimerWheel::Clock::time_point> wakeAt;
+      bool stopping {false};
+      std::thread runner;
+
+      void wakeIfSooner();
+      void run();
+   };
+}
+
+#endif
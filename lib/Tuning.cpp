@@ -0,0 +1,232 @@
+#include "Tuning.hpp"
+
+#include <cerrno>
+#include <iostream>
+
+#ifdef _MSC_VER
+#include <winsock.h>
+#else
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#endif
+
+namespace nettle
+{
+   // -------------------------------------------------------
+   // lowLatency
+   // -------------------------------------------------------
+
+   TuningProfile TuningProfile::lowLatency()
+   {
+      TuningProfile profile;
+      profile.noDelay = true;
+      profile.quickAck = true;
+      profile.busyPollUs = 50;
+      profile.priority = 6;
+      return profile;
+   }
+
+   // -------------------------------------------------------
+   // bulkThroughput
+   // -------------------------------------------------------
+
+   TuningProfile TuningProfile::bulkThroughput()
+   {
+      TuningProfile profile;
+      profile.noDelay = false;
+      profile.recvBuffer = 4 * 1024 * 1024;
+      profile.sendBuffer = 4 * 1024 * 1024;
+      profile.deferAcceptSec = 1;
+      return profile;
+   }
+
+   // -------------------------------------------------------
+   // TuningReport
+   // -------------------------------------------------------
+
+   const TuningOutcome *TuningReport::find(SocketOption option) const
+   {
+      for (const TuningOutcome &outcome : outcomes)
+      {
+         if (outcome.option == option)
+         {
+            return &outcome;
+         }
+      }
+      return nullptr;
+   }
+
+   bool TuningReport::applied(SocketOption option) const
+   {
+      const TuningOutcome *outcome = find(option);
+      return outcome && outcome->error == 0;
+   }
+
+   bool TuningReport::allApplied() const
+   {
+      for (const TuningOutcome &outcome : outcomes)
+      {
+         if (outcome.error != 0)
+         {
+            return false;
+         }
+      }
+      return true;
+   }
+
+   namespace
+   {
+      // Sets an int option and reads back what the kernel made of it
+      void setOption(TuningReport &report, int fd, SocketOption option, int level, int name, int value)
+      {
+         TuningOutcome outcome{option, value, -1, 0};
+
+         if (setsockopt(fd, level, name, (const char *)&value, sizeof(value)) < 0)
+         {
+            outcome.error = errno;
+         }
+         else
+         {
+            int effective = 0;
+            socklen_t length = sizeof(effective);
+            if (getsockopt(fd, level, name, (char *)&effective, &length) == 0)
+            {
+               outcome.effective = effective;
+            }
+         }
+
+         report.outcomes.push_back(outcome);
+      }
+
+      // Options the platform lacks are reported as unsupported rather than skipped silently.
+      // Unused where the platform has them all
+      [[maybe_unused]] void unsupported(TuningReport &report, SocketOption option, int value)
+      {
+         report.outcomes.push_back(TuningOutcome{option, value, -1, ENOPROTOOPT});
+      }
+   }
+
+   // -------------------------------------------------------
+   // applyTuning
+   // -------------------------------------------------------
+
+   TuningReport applyTuning(int fd, const TuningProfile &profile, SocketRole role)
+   {
+      TuningReport report;
+
+      bool tcp = role != SocketRole::UDP;
+      bool listener = role == SocketRole::TCP_LISTENER;
+
+      // Accepted connections take most options over from the listener, those are set once
+      // there instead of again on every connection
+      bool inherited = role == SocketRole::TCP_CONNECTION;
+
+      // Buffers must be sized before listen / connect for the window scale to account for them
+      if (!inherited)
+      {
+         if (profile.recvBuffer)
+         {
+            setOption(report, fd, SocketOption::RECV_BUFFER, SOL_SOCKET, SO_RCVBUF, *profile.recvBuffer);
+         }
+         if (profile.sendBuffer)
+         {
+            setOption(report, fd, SocketOption::SEND_BUFFER, SOL_SOCKET, SO_SNDBUF, *profile.sendBuffer);
+         }
+      }
+
+      if (tcp && !inherited && profile.noDelay)
+      {
+         setOption(report, fd, SocketOption::NO_DELAY, IPPROTO_TCP, TCP_NODELAY, *profile.noDelay ? 1 : 0);
+      }
+
+      // Quick ACK is the one option connections don't inherit
+      if (tcp && !listener)
+      {
+         if (profile.quickAck)
+         {
+#ifdef TCP_QUICKACK
+            setOption(report, fd, SocketOption::QUICK_ACK, IPPROTO_TCP, TCP_QUICKACK, *profile.quickAck ? 1 : 0);
+#else
+            unsupported(report, SocketOption::QUICK_ACK, *profile.quickAck ? 1 : 0);
+#endif
+         }
+      }
+
+      if (!inherited)
+      {
+         if (profile.busyPollUs)
+         {
+#ifdef SO_BUSY_POLL
+            setOption(report, fd, SocketOption::BUSY_POLL, SOL_SOCKET, SO_BUSY_POLL, *profile.busyPollUs);
+#else
+            unsupported(report, SocketOption::BUSY_POLL, *profile.busyPollUs);
+#endif
+         }
+         if (profile.priority)
+         {
+#ifdef SO_PRIORITY
+            setOption(report, fd, SocketOption::PRIORITY, SOL_SOCKET, SO_PRIORITY, *profile.priority);
+#else
+            unsupported(report, SocketOption::PRIORITY, *profile.priority);
+#endif
+         }
+      }
+
+      if (profile.fastOpen && (listener || role == SocketRole::TCP_CLIENT))
+      {
+#if defined(TCP_FASTOPEN) && defined(TCP_FASTOPEN_CONNECT)
+         if (listener)
+         {
+            setOption(report, fd, SocketOption::FAST_OPEN, IPPROTO_TCP, TCP_FASTOPEN, *profile.fastOpen);
+         }
+         else
+         {
+            setOption(report, fd, SocketOption::FAST_OPEN, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, *profile.fastOpen > 0 ? 1 : 0);
+         }
+#else
+         unsupported(report, SocketOption::FAST_OPEN, *profile.fastOpen);
+#endif
+      }
+
+      if (profile.deferAcceptSec && listener)
+      {
+#ifdef TCP_DEFER_ACCEPT
+         setOption(report, fd, SocketOption::DEFER_ACCEPT, IPPROTO_TCP, TCP_DEFER_ACCEPT, *profile.deferAcceptSec);
+#else
+         unsupported(report, SocketOption::DEFER_ACCEPT, *profile.deferAcceptSec);
+#endif
+      }
+
+      return report;
+   }
+
+   // -------------------------------------------------------
+   // pinThread
+   // -------------------------------------------------------
+
+   bool pinThread(std::thread &thread, int cpu)
+   {
+#if defined(__linux__)
+      if (cpu < 0)
+      {
+         return false;
+      }
+
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      CPU_SET(cpu, &cpus);
+
+      if (pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus) != 0)
+      {
+         std::cerr << "Unable to pin thread to cpu " << cpu << std::endl;
+         return false;
+      }
+      return true;
+#else
+      return false;
+#endif
+   }
+}
@@ -0,0 +1,126 @@
+#ifndef NET_TUNING_HPP
+#define NET_TUNING_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <thread>
+#include <vector>
+
+//!
+//! \file Tuning.hpp
+//! \brief Socket option profiles applied by servers and writers as they set up sockets
+//!
+namespace nettle
+{
+   //!
+   //! \brief A socket option a TuningProfile can set
+   //!
+   enum class SocketOption
+   {
+      NO_DELAY,     //! TCP_NODELAY
+      RECV_BUFFER,  //! SO_RCVBUF
+      SEND_BUFFER,  //! SO_SNDBUF
+      BUSY_POLL,    //! SO_BUSY_POLL
+      QUICK_ACK,    //! TCP_QUICKACK
+      FAST_OPEN,    //! TCP_FASTOPEN on listeners, TCP_FASTOPEN_CONNECT on clients
+      DEFER_ACCEPT, //! TCP_DEFER_ACCEPT
+      PRIORITY      //! SO_PRIORITY
+   };
+
+   //!
+   //! \brief What a socket is used for, decides which options of a profile apply to it
+   //!
+   enum class SocketRole
+   {
+      TCP_LISTENER,   //! Listening socket, gets everything accepted connections inherit
+      TCP_CONNECTION, //! Connection accepted by a server, only gets what it doesn't inherit
+      TCP_CLIENT,     //! Outgoing connection, tuned before it connects
+      UDP             //! Datagram socket
+   };
+
+   //!
+   //! \brief Socket options to set. Anything left unset keeps the kernel's (or,
+   //!        for the timeouts, the library's) default
+   //!
+   struct TuningProfile
+   {
+      std::optional<std::chrono::milliseconds> recvTimeout; //! SO_RCVTIMEO of connections and datagram sockets, servers
+                                                            //! set it on the listener for connections to inherit
+      std::optional<std::chrono::milliseconds> sendTimeout; //! SO_SNDTIMEO of connections and datagram sockets, as above
+      std::optional<bool> noDelay;                          //! Disable Nagle's algorithm
+      std::optional<int> recvBuffer;                        //! Receive buffer size requested, the kernel doubles and caps it
+      std::optional<int> sendBuffer;                        //! Send buffer size requested, the kernel doubles and caps it
+      std::optional<int> busyPollUs;                        //! Microseconds to busy poll the device queue on a blocking read
+      std::optional<bool> quickAck;                         //! Acknowledge right away instead of delaying ACKs
+      std::optional<int> fastOpen;                          //! Listener: pending TFO request queue length. Client: > 0 enables TFO
+      std::optional<int> deferAcceptSec;                    //! Only wake accept once data arrived, giving up after this long
+      std::optional<int> priority;                          //! Queueing priority of outgoing packets, 0 - 6 without CAP_NET_ADMIN
+
+      //!
+      //! \brief Small messages out immediately: no Nagle, quick ACKs, busy polling
+      //!        and a raised packet priority
+      //!
+      static TuningProfile lowLatency();
+
+      //!
+      //! \brief Large transfers: big socket buffers, Nagle left on, accepts
+      //!        deferred until the first request arrives
+      //!
+      static TuningProfile bulkThroughput();
+   };
+
+   //!
+   //! \brief Outcome of setting one option
+   //!
+   struct TuningOutcome
+   {
+      SocketOption option; //! The option
+      int requested;       //! Value asked for
+      int effective;       //! Value read back from the socket, -1 if it could not be read
+      int error;           //! errno of the failed setsockopt, 0 if it took effect
+   };
+
+   //!
+   //! \brief Which options of a profile took effect on a socket
+   //!
+   struct TuningReport
+   {
+      std::vector<TuningOutcome> outcomes; //! One per option the profile set and the socket's role uses
+
+      //!
+      //! \retval true iff the option was set without error
+      //!
+      bool applied(SocketOption option) const;
+
+      //!
+      //! \retval The outcome for the option, nullptr if it was not attempted
+      //!
+      const TuningOutcome *find(SocketOption option) const;
+
+      //!
+      //! \retval true iff every attempted option took effect
+      //!
+      bool allApplied() const;
+   };
+
+   //!
+   //! \brief Set the options of a profile that matter for the role of a socket
+   //! \param fd The socket
+   //! \param profile Options to set
+   //! \param role What the socket is used for
+   //! \returns An outcome for every option attempted
+   //! \note Timeouts are left to Socket, they are applied as it is set up
+   //!
+   TuningReport applyTuning(int fd, const TuningProfile &profile, SocketRole role);
+
+   //!
+   //! \brief Pin a thread to one CPU, the threads of a server shard stay on the core its traffic lands on
+   //! \param thread Started thread to pin
+   //! \param cpu CPU index, negative leaves the thread where the scheduler puts it
+   //! \returns true iff the thread was pinned
+   //!
+   bool pinThread(std::thread &thread, int cpu);
+}
+
+#endif
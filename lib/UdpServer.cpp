@@ -0,0 +1,993 @@
+#include "UdpServer.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#if defined(__linux__)
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <linux/filter.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#endif
+
+namespace nettle
+{
+   namespace
+   {
+      constexpr std::size_t UDP_IP_HEADERS = 28;       // IPv4 + UDP header bytes
+      constexpr std::size_t MAX_UDP_PAYLOAD = 65507;
+      constexpr std::size_t ETHERNET_PAYLOAD = 1500 - UDP_IP_HEADERS;
+      constexpr int DEFAULT_BUSY_POLL_US = 50;
+
+      // Label the wait strategy is exported under in metrics
+      const char *waitStrategyName(WaitStrategy wait)
+      {
+         switch (wait)
+         {
+         case WaitStrategy::BLOCKING:
+            return "blocking";
+         case WaitStrategy::ADAPTIVE:
+            return "adaptive";
+         case WaitStrategy::BUSY_POLL:
+            return "busy_poll";
+         default:
+            return "timed";
+         }
+      }
+
+#if defined(__linux__)
+      constexpr std::size_t CONTROL_SIZE = CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(timespec));
+
+      // Pulls the kernel receive time and the GRO segment size out of a message's control data
+      void readControl(msghdr &message,
+                       bool kernelTimestamps,
+                       std::chrono::system_clock::time_point &timestamp,
+                       std::size_t &segmentSize)
+      {
+         for (cmsghdr *cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg))
+         {
+            if (kernelTimestamps && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+            {
+               timespec ts;
+               memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+               timestamp = std::chrono::system_clock::time_point(
+                   std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                       std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec)));
+            }
+#if defined(UDP_GRO)
+            else if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO)
+            {
+               int gsoSize;
+               memcpy(&gsoSize, CMSG_DATA(cmsg), sizeof(gsoSize));
+               if (gsoSize > 0)
+               {
+                  segmentSize = gsoSize;
+               }
+            }
+#endif
+         }
+      }
+
+      // Splits a coalesced receive back into the datagrams the sender wrote,
+      // each copied out into its own pooled buffer
+      void appendSegments(std::vector<DatagramBuffer> &segments,
+                          BufferPool &pool,
+                          const uint8_t *data,
+                          std::size_t length,
+                          std::size_t segmentSize,
+                          const sockaddr_in &source,
+                          std::chrono::system_clock::time_point timestamp)
+      {
+         std::size_t offset = 0;
+         do
+         {
+            std::size_t segmentLength = std::min(segmentSize, length - offset);
+
+            DatagramBuffer segment = pool.acquire();
+            segment.length = std::min(segmentLength, segment.capacity());
+            segment.source = source;
+            segment.timestamp = timestamp;
+            memcpy(segment.data(), data + offset, segment.length);
+
+            segments.push_back(std::move(segment));
+            offset += segmentLength;
+         } while (offset < length);
+      }
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // mtuPayloadSize
+   // ---------------------------------------------------------
+   std::size_t mtuPayloadSize(const std::string &address)
+   {
+#if defined(__linux__)
+      in_addr_t wanted = inet_addr(address.c_str());
+
+      ifaddrs *interfaces = nullptr;
+      if (getifaddrs(&interfaces) < 0)
+      {
+         return ETHERNET_PAYLOAD;
+      }
+
+      int queryFd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+      int mtu = 0;
+
+      for (ifaddrs *iface = interfaces; iface && queryFd >= 0; iface = iface->ifa_next)
+      {
+         if (!iface->ifa_addr || iface->ifa_addr->sa_family != AF_INET)
+         {
+            continue;
+         }
+
+         in_addr_t ifaceAddr = ((sockaddr_in *)iface->ifa_addr)->sin_addr.s_addr;
+         if (wanted != INADDR_ANY && ifaceAddr != wanted)
+         {
+            continue;
+         }
+
+         ifreq request {};
+         strncpy(request.ifr_name, iface->ifa_name, IFNAMSIZ - 1);
+
+         if (ioctl(queryFd, SIOCGIFMTU, &request) == 0)
+         {
+            mtu = std::max(mtu, request.ifr_mtu);
+         }
+      }
+
+      if (queryFd >= 0)
+      {
+         CLOSE_FD(queryFd);
+      }
+      freeifaddrs(interfaces);
+
+      if (mtu <= static_cast<int>(UDP_IP_HEADERS))
+      {
+         return ETHERNET_PAYLOAD;
+      }
+
+      return std::min<std::size_t>(mtu - UDP_IP_HEADERS, MAX_UDP_PAYLOAD);
+#else
+      return ETHERNET_PAYLOAD;
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // UdpServer
+   // ---------------------------------------------------------
+   UdpServer::UdpServer(HostPort hostPort,
+                        UdpDatagramHandler &datagramHandler,
+                        UdpServerConfig config,
+                        std::function<void(SocketError)> errorCb) : Socket(countingErrors(serverMetrics, errorCb)),
+                                                                    hostPort(hostPort),
+                                                                    datagramHandler(datagramHandler),
+                                                                    config(config),
+                                                                    errorCb(countingErrors(serverMetrics, errorCb)),
+                                                                    threadRunning(false)
+   {
+      if (this->config.batchSize == 0)
+      {
+         this->config.batchSize = 1;
+      }
+
+      if (this->config.datagramSize == 0)
+      {
+         this->config.datagramSize = mtuPayloadSize(this->hostPort.getAddress());
+      }
+
+      // Spinning receives only poll the device queue with busy polling enabled on the socket
+      if (this->config.wait == WaitStrategy::BUSY_POLL && !this->config.tuning.busyPollUs)
+      {
+         this->config.tuning.busyPollUs = DEFAULT_BUSY_POLL_US;
+      }
+
+      std::size_t preallocate = (this->config.pooledBuffers > 0) ? this->config.pooledBuffers : 4 * this->config.batchSize;
+
+      pool = BufferPool::create(this->config.datagramSize, preallocate);
+
+      if (this->config.workerThreads > 0)
+      {
+         ring = std::make_unique<Ring<DatagramBuffer>>(this->config.ringCapacity);
+      }
+   }
+
+   // ---------------------------------------------------------
+   // ~UdpServer
+   // ---------------------------------------------------------
+   UdpServer::~UdpServer()
+   {
+      this->socketClose();
+#if defined(_MSC_VER)
+      WSACleanup();
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // serve
+   // ---------------------------------------------------------
+   bool UdpServer::serve()
+   {
+      {
+         std::lock_guard<std::mutex> lock(threadMut);
+
+         if (threadRunning)
+         {
+            std::cerr << "Thread already started" << std::endl;
+            return false;
+         }
+      }
+
+      // Made before the thread starts so stop always finds it
+      WaitStrategy wait = WaitStrategy::TIMED;
+#if defined(__linux__)
+      wait = config.wait;
+      if (wait == WaitStrategy::BLOCKING || wait == WaitStrategy::ADAPTIVE)
+      {
+         if ((wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+         {
+            wait = WaitStrategy::TIMED;
+         }
+      }
+#endif
+      activeWait = wait;
+      activeSteering = ShardSteering::KERNEL;
+
+      threadRunning = true;
+
+      serverThread = std::thread(
+          [](UdpServer *server)
+          {
+             if (!server->openSocket())
+             {
+                return;
+             }
+
+             server->groEnabled = server->config.gro;
+             for (const Shard &shard : server->shards)
+             {
+                server->groEnabled = server->groEnabled && server->enableGro(shard.fd);
+             }
+
+             if (server->config.shards > 0 && server->config.steering != ShardSteering::KERNEL && server->attachSteering())
+             {
+                server->activeSteering = server->config.steering;
+             }
+
+             server->datagramHandler.serverStarted();
+
+             std::vector<std::thread> workers;
+             if (server->ring)
+             {
+                server->workersRunning = true;
+                for (std::size_t i = 0; i < server->config.workerThreads; i++)
+                {
+                   workers.emplace_back(&UdpServer::runWorker, server);
+                }
+             }
+
+             // The server thread receives on the first shard, every other shard gets a thread of its own
+             std::vector<std::thread> receivers;
+             for (std::size_t i = 1; i < server->shards.size(); i++)
+             {
+                receivers.emplace_back(&UdpServer::receiveBatches, server, std::cref(server->shards[i]));
+                pinThread(receivers.back(), server->shards[i].cpu);
+             }
+
+             server->receiveBatches(server->shards[0]);
+
+             for (std::thread &receiver : receivers)
+             {
+                receiver.join();
+             }
+
+             // Workers handle what is still queued before they see the flag
+             if (server->ring)
+             {
+                server->workersRunning.store(false, std::memory_order_release);
+                server->published.fetch_add(1, std::memory_order_release);
+                server->published.notify_all();
+             }
+             for (std::thread &worker : workers)
+             {
+                worker.join();
+             }
+
+             server->closeShards();
+             server->socketClose();
+          } // End func
+          ,
+          this);
+
+      pinThread(serverThread, config.shardCpus.empty() ? -1 : config.shardCpus[0]);
+
+      return true;
+   }
+
+   // ---------------------------------------------------------
+   // stop
+   // ---------------------------------------------------------
+   bool UdpServer::stop()
+   {
+      std::lock_guard<std::mutex> lock(threadMut);
+
+      if (!threadRunning)
+      {
+         std::cerr << "Thread not running" << std::endl;
+         return false;
+      }
+
+      threadRunning = false;
+
+#if defined(__linux__)
+      if (wakeFd >= 0)
+      {
+         // Never read, so a receive loop about to block still finds it readable
+         uint64_t wake = 1;
+         if (::write(wakeFd, &wake, sizeof(wake)) < 0)
+         {
+            std::cerr << "Unable to wake the receive loop" << std::endl;
+         }
+      }
+#endif
+
+      datagramHandler.serverStopping();
+
+      serverThread.join();
+
+      if (wakeFd >= 0)
+      {
+         CLOSE_FD(wakeFd);
+         wakeFd = -1;
+      }
+
+      datagramHandler.serverStopped();
+
+      return true;
+   }
+
+   std::size_t UdpServer::datagramSize() const
+   {
+      return config.datagramSize;
+   }
+
+   std::shared_ptr<BufferPool> UdpServer::bufferPool() const
+   {
+      return pool;
+   }
+
+   IoEngine UdpServer::ioEngine() const
+   {
+      return activeEngine.load();
+   }
+
+   WaitStrategy UdpServer::waitStrategy() const
+   {
+      return activeWait.load();
+   }
+
+   ShardSteering UdpServer::steering() const
+   {
+      return activeSteering.load();
+   }
+
+   const TuningReport &UdpServer::tuningReport() const
+   {
+      return this->tuning;
+   }
+
+   MetricsSnapshot UdpServer::metrics() const
+   {
+      MetricsSnapshot snapshot = serverMetrics.snapshot();
+      snapshot.waitStrategy = waitStrategyName(activeWait.load());
+
+      // The ring counts its own drops, it knows about them first
+      if (ring)
+      {
+         snapshot.counters[static_cast<std::size_t>(Counter::DATAGRAMS_DROPPED)] += ring->stats().dropped;
+      }
+      return snapshot;
+   }
+
+   RingStats UdpServer::ringStats() const
+   {
+      return ring ? ring->stats() : RingStats();
+   }
+
+   // ---------------------------------------------------------
+   // openSocket
+   // ---------------------------------------------------------
+   bool UdpServer::openSocket()
+   {
+#ifdef _MSC_VER
+      WSADATA ws_data;
+      if (WSAStartup(MAKEWORD(2, 0), &ws_data) != 0)
+      {
+         errorCb(SocketError::WSAStartup);
+         return false;
+      }
+#endif
+      memset(&this->sockAddr, 0, sizeof(this->sockAddr));
+      this->sockAddr.sin_family = AF_INET;
+      this->sockAddr.sin_addr.s_addr = inet_addr(this->hostPort.getAddress().c_str());
+      this->sockAddr.sin_port = htons(this->hostPort.getPort());
+
+      if ((this->socketFd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+      {
+         errorCb(SocketError::SOCKET_CREATE);
+         return false;
+      }
+
+      // Buffer sizes requested before bind are in place before the first datagram lands
+      this->applyTuning(this->config.tuning, SocketRole::UDP);
+
+      if (!bindShard(this->socketFd))
+      {
+         CLOSE_FD(this->socketFd);
+         return false;
+      }
+
+      if (!this->setupSocket(this->socketFd, this->sockAddr))
+      {
+         return false;
+      }
+
+      // Sharded servers bind one SO_REUSEPORT socket per shard, each set up
+      // like the first one, timeouts included
+      shards.clear();
+      std::size_t numShards = std::max<std::size_t>(this->config.shards, 1);
+
+      for (std::size_t i = 0; i < numShards; i++)
+      {
+         Shard shard;
+         shard.cpu = (i < this->config.shardCpus.size()) ? this->config.shardCpus[i] : -1;
+
+         if (i == 0)
+         {
+            shard.fd = this->socketFd;
+         }
+         else if ((shard.fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+         {
+            errorCb(SocketError::SOCKET_CREATE);
+            closeShards();
+            return false;
+         }
+         else
+         {
+            nettle::applyTuning(shard.fd, this->config.tuning, SocketRole::UDP);
+            setsockopt(shard.fd, SOL_SOCKET, SO_RCVTIMEO, (char *)&recvTimeout, sizeof(recvTimeout));
+            setsockopt(shard.fd, SOL_SOCKET, SO_SNDTIMEO, (char *)&sendTimeout, sizeof(sendTimeout));
+
+            if (!bindShard(shard.fd))
+            {
+               CLOSE_FD(shard.fd);
+               closeShards();
+               return false;
+            }
+         }
+
+         shards.push_back(shard);
+      }
+
+      return true;
+   }
+
+   // ---------------------------------------------------------
+   // bindShard
+   // ---------------------------------------------------------
+   bool UdpServer::bindShard(int fd)
+   {
+      // Must be set on every socket of the group before it binds
+      bool reusePort = this->config.shards > 0;
+#ifdef SO_REUSEPORT
+      int enable = 1;
+      if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0)
+      {
+         errorCb(SocketError::SOCKET_REUSEPORT);
+         return false;
+      }
+#else
+      if (reusePort)
+      {
+         errorCb(SocketError::SOCKET_REUSEPORT);
+         return false;
+      }
+#endif
+
+      if (::bind(fd, (sockaddr *)&this->sockAddr, sizeof(this->sockAddr)) < 0)
+      {
+         errorCb(SocketError::SOCKET_BIND);
+         return false;
+      }
+      return true;
+   }
+
+   // ---------------------------------------------------------
+   // closeShards
+   // ---------------------------------------------------------
+   void UdpServer::closeShards()
+   {
+      // The first shard's socket is the server's own, closed by socketClose
+      for (std::size_t i = 1; i < shards.size(); i++)
+      {
+         CLOSE_FD(shards[i].fd);
+      }
+      shards.clear();
+   }
+
+   // ---------------------------------------------------------
+   // attachSteering
+   // ---------------------------------------------------------
+   bool UdpServer::attachSteering()
+   {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+      // The program returns the index of the socket in the reuseport group,
+      // which is the order the shards were bound in
+      uint32_t count = static_cast<uint32_t>(shards.size());
+      std::vector<sock_filter> program;
+
+      if (config.steering == ShardSteering::FLOW)
+      {
+         // Source address xor source port, read relative to the IPv4 header (negative
+         // offsets reach back from the payload the program is otherwise given). The port
+         // follows however many options the header carries, X is set to its length first
+         program = {BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, static_cast<uint32_t>(SKF_NET_OFF)),
+                    BPF_STMT(BPF_LD | BPF_H | BPF_IND, static_cast<uint32_t>(SKF_NET_OFF)),
+                    BPF_STMT(BPF_MISC | BPF_TAX, 0),
+                    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<uint32_t>(SKF_NET_OFF + 12)),
+                    BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+                    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, count),
+                    BPF_STMT(BPF_RET | BPF_A, 0)};
+      }
+      else
+      {
+         program = {BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)),
+                    BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, count),
+                    BPF_STMT(BPF_RET | BPF_A, 0)};
+      }
+
+      sock_fprog filter {static_cast<unsigned short>(program.size()), program.data()};
+      return setsockopt(this->socketFd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &filter, sizeof(filter)) == 0;
+#else
+      return false;
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // enableGro
+   // ---------------------------------------------------------
+   bool UdpServer::enableGro(int fd)
+   {
+#if defined(__linux__) && defined(UDP_GRO)
+      int enable = 1;
+      return setsockopt(fd, IPPROTO_UDP, UDP_GRO, &enable, sizeof(enable)) == 0;
+#else
+      return false;
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // receiveBatches
+   // ---------------------------------------------------------
+   void UdpServer::receiveBatches(const Shard &shard)
+   {
+      std::size_t batchSize = config.batchSize;
+
+      // Buffers the handler leaves in place are received into again, only the
+      // ones it keeps are replaced from the pool
+      std::vector<DatagramBuffer> slots(batchSize);
+
+#if defined(__linux__)
+      int enable = 1;
+      bool kernelTimestamps = setsockopt(shard.fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) == 0;
+
+      // receiveUring gives up with false if the ring can't be set up or the
+      // receive fails for good, this loop then takes over the socket
+      if (config.engine == IoEngine::IO_URING && IoUring::supported() && receiveUring(shard, kernelTimestamps))
+      {
+         return;
+      }
+
+      // Coalesced receives land in scratch space large enough for a full IP
+      // packet, each segment is then copied out into its own pooled buffer
+      std::size_t scratchSize = groEnabled ? MAX_GRO_RECEIVE : 0;
+
+      std::vector<uint8_t> scratch(batchSize * scratchSize);
+      std::vector<uint8_t> controls(batchSize * CONTROL_SIZE);
+      std::vector<sockaddr_in> sources(batchSize);
+      std::vector<iovec> iovecs(batchSize);
+      std::vector<mmsghdr> messages(batchSize);
+      std::vector<DatagramBuffer> segments;
+
+      for (std::size_t i = 0; i < batchSize; i++)
+      {
+         if (groEnabled)
+         {
+            iovecs[i].iov_base = &scratch[i * scratchSize];
+            iovecs[i].iov_len = scratchSize;
+         }
+
+         memset(&messages[i], 0, sizeof(mmsghdr));
+         messages[i].msg_hdr.msg_iov = &iovecs[i];
+         messages[i].msg_hdr.msg_iovlen = 1;
+         messages[i].msg_hdr.msg_name = &sources[i];
+      }
+
+      // Every strategy but TIMED receives without blocking and does its waiting in awaitDatagrams
+      int receiveFlags = (activeWait == WaitStrategy::TIMED) ? MSG_WAITFORONE : MSG_DONTWAIT;
+      auto lastReceived = std::chrono::steady_clock::now();
+
+      while (threadRunning)
+      {
+         for (std::size_t i = 0; i < batchSize; i++)
+         {
+            if (!groEnabled)
+            {
+               if (!slots[i])
+               {
+                  slots[i] = pool->acquire();
+               }
+               iovecs[i].iov_base = slots[i].data();
+               iovecs[i].iov_len = slots[i].capacity();
+            }
+
+            messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            messages[i].msg_hdr.msg_control = &controls[i * CONTROL_SIZE];
+            messages[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+         }
+
+         // TIMED blocks for the first datagram (bounded by the socket receive
+         // timeout), either way whatever else is already queued comes along
+         int received = recvmmsg(shard.fd, messages.data(), static_cast<unsigned int>(batchSize), receiveFlags, nullptr);
+         serverMetrics.add(Counter::SYSCALLS);
+
+         if (received <= 0)
+         {
+            if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+               serverMetrics.add(Counter::RECEIVE_ERRORS);
+            }
+            awaitDatagrams(shard.fd, lastReceived);
+            continue;
+         }
+
+         if (receiveFlags == MSG_DONTWAIT)
+         {
+            lastReceived = std::chrono::steady_clock::now();
+         }
+
+         auto now = std::chrono::system_clock::now();
+         std::size_t delivered = 0;
+
+         for (int i = 0; i < received; i++)
+         {
+            // A datagram cut short by a small buffer is counted, not delivered
+            if (messages[i].msg_hdr.msg_flags & MSG_TRUNC)
+            {
+               serverMetrics.add(Counter::DATAGRAMS_TRUNCATED);
+               continue;
+            }
+
+            std::size_t length = messages[i].msg_len;
+            std::size_t segmentSize = length;
+            auto timestamp = now;
+
+            readControl(messages[i].msg_hdr, kernelTimestamps, timestamp, segmentSize);
+
+            if (!groEnabled)
+            {
+               // Kept datagrams close up over the truncated ones so the batch stays contiguous
+               slots[i].length = std::min(length, slots[i].capacity());
+               slots[i].source = sources[i];
+               slots[i].timestamp = timestamp;
+               std::swap(slots[delivered++], slots[i]);
+               continue;
+            }
+
+            appendSegments(segments, *pool, &scratch[i * scratchSize], length, segmentSize, sources[i], timestamp);
+         }
+
+         if (groEnabled)
+         {
+            dispatch(std::span<DatagramBuffer>(segments.data(), segments.size()));
+            segments.clear();
+         }
+         else
+         {
+            dispatch(std::span<DatagramBuffer>(slots.data(), delivered));
+         }
+      }
+#else
+      while (threadRunning)
+      {
+         if (!slots[0])
+         {
+            slots[0] = pool->acquire();
+         }
+
+         socklen_t sourceLen = sizeof(sockaddr_in);
+
+         int received = recvfrom(shard.fd,
+                                 (char *)slots[0].data(),
+                                 static_cast<int>(slots[0].capacity()),
+                                 0,
+                                 (sockaddr *)&slots[0].source,
+                                 &sourceLen);
+         serverMetrics.add(Counter::SYSCALLS);
+
+         if (received <= 0)
+         {
+            serverMetrics.add(Counter::EMPTY_RECEIVES);
+            continue;
+         }
+
+         slots[0].length = received;
+         slots[0].timestamp = std::chrono::system_clock::now();
+
+         dispatch(std::span<DatagramBuffer>(slots.data(), 1));
+      }
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // receiveUring
+   // ---------------------------------------------------------
+   bool UdpServer::receiveUring(const Shard &shard, bool kernelTimestamps)
+   {
+#if defined(__linux__)
+      constexpr uint16_t BUFFER_GROUP = 0;
+
+      // Each provided buffer holds the kernel's recvmsg header, the source
+      // address and control data ahead of the payload
+      std::size_t payloadSize = groEnabled ? MAX_GRO_RECEIVE : config.datagramSize;
+      std::size_t bufferSize = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in) + CONTROL_SIZE + payloadSize;
+
+      unsigned bufferCount = 1;
+      while (bufferCount < 4 * config.batchSize && bufferCount < 32768)
+      {
+         bufferCount <<= 1;
+      }
+
+      IoUring ring(64);
+      BufferRing buffers(ring, BUFFER_GROUP, bufferCount, bufferSize);
+      if (!buffers.isOpen())
+      {
+         return false;
+      }
+
+      activeEngine = IoEngine::IO_URING;
+      activeWait = WaitStrategy::TIMED;
+
+      // Set when the receive fails with something re-arming won't fix
+      bool failed = false;
+
+      msghdr layout {};
+      layout.msg_namelen = sizeof(sockaddr_in);
+      layout.msg_controllen = CONTROL_SIZE;
+
+      // One multishot receive keeps posting completions until it runs out of
+      // buffers or fails, only then does it need to be submitted again
+      auto armReceive = [&]()
+      {
+         io_uring_sqe *sqe = ring.getSqe();
+         if (!sqe)
+         {
+            return false;
+         }
+
+         sqe->opcode = IORING_OP_RECVMSG;
+         sqe->fd = shard.fd;
+         sqe->addr = reinterpret_cast<uint64_t>(&layout);
+         sqe->ioprio = IORING_RECV_MULTISHOT;
+         sqe->flags = IOSQE_BUFFER_SELECT;
+         sqe->buf_group = BUFFER_GROUP;
+         return true;
+      };
+
+      bool armed = armReceive();
+      int waitMs = static_cast<int>(recvTimeout.tv_sec * 1000 + recvTimeout.tv_usec / 1000);
+
+      std::vector<DatagramBuffer> batch;
+      batch.reserve(config.batchSize);
+
+      while (threadRunning)
+      {
+         if (!armed)
+         {
+            armed = armReceive();
+         }
+
+         // Waits for the first completion (bounded by the socket receive
+         // timeout) then takes everything else already posted
+         ring.submit(1, waitMs);
+         serverMetrics.add(Counter::SYSCALLS);
+
+         auto now = std::chrono::system_clock::now();
+
+         unsigned completions = ring.forEachCompletion(
+             [&](const io_uring_cqe &cqe)
+             {
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                {
+                   armed = false;
+                }
+
+                if (cqe.res < 0)
+                {
+                   // Out of provided buffers or interrupted: the receive is
+                   // simply armed again, anything else ends the ring
+                   serverMetrics.add(Counter::RECEIVE_ERRORS);
+                   if (cqe.res != -ENOBUFS && cqe.res != -EINTR)
+                   {
+                      failed = true;
+                   }
+                   return;
+                }
+
+                if (!(cqe.flags & IORING_CQE_F_BUFFER))
+                {
+                   return;
+                }
+
+                uint16_t id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                uint8_t *buffer = buffers.buffer(id);
+
+                io_uring_recvmsg_out out;
+                memcpy(&out, buffer, sizeof(out));
+
+                if (out.flags & MSG_TRUNC)
+                {
+                   serverMetrics.add(Counter::DATAGRAMS_TRUNCATED);
+                   buffers.recycle(id);
+                   return;
+                }
+
+                uint8_t *name = buffer + sizeof(out);
+                uint8_t *control = name + layout.msg_namelen;
+                uint8_t *payload = control + layout.msg_controllen;
+
+                sockaddr_in source {};
+                memcpy(&source, name, std::min<std::size_t>(out.namelen, sizeof(source)));
+
+                msghdr received {};
+                received.msg_control = control;
+                received.msg_controllen = out.controllen;
+
+                std::size_t length = std::min<std::size_t>(out.payloadlen, payloadSize);
+                std::size_t segmentSize = length;
+                auto timestamp = now;
+
+                readControl(received, kernelTimestamps, timestamp, segmentSize);
+
+                // The provided buffer goes straight back to the kernel, the
+                // handler gets pooled buffers it is free to keep
+                appendSegments(batch, *pool, payload, length, segmentSize, source, timestamp);
+                buffers.recycle(id);
+             });
+
+         if (completions == 0)
+         {
+            serverMetrics.add(Counter::EMPTY_RECEIVES);
+         }
+
+         if (!batch.empty())
+         {
+            dispatch(std::span<DatagramBuffer>(batch.data(), batch.size()));
+            batch.clear();
+         }
+
+         if (failed)
+         {
+            // Same as the TCP acceptor: the POSIX loop takes over, keeping
+            // the TIMED wait since it needs no wake-up descriptor
+            activeEngine = IoEngine::POSIX;
+            return false;
+         }
+      }
+
+      return true;
+#else
+      return false;
+#endif
+   }
+
+   // ---------------------------------------------------------
+   // dispatch
+   // ---------------------------------------------------------
+   void UdpServer::dispatch(std::span<DatagramBuffer> batch)
+   {
+      std::size_t bytes = 0;
+      for (const DatagramBuffer &datagram : batch)
+      {
+         bytes += datagram.length;
+      }
+      // Shards count straight into the metrics, the socket's own stats aren't shared between threads
+      serverMetrics.add(Counter::BYTES_IN, bytes);
+      serverMetrics.add(Counter::DATAGRAMS_IN, batch.size());
+
+      if (!ring)
+      {
+         handle(batch);
+         return;
+      }
+
+      // Whatever doesn't fit stays behind in the batch and is received into again
+      for (DatagramBuffer &datagram : batch)
+      {
+         ring->tryPush(std::move(datagram));
+      }
+      published.fetch_add(1, std::memory_order_release);
+      published.notify_one();
+   }
+
+   // ---------------------------------------------------------
+   // handle
+   // ---------------------------------------------------------
+   void UdpServer::handle(std::span<DatagramBuffer> batch)
+   {
+      auto started = std::chrono::steady_clock::now();
+      datagramHandler.newBatch(batch);
+      serverMetrics.observe(std::chrono::steady_clock::now() - started);
+   }
+
+   // ---------------------------------------------------------
+   // runWorker
+   // ---------------------------------------------------------
+   void UdpServer::runWorker()
+   {
+      std::vector<DatagramBuffer> batch;
+      batch.reserve(config.batchSize);
+
+      while (true)
+      {
+         // Read before looking at the ring, a push after the look changes it and the wait falls through
+         uint32_t seen = published.load(std::memory_order_acquire);
+
+         if (ring->popBatch(batch, config.batchSize) > 0)
+         {
+            handle(std::span<DatagramBuffer>(batch.data(), batch.size()));
+            batch.clear();
+            continue;
+         }
+
+         if (!workersRunning.load(std::memory_order_acquire))
+         {
+            return;
+         }
+         published.wait(seen, std::memory_order_acquire);
+      }
+   }
+
+   // ---------------------------------------------------------
+   // awaitDatagrams
+   // ---------------------------------------------------------
+   void UdpServer::awaitDatagrams(int fd, std::chrono::steady_clock::time_point lastReceived)
+   {
+      serverMetrics.add(Counter::EMPTY_RECEIVES);
+
+      // TIMED already waited in the receive call, the spinning strategies go straight back to it
+      WaitStrategy wait = activeWait.load(std::memory_order_relaxed);
+      if (wait == WaitStrategy::TIMED)
+      {
+         return;
+      }
+
+      if (wait == WaitStrategy::BUSY_POLL ||
+          (wait == WaitStrategy::ADAPTIVE && std::chrono::steady_clock::now() - lastReceived < config.spinFor))
+      {
+         serverMetrics.add(Counter::RECEIVE_SPINS);
+         return;
+      }
+
+#if defined(__linux__)
+      // stop() makes the eventfd readable, nothing else ever does
+      pollfd waits[2] = {{fd, POLLIN, 0}, {wakeFd, POLLIN, 0}};
+      serverMetrics.add(Counter::RECEIVE_WAITS);
+      poll(waits, 2, -1);
+#endif
+   }
+}
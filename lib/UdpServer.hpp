@@ -0,0 +1,206 @@
+#ifndef NET_POOLED_UDP_SERVER_HPP
+#define NET_POOLED_UDP_SERVER_HPP
+
+#include "Socket.hpp"
+#include "HostPort.hpp"
+#include "BufferPool.hpp"
+#include "ConnectionHandler.hpp"
+#include "IoUring.hpp"
+#include "Metrics.hpp"
+#include "Ring.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//!
+//! \file UdpServer.hpp
+//! \brief A Udp server that receives into pooled, runtime sized buffers and
+//!        hands them to a UdpDatagramHandler
+//!
+namespace nettle
+{
+   //!
+   //! \brief How the receive loop waits for datagrams once the socket is drained
+   //!
+   enum class WaitStrategy
+   {
+      TIMED,    //! Block in the receive call up to the socket receive timeout, which also bounds how long stop takes
+      BLOCKING, //! Block in poll on the socket and a wake-up eventfd, no idle CPU and stop returns at once
+      ADAPTIVE, //! Keep receiving without blocking for spinFor after the last datagram, then block as BLOCKING
+      BUSY_POLL //! Never block, receive without blocking in a loop with SO_BUSY_POLL set (50us unless the
+                //! tuning profile sets busyPollUs). Lowest wake-up latency for a whole core
+   };
+
+   //!
+   //! \brief How datagrams are spread over the sockets of a sharded UdpServer
+   //!
+   enum class ShardSteering
+   {
+      KERNEL, //! The kernel's SO_REUSEPORT hash of the address / port 4-tuple
+      FLOW,   //! A BPF program picks the shard from the source address and port, a sender always lands on the same shard
+      CPU     //! A BPF program picks the shard the receiving CPU maps to, pair with shardCpus = {0, 1, ..}
+   };
+
+   //!
+   //! \brief Construction time configuration of a UdpServer
+   //!
+   struct UdpServerConfig
+   {
+      std::size_t batchSize = 32;    //! Most datagrams pulled from the socket per receive call
+      bool gro = false;              //! Ask the kernel to coalesce datagrams (UDP_GRO), split again before delivery
+      std::size_t datagramSize = 0;  //! Bytes per pooled buffer, 0 sizes buffers to the MTU of the listen interface
+      std::size_t pooledBuffers = 0; //! Buffers allocated up front, 0 allocates four batches worth
+      IoEngine engine = IoEngine::POSIX; //! IO_URING receives through a multishot recvmsg into kernel picked buffers
+      TuningProfile tuning;              //! Socket options for the listening socket
+      WaitStrategy wait = WaitStrategy::TIMED;         //! How an idle receive loop waits (POSIX engine on Linux)
+      std::chrono::microseconds spinFor {50};          //! How long ADAPTIVE keeps spinning after traffic
+      std::size_t shards = 0;                          //! SO_REUSEPORT sockets, each received on by its own thread,
+                                                       //! the handler is then called from all of them at once (0 = one socket)
+      std::vector<int> shardCpus;                      //! CPU each shard's thread is pinned to, -1 or absent leaves it unpinned
+      ShardSteering steering = ShardSteering::KERNEL;  //! Which shard a datagram is received on (Linux)
+      std::size_t workerThreads = 0;                   //! Threads handling datagrams the receive threads queue on a ring,
+                                                       //! the handler is then called from all of them at once (0 = on the receive threads)
+      std::size_t ringCapacity = 8192;                 //! Datagrams the ring holds (rounded up to a power of two), the rest are dropped
+   };
+
+   //!
+   //! \brief Largest UDP payload that fits the MTU of the interface owning an address
+   //! \param address Dotted address, the any address uses the largest MTU of any interface
+   //! \returns A typical Ethernet payload if the interface can't be found
+   //!
+   std::size_t mtuPayloadSize(const std::string &address);
+
+   //!
+   //! \class UdpServer
+   //! \brief A Udp server that batches receives into pooled buffers
+   //!
+   class UdpServer : protected Socket
+   {
+   public:
+      //!
+      //! \brief Construct a UdpServer
+      //! \param hostPort Address and port to listen on
+      //! \param datagramHandler Handler given every received datagram
+      //! \param config Receive tuning of the server
+      //! \param errorCb The error callback - Defaults to ErrorSink
+      //!
+      UdpServer(HostPort hostPort,
+                UdpDatagramHandler &datagramHandler,
+                UdpServerConfig config = UdpServerConfig(),
+                std::function<void(SocketError)> errorCb = nettle::ErrorSink);
+
+      //!
+      //! \brief Destructs a server
+      //!
+      ~UdpServer();
+
+      //!
+      //! \brief Start the server
+      //!
+      bool serve();
+
+      //!
+      //! \brief Stop the server
+      //!
+      bool stop();
+
+      //!
+      //! \retval Size of the buffers datagrams are received into
+      //!
+      std::size_t datagramSize() const;
+
+      //!
+      //! \retval The pool datagram buffers are drawn from
+      //!
+      std::shared_ptr<BufferPool> bufferPool() const;
+
+      //!
+      //! \brief The engine receives run on, IO_URING falls back to POSIX when
+      //!        the kernel does not support it
+      //! \note Settled once the server thread starts receiving
+      //!
+      IoEngine ioEngine() const;
+
+      //!
+      //! \brief The wait strategy the receive loop runs, TIMED when the configured
+      //!        one is unavailable (other platforms, the IO_URING engine, no eventfd)
+      //! \note Settled once the server thread starts receiving
+      //!
+      WaitStrategy waitStrategy() const;
+
+      //!
+      //! \brief How datagrams are spread over the shards, KERNEL when the
+      //!        configured program could not be attached
+      //! \note Settled before the handler's serverStarted is called
+      //!
+      ShardSteering steering() const;
+
+      //!
+      //! \brief Which options of the tuning profile took effect on the socket
+      //! \note Settled before the handler's serverStarted is called
+      //!
+      const TuningReport &tuningReport() const;
+
+      //!
+      //! \brief Datagrams, bytes and receive calls of the server, how long the
+      //!        handler took per batch and the errors it reported
+      //!
+      MetricsSnapshot metrics() const;
+
+      //!
+      //! \brief Occupancy of the ring between receive and worker threads
+      //! \retval All zero without worker threads
+      //!
+      RingStats ringStats() const;
+
+   private:
+      Metrics serverMetrics;
+      HostPort hostPort;
+      UdpDatagramHandler &datagramHandler;
+      UdpServerConfig config;
+      std::function<void(SocketError)> errorCb;
+      std::shared_ptr<BufferPool> pool;
+
+      std::atomic<bool> threadRunning;
+      std::mutex threadMut;
+      std::thread serverThread;
+
+      struct Shard
+      {
+         int fd {-1};
+         int cpu {-1};
+      };
+
+      std::vector<Shard> shards;
+      std::atomic<ShardSteering> activeSteering {ShardSteering::KERNEL};
+
+      std::unique_ptr<Ring<DatagramBuffer>> ring;
+      std::atomic<uint32_t> published {0};
+      std::atomic<bool> workersRunning {false};
+
+      static constexpr std::size_t MAX_GRO_RECEIVE = 65535;
+      bool groEnabled {false};
+      std::atomic<IoEngine> activeEngine {IoEngine::POSIX};
+      std::atomic<WaitStrategy> activeWait {WaitStrategy::TIMED};
+      int wakeFd {-1};
+
+      bool openSocket();
+      bool bindShard(int fd);
+      void closeShards();
+      bool attachSteering();
+      bool enableGro(int fd);
+      void receiveBatches(const Shard &shard);
+      bool receiveUring(const Shard &shard, bool kernelTimestamps);
+      void dispatch(std::span<DatagramBuffer> batch);
+      void handle(std::span<DatagramBuffer> batch);
+      void runWorker();
+      void awaitDatagrams(int fd, std::chrono::steady_clock::time_point lastReceived);
+   };
+}
+
+#endif
@@ -4,12 +4,12 @@
 #include "Socket.hpp"
 #include "HostPort.hpp"
 #include "ConnectionHandler.hpp"
+#include "UdpServer.hpp"
 #include <iostream>
 #include <cstring>
 #include <string>
-#include <atomic>
-#include <mutex>
-#include <thread>
+#include <span>
+#include <vector>
 
 //!
 //! \file UdpServerN.hpp
@@ -21,9 +21,11 @@ namespace nettle
    //!
    //! \class UdpServerN
    //! \brief A Udp server that sets up a socket and hands it back to a user to serve
+   //! \note Runs a UdpServer with N byte pooled buffers and adapts its datagrams
+   //!       to the fixed size UdpConnectionHandlerN interface
    //!
    template <std::size_t N>
-   class UdpServerN : protected Socket
+   class UdpServerN : private UdpDatagramHandler
    {
    public:
       //!
@@ -34,24 +36,26 @@ namespace nettle
       //!
       UdpServerN(HostPort hostPort,
                  UdpConnectionHandlerN<N> &connectionHandler,
-                 std::function<void(SocketError)> errorCb = nettle::ErrorSink) : Socket(errorCb),
-                                                                                 hostPort(hostPort),
-                                                                                 connectionHandler(connectionHandler),
-                                                                                 errorCb(errorCb),
-                                                                                 threadRunning(false)
+                 std::function<void(SocketError)> errorCb = nettle::ErrorSink) : UdpServerN(hostPort,
+                                                                                            connectionHandler,
+                                                                                            UdpServerConfig(),
+                                                                                            errorCb)
       {
       }
 
       //!
-      //! \brief Destructs a server
+      //! \brief Construct a UdpServerN from a configuration
+      //! \param hostPort Address and port to listen on
+      //! \param connectionHandler Connection handler class
+      //! \param config Receive tuning of the server, the datagram size is always N
+      //! \param errorCb The error callback - Defaults to ErrorSink
       //!
-      ~UdpServerN()
+      UdpServerN(HostPort hostPort,
+                 UdpConnectionHandlerN<N> &connectionHandler,
+                 UdpServerConfig config,
+                 std::function<void(SocketError)> errorCb = nettle::ErrorSink) : connectionHandler(connectionHandler),
+                                                                                 server(hostPort, *this, fixedSize(config), errorCb)
       {
-
-         this->socketClose();
-#if defined(_MSC_VER)
-         WSACleanup();
-#endif
       }
 
       //!
@@ -59,123 +63,102 @@ namespace nettle
       //!
       bool serve()
       {
-         {
-            std::lock_guard<std::mutex> lock(threadMut);
+         return server.serve();
+      }
 
-            if (threadRunning)
-            {
-               std::cerr << "Thread already started" << std::endl;
-               return false;
-            }
-         }
+      //!
+      //! \brief Stop the server
+      //!
+      bool stop()
+      {
+         return server.stop();
+      }
 
-         threadRunning = true;
+      //!
+      //! \brief Which options of the tuning profile took effect on the socket
+      //! \note Settled before the handler's serverStarted is called
+      //!
+      const TuningReport &tuningReport() const
+      {
+         return server.tuningReport();
+      }
 
-         serverThread = std::thread(
-             [](UdpServerN *server)
-             {
+      //!
+      //! \retval The wait strategy the underlying server's receive loop runs
+      //!
+      WaitStrategy waitStrategy() const
+      {
+         return server.waitStrategy();
+      }
 
-#ifdef _MSC_VER
-                WSADATA ws_data;
-                if (WSAStartup(MAKEWORD(2, 0), &ws_data) != 0)
-                {
-                   errorCb(SocketError::WSAStartup);
-                   return;
-                }
-#endif
-                if ((server->socketFd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
-                {
-                   server->errorCb(SocketError::SOCKET_CREATE);
-                   return;
-                }
-
-                memset(&server->sockAddr, 0, sizeof(server->sockAddr));
-                server->sockAddr.sin_family = AF_INET;
-                server->sockAddr.sin_addr.s_addr = inet_addr(server->hostPort.getAddress().c_str());
-                server->sockAddr.sin_port = htons(server->hostPort.getPort());
-
-                if (::bind(server->socketFd, (sockaddr *)&server->sockAddr, sizeof(server->sockAddr)) < 0)
-                {
-                   server->errorCb(SocketError::SOCKET_BIND);
-                   return;
-                }
-
-                if ((server->socketFd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
-                {
-                   server->errorCb(SocketError::SOCKET_CREATE);
-                   return;
-                }
-
-                memset(&server->sockAddr, 0, sizeof(server->sockAddr));
-                server->sockAddr.sin_family = AF_INET;
-                server->sockAddr.sin_addr.s_addr = inet_addr(server->hostPort.getAddress().c_str());
-                server->sockAddr.sin_port = htons(server->hostPort.getPort());
-
-                if (::bind(server->socketFd, (sockaddr *)&server->sockAddr, sizeof(server->sockAddr)) < 0)
-                {
-                   server->errorCb(SocketError::SOCKET_BIND);
-                   return;
-                }
-
-                server->setupSocket(server->socketFd, server->sockAddr);
-
-                while (server->threadRunning)
-                {
-
-                   std::this_thread::sleep_for(std::chrono::milliseconds(1));
-
-                   uint8_t buffer[N];
-
-                   int recvSize = server->socketReadIn(buffer, N);
-
-                   if (recvSize > 0)
-                   {
-                      server->connectionHandler.newData(buffer);
-                   }
-                }
-
-                server->socketClose();
-             } // End func
-             ,
-             this);
-
-         return true;
+      //!
+      //! \retval How the underlying server spreads datagrams over its shards
+      //!
+      ShardSteering steering() const
+      {
+         return server.steering();
       }
 
       //!
-      //! \brief Stop the server
+      //! \retval Counters of the underlying server
       //!
-      bool stop()
+      MetricsSnapshot metrics() const
       {
+         return server.metrics();
+      }
 
-         std::lock_guard<std::mutex> lock(threadMut);
+      //!
+      //! \retval Occupancy of the underlying server's worker ring
+      //!
+      RingStats ringStats() const
+      {
+         return server.ringStats();
+      }
 
-         if (!threadRunning)
-         {
-            std::cerr << "Thread not running" << std::endl;
-            return false;
-         }
+   private:
+      UdpConnectionHandlerN<N> &connectionHandler;
+      UdpServer server;
 
-         threadRunning = false;
+      static UdpServerConfig fixedSize(UdpServerConfig config)
+      {
+         config.datagramSize = N;
+         return config;
+      }
 
-         connectionHandler.serverStopping();
+      void serverStarted() override
+      {
+         connectionHandler.serverStarted();
+      }
 
-         serverThread.join();
+      void serverStopping() override
+      {
+         connectionHandler.serverStopping();
+      }
 
+      void serverStopped() override
+      {
          connectionHandler.serverStopped();
+      }
 
-         return true;
+      void newDatagram(DatagramBuffer &datagram) override
+      {
+         newBatch(std::span<DatagramBuffer>(&datagram, 1));
       }
 
-   private:
-      HostPort hostPort;
-      UdpConnectionHandlerN<N> &connectionHandler;
-      std::function<void(SocketError)> errorCb;
+      void newBatch(std::span<DatagramBuffer> batch) override
+      {
+         // Buffers hold exactly N bytes, so newData's fixed size view stays in bounds.
+         // Shards deliver from several threads at once, each fills its own views
+         thread_local std::vector<Datagram> datagrams;
+         datagrams.clear();
+         for (auto &datagram : batch)
+         {
+            datagrams.push_back(Datagram{datagram.data(), datagram.length, datagram.source});
+         }
 
-      std::atomic<bool> threadRunning;
-      std::mutex threadMut;
-      std::thread serverThread;
+         connectionHandler.newBatch(std::span<const Datagram>(datagrams.data(), datagrams.size()));
+      }
    };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,14 +1,24 @@
 #include "Writer.hpp"
 
+#include <algorithm>
 #include <cstring>
 
+#if defined(__linux__)
+#include <netinet/udp.h>
+#endif
+
 namespace nettle
 {
    // -------------------------------------------------------
    // StdWriter
    // -------------------------------------------------------
 
-   Writer::Writer(HostPort connectionInfo, WriterType connectionType, std::function<void(SocketError)> errorCb) : Socket(errorCb), errorPresent(false)
+   Writer::Writer(HostPort connectionInfo,
+                  WriterType connectionType,
+                  std::function<void(SocketError)> errorCb,
+                  const TuningProfile &tuning) : Socket(errorCb),
+                                                 errorPresent(false),
+                                                 gsoSupport(OffloadSupport::UNKNOWN)
    {
 
 #ifdef _MSC_VER
@@ -43,6 +53,9 @@ namespace nettle
          }
       }
 
+      // Buffers and fast open have to be in place before the handshake
+      this->applyTuning(tuning, (connectionType == WriterType::TCP) ? SocketRole::TCP_CLIENT : SocketRole::UDP);
+
       memset(&serverAddr, 0, sizeof(serverAddr));
       serverAddr.sin_family = AF_INET;
       if (inet_pton(AF_INET, connectionInfo.getAddress().c_str(), &serverAddr.sin_addr) <= 0)
@@ -78,4 +91,236 @@ namespace nettle
 
       return errorPresent;
    }
-}
\ No newline at end of file
+
+   // -------------------------------------------------------
+   // sendBatch
+   // -------------------------------------------------------
+
+   BatchSendResult Writer::sendBatch(std::span<OutboundDatagram> datagrams)
+   {
+      BatchSendResult result;
+
+#if defined(__linux__)
+      // Submitted in fixed size chunks so a batch never allocates
+      constexpr std::size_t CHUNK = 64;
+      mmsghdr messages[CHUNK];
+      iovec iovecs[CHUNK];
+
+      std::size_t index = 0;
+      while (index < datagrams.size())
+      {
+         std::size_t chunk = std::min(CHUNK, datagrams.size() - index);
+
+         for (std::size_t i = 0; i < chunk; i++)
+         {
+            OutboundDatagram &datagram = datagrams[index + i];
+
+            iovecs[i].iov_base = const_cast<void *>(datagram.data);
+            iovecs[i].iov_len = datagram.length;
+
+            memset(&messages[i], 0, sizeof(mmsghdr));
+            messages[i].msg_hdr.msg_iov = &iovecs[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+
+            if (datagram.destination)
+            {
+               messages[i].msg_hdr.msg_name = const_cast<sockaddr_in *>(datagram.destination);
+               messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            }
+         }
+
+         int sent = sendmmsg(this->socketFd, messages, static_cast<unsigned int>(chunk), 0);
+         countOut(0);
+
+         if (sent < 0)
+         {
+            if (errno == EINTR)
+            {
+               continue;
+            }
+
+            // sendmmsg only fails outright on the first datagram of the chunk
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EBADF || errno == ENOTSOCK)
+            {
+               result.error = errno;
+               break;
+            }
+
+            datagrams[index].result = -errno;
+            result.failed++;
+            index++;
+            continue;
+         }
+
+         std::size_t bytes = 0;
+         for (int i = 0; i < sent; i++)
+         {
+            datagrams[index + i].result = static_cast<int>(messages[i].msg_len);
+            bytes += messages[i].msg_len;
+         }
+         countOut(bytes, sent, 0);
+
+         result.sent += sent;
+         index += sent;
+      }
+#else
+      for (auto &datagram : datagrams)
+      {
+         int sent = sendto(this->socketFd,
+                           (const char *)datagram.data,
+                           static_cast<int>(datagram.length),
+                           0,
+                           (const sockaddr *)datagram.destination,
+                           datagram.destination ? sizeof(sockaddr_in) : 0);
+         if (sent < 0)
+         {
+            countOut(0);
+            datagram.result = -errno;
+            result.failed++;
+            continue;
+         }
+
+         countOut(sent, 1);
+
+         datagram.result = sent;
+         result.sent++;
+      }
+#endif
+      return result;
+   }
+
+   // -------------------------------------------------------
+   // sendSegmented
+   // -------------------------------------------------------
+
+   BatchSendResult Writer::sendSegmented(const void *buffer,
+                                         std::size_t length,
+                                         uint16_t segmentSize,
+                                         const sockaddr_in *destination)
+   {
+      const uint8_t *cBuff = static_cast<const uint8_t *>(buffer);
+
+      if (segmentSize == 0)
+      {
+         return BatchSendResult{0, 0, EINVAL};
+      }
+
+#if defined(__linux__) && defined(UDP_SEGMENT)
+      if (gsoSupport == OffloadSupport::UNSUPPORTED)
+      {
+         return sendSegmentsInBatch(cBuff, length, segmentSize, destination);
+      }
+
+      // The kernel caps a single offloaded send at 64 segments within one IP packet
+      constexpr std::size_t MAX_SEGMENTS = 64;
+      constexpr std::size_t MAX_PAYLOAD = 65507;
+
+      std::size_t perSend = std::min(MAX_SEGMENTS, MAX_PAYLOAD / segmentSize) * segmentSize;
+      if (perSend == 0)
+      {
+         return sendSegmentsInBatch(cBuff, length, segmentSize, destination);
+      }
+
+      BatchSendResult result;
+      std::size_t offset = 0;
+
+      while (offset < length)
+      {
+         std::size_t chunk = std::min(perSend, length - offset);
+
+         iovec iov;
+         iov.iov_base = const_cast<uint8_t *>(cBuff + offset);
+         iov.iov_len = chunk;
+
+         char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+
+         msghdr message {};
+         message.msg_iov = &iov;
+         message.msg_iovlen = 1;
+         message.msg_control = control;
+         message.msg_controllen = sizeof(control);
+
+         if (destination)
+         {
+            message.msg_name = const_cast<sockaddr_in *>(destination);
+            message.msg_namelen = sizeof(sockaddr_in);
+         }
+
+         cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+         cmsg->cmsg_level = SOL_UDP;
+         cmsg->cmsg_type = UDP_SEGMENT;
+         cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+         memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(uint16_t));
+
+         ssize_t sent = sendmsg(this->socketFd, &message, 0);
+         countOut((sent > 0) ? sent : 0, (sent > 0) ? (chunk + segmentSize - 1) / segmentSize : 0);
+
+         if (sent < 0)
+         {
+            if (errno == EINTR)
+            {
+               continue;
+            }
+
+            // Old kernels reject the option, devices without checksum offload fail with EIO.
+            // Either way the rest goes out as a regular batch from now on
+            if (errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP || errno == EIO)
+            {
+               gsoSupport = OffloadSupport::UNSUPPORTED;
+
+               BatchSendResult rest = sendSegmentsInBatch(cBuff + offset, length - offset, segmentSize, destination);
+               result.sent += rest.sent;
+               result.failed += rest.failed;
+               result.error = rest.error;
+               return result;
+            }
+
+            result.error = errno;
+            return result;
+         }
+
+         gsoSupport = OffloadSupport::SUPPORTED;
+         result.sent += (chunk + segmentSize - 1) / segmentSize;
+         offset += chunk;
+      }
+
+      return result;
+#else
+      return sendSegmentsInBatch(cBuff, length, segmentSize, destination);
+#endif
+   }
+
+   // -------------------------------------------------------
+   // sendSegmentsInBatch
+   // -------------------------------------------------------
+
+   BatchSendResult Writer::sendSegmentsInBatch(const uint8_t *buffer,
+                                               std::size_t length,
+                                               uint16_t segmentSize,
+                                               const sockaddr_in *destination)
+   {
+      constexpr std::size_t CHUNK = 64;
+      OutboundDatagram segments[CHUNK];
+
+      BatchSendResult result;
+      std::size_t offset = 0;
+
+      while (offset < length && result.error == 0)
+      {
+         std::size_t count = 0;
+         while (count < CHUNK && offset < length)
+         {
+            std::size_t segmentLength = std::min<std::size_t>(segmentSize, length - offset);
+            segments[count++] = OutboundDatagram{buffer + offset, segmentLength, destination};
+            offset += segmentLength;
+         }
+
+         BatchSendResult chunkResult = sendBatch(std::span<OutboundDatagram>(segments, count));
+         result.sent += chunkResult.sent;
+         result.failed += chunkResult.failed;
+         result.error = chunkResult.error;
+      }
+
+      return result;
+   }
+}
@@ -5,6 +5,7 @@
 #include "HostPort.hpp"
 #include <string>
 #include <functional>
+#include <span>
 
 //!
 //! \file Writer.hpp
@@ -21,6 +22,27 @@ namespace nettle
       UDP  //! A UDP writer
    };
 
+   //!
+   //! \brief A datagram handed to Writer::sendBatch
+   //!
+   struct OutboundDatagram
+   {
+      const void *data;                         //! Bytes to send
+      std::size_t length;                       //! Number of bytes to send
+      const sockaddr_in *destination = nullptr; //! Where to send it, nullptr sends to the connected peer
+      int result = 0;                           //! Set by sendBatch - bytes sent, -errno if refused, 0 if never attempted
+   };
+
+   //!
+   //! \brief Outcome of a batch send
+   //!
+   struct BatchSendResult
+   {
+      std::size_t sent = 0;   //! Datagrams accepted by the kernel
+      std::size_t failed = 0; //! Datagrams refused by the kernel, skipped over
+      int error = 0;          //! errno that ended the batch early, 0 if every datagram was attempted
+   };
+
    //!
    //! \class StdWriter
    //! \brief StdWriter creator for TCP and UDP connections
@@ -33,8 +55,12 @@ namespace nettle
       //! \param HostPort Ip and Port information for remote connection
       //! \param WriterType The type of writer to construct (TCP/UDP)
       //! \param errorCb Callback when an error occurs
+      //! \param tuning Socket options set before connecting, see tuningReport for which took effect
       //!
-      Writer(HostPort connectionInfo, WriterType connectionType, std::function<void(SocketError)> errorCb = nettle::ErrorSink);
+      Writer(HostPort connectionInfo,
+             WriterType connectionType,
+             std::function<void(SocketError)> errorCb = nettle::ErrorSink,
+             const TuningProfile &tuning = TuningProfile());
 
       //!
       //! \brief Deconstruct a writer
@@ -46,8 +72,46 @@ namespace nettle
       //!
       bool hasError() const;
 
+      //!
+      //! \brief Send many datagrams with as few syscalls as possible (sendmmsg)
+      //! \param datagrams Datagrams to send, each one's result is filled in
+      //! \returns Counts of sent and refused datagrams. A datagram the kernel refuses
+      //!          is skipped, a socket level error (timeout, bad socket) ends the batch
+      //! \note Intended for UDP writers
+      //!
+      BatchSendResult sendBatch(std::span<OutboundDatagram> datagrams);
+
+      //!
+      //! \brief Send one large buffer as consecutive segmentSize datagrams, letting the
+      //!        kernel do the segmentation (UDP_SEGMENT). Falls back to sendBatch when
+      //!        the kernel or route lacks segmentation offload
+      //! \param buffer Bytes to send
+      //! \param length Number of bytes to send
+      //! \param segmentSize Payload bytes per datagram, the last one may be shorter
+      //! \param destination Where to send it, nullptr sends to the connected peer
+      //! \returns Counts are in datagrams (segments)
+      //! \note Intended for UDP writers
+      //!
+      BatchSendResult sendSegmented(const void *buffer,
+                                    std::size_t length,
+                                    uint16_t segmentSize,
+                                    const sockaddr_in *destination = nullptr);
+
    private:
       bool errorPresent;
+
+      enum class OffloadSupport
+      {
+         UNKNOWN,
+         SUPPORTED,
+         UNSUPPORTED
+      };
+      OffloadSupport gsoSupport;
+
+      BatchSendResult sendSegmentsInBatch(const uint8_t *buffer,
+                                          std::size_t length,
+                                          uint16_t segmentSize,
+                                          const sockaddr_in *destination);
    };
 }
 
@@ -0,0 +1,347 @@
+#include "WriterPool.hpp"
+
+#include <utility>
+
+namespace nettle
+{
+   // -------------------------------------------------------
+   // PooledWriter
+   // -------------------------------------------------------
+
+   PooledWriter::PooledWriter() : pool(nullptr),
+                                  writer(nullptr),
+                                  broken(false)
+   {
+   }
+
+   PooledWriter::PooledWriter(std::shared_ptr<WriterPool> pool, HostPort endpoint, std::unique_ptr<Writer> writer) :
+         pool(std::move(pool)),
+         endpoint(std::move(endpoint)),
+         writer(std::move(writer)),
+         broken(false)
+   {
+   }
+
+   PooledWriter::PooledWriter(PooledWriter &&other) noexcept : pool(std::move(other.pool)),
+                                                               endpoint(std::move(other.endpoint)),
+                                                               writer(std::move(other.writer)),
+                                                               broken(std::exchange(other.broken, false))
+   {
+      other.endpoint.reset();
+   }
+
+   PooledWriter &PooledWriter::operator=(PooledWriter &&other) noexcept
+   {
+      if (this != &other)
+      {
+         release();
+
+         pool = std::move(other.pool);
+         endpoint = std::move(other.endpoint);
+         writer = std::move(other.writer);
+         broken = std::exchange(other.broken, false);
+         other.endpoint.reset();
+      }
+      return *this;
+   }
+
+   // -------------------------------------------------------
+   // ~PooledWriter
+   // -------------------------------------------------------
+
+   PooledWriter::~PooledWriter()
+   {
+      release();
+   }
+
+   Writer &PooledWriter::operator*() const
+   {
+      return *writer;
+   }
+
+   Writer *PooledWriter::operator->() const
+   {
+      return writer.get();
+   }
+
+   void PooledWriter::markBroken()
+   {
+      broken = true;
+   }
+
+   // -------------------------------------------------------
+   // release
+   // -------------------------------------------------------
+
+   void PooledWriter::release()
+   {
+      if (pool && writer)
+      {
+         pool->giveBack(*endpoint, std::move(writer), broken);
+      }
+
+      pool.reset();
+      endpoint.reset();
+      writer.reset();
+      broken = false;
+   }
+
+   PooledWriter::operator bool() const
+   {
+      return writer != nullptr;
+   }
+
+   // -------------------------------------------------------
+   // WriterPool
+   // -------------------------------------------------------
+
+   WriterPool::WriterPool(WriterPoolConfig config, std::function<void(SocketError)> errorCb) : config(config),
+                                                                                              errorCb(std::move(errorCb))
+   {
+   }
+
+   std::shared_ptr<WriterPool> WriterPool::create(WriterPoolConfig config, std::function<void(SocketError)> errorCb)
+   {
+      return std::shared_ptr<WriterPool>(new WriterPool(config, std::move(errorCb)));
+   }
+
+   // -------------------------------------------------------
+   // borrow
+   // -------------------------------------------------------
+
+   PooledWriter WriterPool::borrow(const HostPort &endpoint)
+   {
+      const Clock::time_point deadline = Clock::now() + config.borrowTimeout;
+
+      // Sockets are closed and probed outside the lock, only the bookkeeping happens under it
+      std::vector<Idle> closing;
+      std::unique_lock<std::mutex> lock(mut);
+
+      while (true)
+      {
+         // References into an unordered_map survive rehashing
+         Endpoint &state = endpoints[endpoint];
+         evictExpired(state, Clock::now(), closing);
+
+         if (!state.idle.empty())
+         {
+            std::unique_ptr<Writer> writer = std::move(state.idle.back().writer);
+            state.idle.pop_back();
+
+            lock.unlock();
+            closing.clear();
+
+            if (healthy(*writer))
+            {
+               lock.lock();
+               counters.reused++;
+               return PooledWriter(shared_from_this(), endpoint, std::move(writer));
+            }
+
+            writer.reset();
+
+            lock.lock();
+            state.open--;
+            counters.discarded++;
+            continue;
+         }
+
+         if (state.open < config.maxPerEndpoint)
+         {
+            state.open++;
+            lock.unlock();
+            closing.clear();
+
+            auto writer = std::make_unique<Writer>(endpoint, WriterType::TCP, errorCb);
+
+            lock.lock();
+            if (writer->hasError())
+            {
+               state.open--;
+               returned.notify_one();
+               return PooledWriter();
+            }
+
+            counters.connected++;
+            return PooledWriter(shared_from_this(), endpoint, std::move(writer));
+         }
+
+         if (returned.wait_until(lock, deadline) == std::cv_status::timeout &&
+             state.idle.empty() && state.open >= config.maxPerEndpoint)
+         {
+            return PooledWriter();
+         }
+      }
+   }
+
+   // -------------------------------------------------------
+   // write
+   // -------------------------------------------------------
+
+   IoResult WriterPool::write(const HostPort &endpoint, const void *buffer, std::size_t length)
+   {
+      const uint8_t *cBuff = static_cast<const uint8_t *>(buffer);
+      IoResult result{IoStatus::FAILED, 0, ENOTCONN};
+
+      for (int attempt = 0; attempt < 2; attempt++)
+      {
+         PooledWriter writer = borrow(endpoint);
+         if (!writer)
+         {
+            return IoResult{IoStatus::FAILED, 0, ENOTCONN};
+         }
+
+         std::size_t sent = 0;
+         while (sent < length)
+         {
+            result = writer->writeSome(cBuff + sent, length - sent);
+            sent += result.bytes;
+
+            if (result.status != IoStatus::COMPLETE && result.status != IoStatus::PARTIAL)
+            {
+               break;
+            }
+         }
+
+         if (sent == length)
+         {
+            return IoResult{IoStatus::COMPLETE, sent, 0};
+         }
+
+         writer.markBroken();
+
+         // Bytes already on the wire can't be taken back, replaying them would duplicate data
+         if (sent > 0)
+         {
+            return IoResult{result.status, sent, result.error};
+         }
+      }
+      return result;
+   }
+
+   // -------------------------------------------------------
+   // evictIdle
+   // -------------------------------------------------------
+
+   std::size_t WriterPool::evictIdle()
+   {
+      std::vector<Idle> closing;
+      std::size_t closed = 0;
+      {
+         std::lock_guard<std::mutex> lock(mut);
+
+         Clock::time_point now = Clock::now();
+         for (auto &[endpoint, state] : endpoints)
+         {
+            closed += evictExpired(state, now, closing);
+         }
+      }
+      return closed;
+   }
+
+   // -------------------------------------------------------
+   // idleCount
+   // -------------------------------------------------------
+
+   std::size_t WriterPool::idleCount(const HostPort &endpoint) const
+   {
+      std::lock_guard<std::mutex> lock(mut);
+
+      auto state = endpoints.find(endpoint);
+      return (state == endpoints.end()) ? 0 : state->second.idle.size();
+   }
+
+   // -------------------------------------------------------
+   // stats
+   // -------------------------------------------------------
+
+   WriterPoolStats WriterPool::stats() const
+   {
+      std::lock_guard<std::mutex> lock(mut);
+      return counters;
+   }
+
+   // -------------------------------------------------------
+   // giveBack
+   // -------------------------------------------------------
+
+   void WriterPool::giveBack(const HostPort &endpoint, std::unique_ptr<Writer> writer, bool broken)
+   {
+      {
+         std::lock_guard<std::mutex> lock(mut);
+
+         Endpoint &state = endpoints[endpoint];
+         if (broken || writer->hasError() || !writer->isOpen())
+         {
+            state.open--;
+            counters.discarded++;
+         }
+         else
+         {
+            state.idle.push_back(Idle{std::move(writer), Clock::now()});
+         }
+      }
+
+      // A broken writer is closed here, outside the lock
+      returned.notify_one();
+   }
+
+   // -------------------------------------------------------
+   // evictExpired
+   // -------------------------------------------------------
+
+   std::size_t WriterPool::evictExpired(Endpoint &endpoint, Clock::time_point now, std::vector<Idle> &closing)
+   {
+      // The oldest sit at the front
+      std::size_t expired = 0;
+      while (expired < endpoint.idle.size() && now - endpoint.idle[expired].since >= config.idleTimeout)
+      {
+         expired++;
+      }
+
+      if (expired == 0)
+      {
+         return 0;
+      }
+
+      for (std::size_t i = 0; i < expired; i++)
+      {
+         closing.push_back(std::move(endpoint.idle[i]));
+      }
+      endpoint.idle.erase(endpoint.idle.begin(), endpoint.idle.begin() + expired);
+
+      endpoint.open -= expired;
+      counters.evicted += expired;
+      returned.notify_all();
+      return expired;
+   }
+
+   // -------------------------------------------------------
+   // healthy
+   // -------------------------------------------------------
+
+   bool WriterPool::healthy(Writer &writer)
+   {
+#ifdef _MSC_VER
+      return writer.isOpen();
+#else
+      if (!writer.isOpen())
+      {
+         return false;
+      }
+
+      // A writer's peer has nothing to say; a hang up, reset or stray bytes all mean
+      // the stream can't be trusted any more
+      char probe;
+      while (true)
+      {
+         ssize_t peeked = recv(writer.getSocketFd(), &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+         if (peeked < 0 && errno == EINTR)
+         {
+            continue;
+         }
+         return peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+      }
+#endif
+   }
+}
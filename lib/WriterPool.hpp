@@ -0,0 +1,184 @@
+#ifndef NET_WRITER_POOL_HPP
+#define NET_WRITER_POOL_HPP
+
+#include "HostPort.hpp"
+#include "Writer.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+//!
+//! \file WriterPool.hpp
+//! \brief Warm TCP connections kept per endpoint and lent out to writers
+//!
+namespace nettle
+{
+   class WriterPool;
+
+   //!
+   //! \brief Limits of a WriterPool
+   //!
+   struct WriterPoolConfig
+   {
+      std::size_t maxPerEndpoint = 8;                 //! Connections open to one endpoint, lent out or idle
+      std::chrono::milliseconds idleTimeout {30000};  //! Idle connections older than this are closed
+      std::chrono::milliseconds borrowTimeout {5000}; //! Longest borrow waits for a connection when at the maximum
+   };
+
+   //!
+   //! \brief Counters of a WriterPool since it was created
+   //!
+   struct WriterPoolStats
+   {
+      std::size_t connected = 0; //! Connections opened
+      std::size_t reused = 0;    //! Borrows served from an idle connection
+      std::size_t discarded = 0; //! Connections dropped as broken, on return or by the health check
+      std::size_t evicted = 0;   //! Idle connections closed for sitting unused too long
+   };
+
+   //!
+   //! \class PooledWriter
+   //! \brief A connection lent out by a WriterPool. Move-only, the connection goes
+   //!        back to the pool when the lease is released or destroyed
+   //!
+   class PooledWriter
+   {
+   public:
+      //!
+      //! \brief Construct an empty lease that holds no connection
+      //!
+      PooledWriter();
+
+      PooledWriter(PooledWriter &&other) noexcept;
+      PooledWriter &operator=(PooledWriter &&other) noexcept;
+
+      PooledWriter(const PooledWriter &) = delete;
+      PooledWriter &operator=(const PooledWriter &) = delete;
+
+      //!
+      //! \brief Returns the connection to its pool
+      //!
+      ~PooledWriter();
+
+      Writer &operator*() const;
+      Writer *operator->() const;
+
+      //!
+      //! \brief Have the connection closed instead of reused once returned
+      //! \note Call when the stream is left in an unknown state, e.g. after a failed write
+      //!
+      void markBroken();
+
+      //!
+      //! \brief Hand the connection back to the pool early
+      //! \post The lease is empty
+      //!
+      void release();
+
+      //!
+      //! \retval true iff the lease holds a connection
+      //!
+      explicit operator bool() const;
+
+   private:
+      friend class WriterPool;
+
+      PooledWriter(std::shared_ptr<WriterPool> pool, HostPort endpoint, std::unique_ptr<Writer> writer);
+
+      std::shared_ptr<WriterPool> pool;
+      std::optional<HostPort> endpoint;
+      std::unique_ptr<Writer> writer;
+      bool broken;
+   };
+
+   //!
+   //! \class WriterPool
+   //! \brief Thread safe pool of connected TCP writers keyed by endpoint. Saves
+   //!        the handshake (and the TIME_WAIT left behind) of a Writer per message
+   //!
+   class WriterPool : public std::enable_shared_from_this<WriterPool>
+   {
+   public:
+      //!
+      //! \brief Create a pool
+      //! \param config Limits of the pool
+      //! \param errorCb Callback for errors of the connections it opens - Defaults to ErrorSink
+      //!
+      static std::shared_ptr<WriterPool> create(WriterPoolConfig config = WriterPoolConfig(),
+                                                std::function<void(SocketError)> errorCb = ErrorSink);
+
+      //!
+      //! \brief Lend out a connection to the endpoint, the most recently returned
+      //!        idle one if it is still healthy, a new one otherwise
+      //! \note Blocks for up to borrowTimeout while the endpoint is at its maximum
+      //! \returns An empty lease if no connection could be made or freed up in time
+      //!
+      PooledWriter borrow(const HostPort &endpoint);
+
+      //!
+      //! \brief Write the whole buffer over a pooled connection
+      //! \returns COMPLETE, or how the write ended. A connection that fails before
+      //!          taking any bytes is replaced and the write retried once, a
+      //!          connection that fails part way through is dropped and not retried
+      //!
+      IoResult write(const HostPort &endpoint, const void *buffer, std::size_t length);
+
+      //!
+      //! \brief Close every idle connection past the idle timeout
+      //! \returns Number of connections closed
+      //! \note Borrowing sweeps the borrowed endpoint, call this to sweep them all
+      //!
+      std::size_t evictIdle();
+
+      //!
+      //! \retval Connections to the endpoint sitting idle in the pool
+      //!
+      std::size_t idleCount(const HostPort &endpoint) const;
+
+      //!
+      //! \retval Counters since creation
+      //!
+      WriterPoolStats stats() const;
+
+   private:
+      friend class PooledWriter;
+
+      using Clock = std::chrono::steady_clock;
+
+      struct Idle
+      {
+         std::unique_ptr<Writer> writer;
+         Clock::time_point since;
+      };
+
+      struct Endpoint
+      {
+         std::vector<Idle> idle; // Most recently returned last
+         std::size_t open = 0;   // Idle, lent out, or being connected
+      };
+
+      WriterPool(WriterPoolConfig config, std::function<void(SocketError)> errorCb);
+
+      void giveBack(const HostPort &endpoint, std::unique_ptr<Writer> writer, bool broken);
+      std::size_t evictExpired(Endpoint &endpoint, Clock::time_point now, std::vector<Idle> &closing);
+
+      static bool healthy(Writer &writer);
+
+      WriterPoolConfig config;
+      std::function<void(SocketError)> errorCb;
+
+      mutable std::mutex mut;
+      std::condition_variable returned;
+      std::unordered_map<HostPort, Endpoint> endpoints;
+      WriterPoolStats counters;
+   };
+}
+
+#endif
@@ -1,11 +1,28 @@
+#include <atomic>
+#include <future>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+#include <netinet/tcp.h>
 #include <lib/Writer.hpp>
 
+#include "Async.hpp"
+#include "AsyncWriter.hpp"
 #include "HostPort.hpp"
+#include "IoUring.hpp"
+#include "Metrics.hpp"
+#include "Ring.hpp"
 #include "Socket.hpp"
 #include "TcpServer.hpp"
+#include "TimerWheel.hpp"
+#include "UdpServer.hpp"
 #include "UdpServerN.hpp"
+#include "WriterPool.hpp"
 #include "ConnectionHandler.hpp"
+#include "Framing.hpp"
 
 #include "CppUTest/TestHarness.h"
 
@@ -14,6 +31,33 @@ namespace
     constexpr int MAX_TRYS               = 100;
     constexpr int TCP_TEST_PORT          = 8009;
     constexpr int UDP_TEST_PORT          = 8001;
+    constexpr int TCP_EVENT_TEST_PORT    = 8010;
+    constexpr int TCP_POOL_TEST_PORT     = 8011;
+    constexpr int TCP_SHARD_TEST_PORT    = 8012;
+    constexpr int TCP_VECTOR_TEST_PORT   = 8013;
+    constexpr int TCP_SPLICE_TEST_PORT   = 8014;
+    constexpr int TCP_ZEROCOPY_TEST_PORT = 8015;
+    constexpr int TCP_NONBLOCK_TEST_PORT = 8016;
+    constexpr int TCP_URING_TEST_PORT_A  = 8017;
+    constexpr int TCP_URING_TEST_PORT_B  = 8018;
+    constexpr int TCP_COROUTINE_TEST_PORT = 8019;
+    constexpr int TCP_FRAMING_TEST_PORT  = 8020;
+    constexpr int TCP_WRITER_POOL_TEST_PORT = 8021;
+    constexpr int TCP_ASYNC_WRITER_TEST_PORT = 8022;
+    constexpr int TCP_TUNING_TEST_PORT   = 8023;
+    constexpr int TCP_IDLE_TEST_PORT     = 8024;
+    constexpr int TCP_METRICS_TEST_PORT  = 8025;
+    constexpr int TCP_ACCEPT_TEST_PORT   = 8026;
+    constexpr int UDP_BATCH_TEST_PORT    = 8002;
+    constexpr int UDP_SEND_TEST_PORT_A   = 8003;
+    constexpr int UDP_SEND_TEST_PORT_B   = 8004;
+    constexpr int UDP_GSO_TEST_PORT      = 8005;
+    constexpr int UDP_POOL_TEST_PORT     = 8006;
+    constexpr int UDP_URING_TEST_PORT    = 8007;
+    constexpr int UDP_WAIT_TEST_PORT     = 8008;
+    constexpr int UDP_SHARD_TEST_PORT    = 8027;
+    constexpr int UDP_RING_TEST_PORT     = 8028;
+    constexpr int TCP_KEEP_TEST_PORT     = 8029;
 
     // -----------------------------------------------------------------------------------------------------------------
 
@@ -67,82 +111,1896 @@ namespace
 
     // -----------------------------------------------------------------------------------------------------------------
 
+    class EventConnectionHandler : public nettle::TcpConnectionHandler {
+
+    public:
+        EventConnectionHandler() : bytes(0), closed(0) {
+
+        }
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newConnection(nettle::Socket connection) override { }
+
+        bool connectionReady(nettle::Socket &connection) override {
+
+            // Messages are 10 bytes, one split over two wake-ups counts once it is complete
+            char buffer[10];
+            nettle::IoResult read = connection.readSome(buffer, sizeof(buffer));
+            bytes += read.bytes;
+
+            return read.status != nettle::IoStatus::CLOSED && read.status != nettle::IoStatus::FAILED;
+        }
+
+        void connectionClosed(nettle::Socket &connection) override {
+
+            closed++;
+        }
+
+        int messagesReceived() const {
+
+            return static_cast<int>(bytes.load() / 10);
+        }
+
+        int connectionsClosed() const {
+
+            return closed.load();
+        }
+
+    private:
+        std::atomic<std::size_t> bytes;
+        std::atomic<int> closed;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    class BlockingConnectionHandler : public nettle::TcpConnectionHandler {
+
+    public:
+        BlockingConnectionHandler() : released(false), handled(0) {
+
+        }
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newConnection(nettle::Socket connection) override {
+
+            while(!released.load()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            handled++;
+        }
+
+        void release() {
+
+            released.store(true);
+        }
+
+        int connectionsHandled() const {
+
+            return handled.load();
+        }
+
+    private:
+        std::atomic<bool> released;
+        std::atomic<int> handled;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    class FramedConnectionHandler : public nettle::TcpConnectionHandler {
+
+    public:
+        FramedConnectionHandler() : bodyMatches(false), done(false) {
+
+        }
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newConnection(nettle::Socket connection) override {
+
+            uint32_t bodySize = 0;
+            char tag[4];
+
+            iovec header[] = {{tag, sizeof(tag)}, {&bodySize, sizeof(bodySize)}};
+            if(connection.socketReadInv(header) != sizeof(tag) + sizeof(bodySize)) {
+                done = true;
+                return;
+            }
+
+            std::vector<uint8_t> body(bodySize);
+            iovec payload[] = {{body.data(), body.size()}};
+            int got = connection.socketReadInv(payload);
+
+            bool matches = (got == static_cast<int>(bodySize)) && memcmp(tag, "BODY", 4) == 0;
+            for(std::size_t i = 0; matches && i < body.size(); i++) {
+                matches = body[i] == static_cast<uint8_t>(i);
+            }
+
+            bodyMatches = matches;
+            done = true;
+        }
+
+        bool finished() const {
+
+            return done.load();
+        }
+
+        bool receivedIntactBody() const {
+
+            return bodyMatches.load();
+        }
+
+    private:
+        std::atomic<bool> bodyMatches;
+        std::atomic<bool> done;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    class RelayConnectionHandler : public nettle::TcpConnectionHandler {
+
+    public:
+        RelayConnectionHandler(int fileFd) : fileFd(fileFd) {
+
+        }
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        // 'F' sends the file back, 'E' echoes the bytes that follow, neither touches user memory
+        void newConnection(nettle::Socket connection) override {
+
+            char command;
+            uint32_t size;
+            iovec request[] = {{&command, 1}, {&size, sizeof(size)}};
+            if(connection.socketReadInv(request) != 1 + sizeof(size)) {
+                return;
+            }
+
+            nettle::IoResult result = (command == 'F') ? connection.socketSendFile(fileFd, 0, size)
+                                                       : connection.socketSpliceTo(connection, size);
+            if(result.status != nettle::IoStatus::COMPLETE || result.bytes != size) {
+                std::cout << "Relay ended early after " << result.bytes << " bytes" << std::endl;
+            }
+        }
+
+    private:
+        int fileFd;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    class GatedConnectionHandler : public nettle::TcpConnectionHandler {
+
+    public:
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        // Replies once told to, then holds the connection without reading until released
+        void newConnection(nettle::Socket connection) override {
+
+            reply.get_future().wait();
+            connection.socketWriteOut("pong", 4);
+            release.get_future().wait();
+        }
+
+        std::promise<void> reply;
+        std::promise<void> release;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    // Echoes length prefixed frames back as newline delimited ones, a buffered batch per write
+    class FrameEchoHandler : public nettle::TcpConnectionHandler {
+
+    public:
+        FrameEchoHandler() : frames(0), done(false) {
+
+        }
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newConnection(nettle::Socket connection) override {
+
+            nettle::FrameReader reader(connection, nettle::FrameFormat::lengthPrefixed(), 1024);
+            nettle::FrameWriter writer(connection, nettle::FrameFormat::delimited("\n"));
+
+            nettle::FrameResult result = reader.next();
+            while(result.status == nettle::IoStatus::COMPLETE) {
+
+                do {
+                    writer.queue(result.frame);
+                    frames++;
+                    result = reader.tryNext();
+                } while(result.status == nettle::IoStatus::COMPLETE);
+
+                if(writer.flush().status != nettle::IoStatus::COMPLETE) {
+                    break;
+                }
+                result = reader.next();
+            }
+            done = true;
+        }
+
+        bool finished() const {
+
+            return done.load();
+        }
+
+        int framesEchoed() const {
+
+            return frames.load();
+        }
+
+    private:
+        std::atomic<int> frames;
+        std::atomic<bool> done;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    // Reads until the peer hangs up, counting the bytes
+    class DrainConnectionHandler : public nettle::TcpConnectionHandler {
+
+    public:
+        DrainConnectionHandler() : bytes(0), done(false) {
+
+        }
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newConnection(nettle::Socket connection) override {
+
+            char buffer[16 * 1024];
+            nettle::IoResult result = connection.readSome(buffer, sizeof(buffer));
+            while(result.bytes > 0) {
+                bytes += result.bytes;
+                result = connection.readSome(buffer, sizeof(buffer));
+            }
+            done = true;
+        }
+
+        bool finished() const {
+
+            return done.load();
+        }
+
+        std::size_t bytesReceived() const {
+
+            return bytes.load();
+        }
+
+    private:
+        std::atomic<std::size_t> bytes;
+        std::atomic<bool> done;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    // Records whether the server's tuning reached the accepted connection
+    class TuningConnectionHandler : public nettle::TcpConnectionHandler {
+
+    public:
+        TuningConnectionHandler() : noDelay(false), recvTimeoutMs(0), done(false) {
+
+        }
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newConnection(nettle::Socket connection) override {
+
+            int enabled = 0;
+            socklen_t length = sizeof(enabled);
+            getsockopt(connection.getSocketFd(), IPPROTO_TCP, TCP_NODELAY, &enabled, &length);
+
+            // Inherited from the listener, the connection itself is not tuned for it
+            noDelay = connection.tuningReport().find(nettle::SocketOption::NO_DELAY) == nullptr && enabled == 1;
+
+            timeval recv {};
+            length = sizeof(recv);
+            getsockopt(connection.getSocketFd(), SOL_SOCKET, SO_RCVTIMEO, &recv, &length);
+            recvTimeoutMs = recv.tv_sec * 1000 + recv.tv_usec / 1000;
+            done = true;
+        }
+
+        bool finished() const {
+
+            return done.load();
+        }
+
+        bool connectionNoDelay() const {
+
+            return noDelay.load();
+        }
+
+        long connectionRecvTimeoutMs() const {
+
+            return recvTimeoutMs.load();
+        }
+
+    private:
+        std::atomic<bool> noDelay;
+        std::atomic<long> recvTimeoutMs;
+        std::atomic<bool> done;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    class InheritingConnectionHandler : public nettle::TcpConnectionHandler {
+
+    public:
+        InheritingConnectionHandler() : connections(0), inherited(0) {
+
+        }
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newConnection(nettle::Socket connection) override {
+
+            timeval recv {};
+            timeval send {};
+            socklen_t length = sizeof(timeval);
+            getsockopt(connection.getSocketFd(), SOL_SOCKET, SO_RCVTIMEO, &recv, &length);
+            length = sizeof(timeval);
+            getsockopt(connection.getSocketFd(), SOL_SOCKET, SO_SNDTIMEO, &send, &length);
+
+            if (recv.tv_sec == nettle::SOCKET_RECV_TIMEOUT_SEC && send.tv_sec == nettle::SOCKET_SEND_TIMEOUT_SEC) {
+                inherited++;
+            }
+            connections++;
+        }
+
+        int connectionsAccepted() const {
+
+            return connections.load();
+        }
+
+        int connectionsInherited() const {
+
+            return inherited.load();
+        }
+
+    private:
+        std::atomic<int> connections;
+        std::atomic<int> inherited;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    // Moves every connection into a list of its own, to be served once newConnection has returned
+    class KeepingConnectionHandler : public nettle::TcpConnectionHandler {
+
+    public:
+        KeepingConnectionHandler() : kept(0) {
+
+        }
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newConnection(nettle::Socket connection) override {
+
+            std::lock_guard<std::mutex> lock(mutex);
+            connections.push_back(std::move(connection));
+            kept++;
+        }
+
+        int connectionsKept() const {
+
+            return kept.load();
+        }
+
+        nettle::Socket take() {
+
+            std::lock_guard<std::mutex> lock(mutex);
+            nettle::Socket connection(std::move(connections.front()));
+            connections.erase(connections.begin());
+            return connection;
+        }
+
+    private:
+        std::mutex mutex;
+        std::vector<nettle::Socket> connections;
+        std::atomic<int> kept;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
     template <std::size_t N>
     class UdpConenctionHandler : public nettle::UdpConnectionHandlerN<N> {
 
-    public:
-        UdpConenctionHandler() : gotConn(false) {
+    public:
+        UdpConenctionHandler() : gotConn(false) {
+
+        }
+
+        void serverStarted() override  {
+            std::cout << "UDP<" << N << "> Was informed that the server started " << std::endl;
+        }
+
+        void serverStopping() override {
+            std::cout << "UDP<" << N << "> Was informed that the server is stopping " << std::endl;
+        }
+
+        void serverStopped() override  {
+            std::cout << "UDP<" << N << "> Was informed that the server stopped " << std::endl;
+        }
+
+        void newData(uint8_t data[N]) override {
+
+            std::cout << "UDP<" << N << "> got data : " << data << std::endl;
+
+            gotConn = true;
+        }
+
+        bool handlerGotAConnection() const {
+
+            return gotConn;
+        }
+
+    private:
+
+        bool gotConn;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    template <std::size_t N>
+    class UdpBatchHandler : public nettle::UdpConnectionHandlerN<N> {
+
+    public:
+        UdpBatchHandler() : received(0), badSources(0) {
+
+        }
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newData(uint8_t data[N]) override { }
+
+        void newBatch(std::span<const nettle::Datagram> batch) override {
+
+            for(auto &datagram : batch) {
+
+                if(datagram.source.sin_addr.s_addr != inet_addr("127.0.0.1") || datagram.length != 8) {
+                    badSources++;
+                }
+                received++;
+            }
+        }
+
+        int datagramsReceived() const {
+
+            return received.load();
+        }
+
+        int malformedDatagrams() const {
+
+            return badSources.load();
+        }
+
+    private:
+        std::atomic<int> received;
+        std::atomic<int> badSources;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    template <std::size_t N>
+    class ShardRecordingHandler : public nettle::UdpConnectionHandlerN<N> {
+
+    public:
+        ShardRecordingHandler() : received(0) {
+
+        }
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newData(uint8_t data[N]) override { }
+
+        void newBatch(std::span<const nettle::Datagram> batch) override {
+
+            std::lock_guard<std::mutex> lock(mut);
+
+            for(auto &datagram : batch) {
+                receivers[ntohs(datagram.source.sin_port)].insert(std::this_thread::get_id());
+                threads.insert(std::this_thread::get_id());
+            }
+            received += batch.size();
+        }
+
+        int datagramsReceived() const {
+
+            return received.load();
+        }
+
+        // Sources whose datagrams were received on more than one thread
+        int splitSources() const {
+
+            std::lock_guard<std::mutex> lock(mut);
+
+            int split = 0;
+            for(auto &source : receivers) {
+                split += (source.second.size() > 1) ? 1 : 0;
+            }
+            return split;
+        }
+
+        std::size_t receivingThreads() const {
+
+            std::lock_guard<std::mutex> lock(mut);
+            return threads.size();
+        }
+
+    private:
+        std::atomic<int> received;
+        mutable std::mutex mut;
+        std::map<uint16_t, std::set<std::thread::id>> receivers;
+        std::set<std::thread::id> threads;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    template <std::size_t N>
+    class GatedDatagramHandler : public nettle::UdpConnectionHandlerN<N> {
+
+    public:
+        GatedDatagramHandler() : received(0), open(false) {
+
+        }
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newData(uint8_t data[N]) override { }
+
+        void newBatch(std::span<const nettle::Datagram> batch) override {
+
+            // Stands in for a slow handler, nothing is handled until the gate opens
+            while(!open.load()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            received += batch.size();
+        }
+
+        void openGate() {
+
+            open = true;
+        }
+
+        int datagramsReceived() const {
+
+            return received.load();
+        }
+
+    private:
+        std::atomic<int> received;
+        std::atomic<bool> open;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    class RetainingDatagramHandler : public nettle::UdpDatagramHandler {
+
+    public:
+        RetainingDatagramHandler() : received(0) {
+
+        }
+
+        void serverStarted() override { }
+
+        void serverStopping() override { }
+
+        void serverStopped() override { }
+
+        void newDatagram(nettle::DatagramBuffer &datagram) override {
+
+            std::lock_guard<std::mutex> lock(mut);
+
+            // Keep every other datagram past the callback without copying it
+            if(received++ % 2 == 0) {
+                kept.push_back(std::move(datagram));
+            }
+        }
+
+        int datagramsReceived() {
+
+            std::lock_guard<std::mutex> lock(mut);
+            return received;
+        }
+
+        std::vector<nettle::DatagramBuffer> takeKept() {
+
+            std::lock_guard<std::mutex> lock(mut);
+            return std::move(kept);
+        }
+
+    private:
+        std::mutex mut;
+        int received;
+        std::vector<nettle::DatagramBuffer> kept;
+    };
+    // -----------------------------------------------------------------------------------------------------------------
+
+    nettle::Task<void> echoSession(std::unique_ptr<nettle::AsyncSocket> connection) {
+
+        char buffer[256];
+        while(true) {
+            nettle::IoResult read = co_await connection->readSome(buffer, sizeof(buffer));
+            if(read.bytes == 0) {
+                co_return;
+            }
+
+            nettle::IoResult written = co_await connection->write(buffer, read.bytes);
+            if(written.status != nettle::IoStatus::COMPLETE) {
+                co_return;
+            }
+        }
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    nettle::Task<void> acceptLoop(nettle::Executor &executor, nettle::TcpServer &server) {
+
+        while(true) {
+            auto connection = co_await server.accept(executor);
+            if(!connection) {
+                co_return;
+            }
+            executor.spawn(echoSession(std::move(connection)));
+        }
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    nettle::Task<void> echoClient(nettle::Executor &executor, nettle::HostPort hp, int id,
+                                  std::atomic<int> &echoed, std::atomic<int> &remaining) {
+
+        auto connection = co_await nettle::connectAsync(executor, hp);
+        if(connection) {
+            std::string message = "coroutine client " + std::to_string(id);
+            std::string reply(message.size(), '\0');
+
+            nettle::IoResult written = co_await connection->write(message.data(), message.size());
+            nettle::IoResult read = co_await connection->read(reply.data(), reply.size());
+
+            if(written.status == nettle::IoStatus::COMPLETE &&
+               read.status == nettle::IoStatus::COMPLETE && reply == message) {
+                echoed++;
+            }
+        }
+
+        if(--remaining == 0) {
+            executor.stop();
+        }
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+
+    nettle::Task<void> parkedRead(nettle::AsyncSocket &connection, nettle::IoStatus &status) {
+
+        char buffer[16];
+        nettle::IoResult read = co_await connection.readSome(buffer, sizeof(buffer));
+        status = read.status;
+    }
+
+    // Parks a read on a silent connection, then closes the connection under it
+    nettle::Task<void> closeWhileReading(nettle::Executor &executor, nettle::HostPort hp, nettle::IoStatus &status) {
+
+        auto connection = co_await nettle::connectAsync(executor, hp);
+        if(connection) {
+            executor.spawn(parkedRead(*connection, status));
+            co_await executor.yield();
+
+            connection->close();
+            co_await executor.yield();
+        }
+        executor.stop();
+    }
+}
+
+TEST_GROUP(Tcp)
+{
+};
+
+TEST(Tcp, TcpTest)
+{
+    nettle::HostPort hp("127.0.0.1", TCP_TEST_PORT);
+    TestConnectionHandler handler("TcpTest");
+    nettle::TcpServer server(hp, handler);
+
+    CHECK_FALSE_TEXT(server.stop(), "Stopped inactive server?");
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    CHECK_FALSE_TEXT(server.serve(), "Started active server?");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    nettle::Writer writer(hp, nettle::WriterType::TCP);
+
+    if(writer.hasError()) {
+
+        writer.socketClose();
+
+        FAIL("Writer reported an error!");
+    }
+
+    std::string test = "TCP  write";
+
+    writer.socketWriteOut(test.c_str(), test.size());
+
+    writer.socketClose();
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    CHECK_TRUE_TEXT(handler.handlerGotAConenction(), "Handler did not get requested writer connection");
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Tcp, TcpEventLoopTest)
+{
+    constexpr int NUM_WRITERS = 50;
+
+    nettle::HostPort hp("127.0.0.1", TCP_EVENT_TEST_PORT);
+    EventConnectionHandler handler;
+
+    nettle::TcpServerConfig config;
+    config.mode             = nettle::TcpServeMode::EVENT_LOOP;
+    config.eventLoopThreads = 2;
+
+    nettle::TcpServer server(hp, handler, config);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start event loops");
+
+    CHECK_FALSE_TEXT(server.serve(), "Started active server?");
+
+    // Hold every connection open at once so the loops have to multiplex them
+    std::vector<std::unique_ptr<nettle::Writer>> writers;
+    for(int i = 0; i < NUM_WRITERS; i++) {
+
+        writers.push_back(std::make_unique<nettle::Writer>(hp, nettle::WriterType::TCP));
+        CHECK_FALSE_TEXT(writers.back()->hasError(), "Writer reported an error!");
+    }
+
+    std::string test = "EVENT  TCP";
+    for(int round = 0; round < 2; round++) {
+        for(auto &writer : writers) {
+            writer->socketWriteOut(test.c_str(), test.size());
+        }
+    }
+
+    for(int i = 0; i < MAX_TRYS && handler.messagesReceived() < 2 * NUM_WRITERS; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    LONGS_EQUAL(2 * NUM_WRITERS, handler.messagesReceived());
+
+    // Half a message on one connection must not hold up the others sharing its loop
+    writers.front()->socketWriteOut(test.c_str(), 5);
+    for(std::size_t i = 1; i < writers.size(); i++) {
+        writers[i]->socketWriteOut(test.c_str(), test.size());
+    }
+
+    for(int i = 0; i < MAX_TRYS && handler.messagesReceived() < 3 * NUM_WRITERS - 1; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    LONGS_EQUAL(3 * NUM_WRITERS - 1, handler.messagesReceived());
+
+    writers.clear();
+
+    for(int i = 0; i < MAX_TRYS && handler.connectionsClosed() < NUM_WRITERS; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    LONGS_EQUAL(NUM_WRITERS, handler.connectionsClosed());
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Tcp, TcpWorkerPoolRejectTest)
+{
+    nettle::HostPort hp("127.0.0.1", TCP_POOL_TEST_PORT);
+    BlockingConnectionHandler handler;
+
+    nettle::TcpServerConfig config;
+    config.workerThreads        = 1;
+    config.connectionQueueDepth = 1;
+    config.overloadPolicy       = nettle::OverloadPolicy::REJECT;
+
+    nettle::TcpServer server(hp, handler, config);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // One connection parks the only worker, one waits in the queue, the last is turned away
+    std::vector<std::unique_ptr<nettle::Writer>> writers;
+    for(int i = 0; i < 3; i++) {
+
+        writers.push_back(std::make_unique<nettle::Writer>(hp, nettle::WriterType::TCP));
+        CHECK_FALSE_TEXT(writers.back()->hasError(), "Writer reported an error!");
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    char byte;
+    LONGS_EQUAL(0, writers.back()->socketReadIn(&byte, 1));
+
+    handler.release();
+
+    for(int i = 0; i < MAX_TRYS && handler.connectionsHandled() < 2; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    LONGS_EQUAL(2, handler.connectionsHandled());
+
+    writers.clear();
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Tcp, TcpShardedAcceptTest)
+{
+    constexpr std::size_t NUM_SHARDS = 4;
+    constexpr int NUM_WRITERS        = 200;
+
+    nettle::HostPort hp("127.0.0.1", TCP_SHARD_TEST_PORT);
+    EventConnectionHandler handler;
+
+    nettle::TcpServerConfig config;
+    config.mode   = nettle::TcpServeMode::EVENT_LOOP;
+    config.shards = NUM_SHARDS;
+
+    nettle::TcpServer server(hp, handler, config);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start sharded server");
+
+    std::string test = "SHARD  TCP";
+    for(int i = 0; i < NUM_WRITERS; i++) {
+
+        nettle::Writer writer(hp, nettle::WriterType::TCP);
+        CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+        writer.socketWriteOut(test.c_str(), test.size());
+    }
+
+    for(int i = 0; i < MAX_TRYS && handler.messagesReceived() < NUM_WRITERS; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    LONGS_EQUAL(NUM_WRITERS, handler.messagesReceived());
+
+    auto counts = server.shardAcceptCounts();
+    LONGS_EQUAL(NUM_SHARDS, counts.size());
+
+    uint64_t total = 0;
+    for(auto count : counts) {
+        CHECK_TEXT(count > 0, "Kernel left a shard without connections");
+        total += count;
+    }
+    LONGS_EQUAL(NUM_WRITERS, total);
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Tcp, TcpVectoredIoTest)
+{
+    nettle::HostPort hp("127.0.0.1", TCP_VECTOR_TEST_PORT);
+    FramedConnectionHandler handler;
+    nettle::TcpServer server(hp, handler);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    nettle::Writer writer(hp, nettle::WriterType::TCP);
+    CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+    // Large enough that the kernel takes it in several partial writes
+    std::vector<uint8_t> body(4 * 1024 * 1024);
+    for(std::size_t i = 0; i < body.size(); i++) {
+        body[i] = static_cast<uint8_t>(i);
+    }
+
+    uint32_t bodySize = body.size();
+    char tag[] = "BODY";
+
+    // Header split across two iovecs, body split mid way so partial writes cross boundaries
+    iovec message[] = {{tag, 4},
+                       {&bodySize, sizeof(bodySize)},
+                       {body.data(), body.size() / 3},
+                       {body.data() + body.size() / 3, body.size() - body.size() / 3}};
+
+    LONGS_EQUAL(4 + sizeof(bodySize) + body.size(), writer.socketWriteOutv(message));
+
+    for(int i = 0; i < MAX_TRYS * 10 && !handler.finished(); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    CHECK_TRUE_TEXT(handler.receivedIntactBody(), "Vectored read did not reassemble the body");
+
+    writer.socketClose();
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Tcp, TcpZeroCopyTransferTest)
+{
+    constexpr uint32_t SIZE = 512 * 1024;
+
+    std::vector<uint8_t> content(SIZE);
+    for(std::size_t i = 0; i < content.size(); i++) {
+        content[i] = static_cast<uint8_t>(i * 7);
+    }
+
+    char path[] = "/tmp/nettleSendFileXXXXXX";
+    int fileFd = mkstemp(path);
+    CHECK_TEXT(fileFd >= 0, "Unable to create temp file");
+    unlink(path);
+    LONGS_EQUAL(SIZE, write(fileFd, content.data(), content.size()));
+
+    nettle::HostPort hp("127.0.0.1", TCP_SPLICE_TEST_PORT);
+    RelayConnectionHandler handler(fileFd);
+    nettle::TcpServer server(hp, handler);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    {
+        nettle::Writer writer(hp, nettle::WriterType::TCP);
+        CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+        char command = 'F';
+        uint32_t size = SIZE;
+        iovec request[] = {{&command, 1}, {&size, sizeof(size)}};
+        writer.socketWriteOutv(request);
+
+        std::vector<uint8_t> received(SIZE);
+        LONGS_EQUAL(SIZE, writer.socketReadIn(received.data(), SIZE));
+        CHECK_TEXT(received == content, "sendfile delivered different bytes");
+    }
+
+    {
+        nettle::Writer writer(hp, nettle::WriterType::TCP);
+        CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+        char command = 'E';
+        uint32_t size = SIZE;
+        iovec request[] = {{&command, 1}, {&size, sizeof(size)}, {content.data(), content.size()}};
+
+        // Echoed bytes are read back on another thread so neither side stalls on full buffers
+        std::vector<uint8_t> received(SIZE);
+        int got = 0;
+        std::thread reader([&]() { got = writer.socketReadIn(received.data(), SIZE); });
+
+        writer.socketWriteOutv(request);
+        reader.join();
+
+        LONGS_EQUAL(SIZE, got);
+        CHECK_TEXT(received == content, "splice relay delivered different bytes");
+    }
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+
+    close(fileFd);
+}
+
+TEST(Tcp, TcpZeroCopySendTest)
+{
+    constexpr uint32_t SIZE = 256 * 1024;
+
+    std::vector<uint8_t> content(SIZE);
+    for(std::size_t i = 0; i < content.size(); i++) {
+        content[i] = static_cast<uint8_t>(i * 13);
+    }
+
+    nettle::HostPort hp("127.0.0.1", TCP_ZEROCOPY_TEST_PORT);
+    RelayConnectionHandler handler(-1);
+    nettle::TcpServer server(hp, handler);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    {
+        nettle::Writer writer(hp, nettle::WriterType::TCP);
+        CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+        CHECK_TRUE_TEXT(writer.enableZeroCopy(), "Zero copy not supported");
+
+        char command = 'E';
+        uint32_t size = SIZE;
+        iovec request[] = {{&command, 1}, {&size, sizeof(size)}};
+        writer.socketWriteOutv(request);
+
+        std::vector<uint8_t> received(SIZE);
+        int got = 0;
+        std::thread reader([&]() { got = writer.socketReadIn(received.data(), SIZE); });
+
+        int released = 0;
+        LONGS_EQUAL(SIZE, writer.socketWriteOutZeroCopy(content.data(), SIZE, [&](nettle::ZeroCopyRelease) { released++; }));
+        reader.join();
+
+        // Loopback always ends up copying, the buffer is still only handed back by a completion
+        for(int i = 0; i < 100 && writer.pendingZeroCopy() > 0; i++) {
+            writer.reapZeroCopyCompletions(10);
+        }
+
+        LONGS_EQUAL(1, released);
+        LONGS_EQUAL(0, writer.pendingZeroCopy());
+        LONGS_EQUAL(SIZE, got);
+        CHECK_TEXT(received == content, "zero copy send delivered different bytes");
+    }
+
+    {
+        nettle::Writer writer(hp, nettle::WriterType::TCP);
+        CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+        CHECK_TRUE_TEXT(writer.enableZeroCopy(), "Zero copy not supported");
+
+        // Small writes skip zero copy and are released straight away
+        uint8_t small[64] = {};
+        char command = 'E';
+        uint32_t size = sizeof(small);
+        iovec request[] = {{&command, 1}, {&size, sizeof(size)}};
+        writer.socketWriteOutv(request);
+
+        bool released = false;
+        LONGS_EQUAL(sizeof(small), writer.socketWriteOutZeroCopy(small, sizeof(small), [&](nettle::ZeroCopyRelease how) {
+            released = (how == nettle::ZeroCopyRelease::COPIED);
+        }));
+        CHECK_TRUE(released);
+        LONGS_EQUAL(0, writer.pendingZeroCopy());
+        LONGS_EQUAL(sizeof(small), writer.socketReadIn(small, sizeof(small)));
+    }
+
+    {
+        nettle::Writer writer(hp, nettle::WriterType::TCP);
+        CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+        CHECK_TRUE_TEXT(writer.enableZeroCopy(), "Zero copy not supported");
+
+        char command = 'E';
+        uint32_t size = SIZE;
+        iovec request[] = {{&command, 1}, {&size, sizeof(size)}};
+        writer.socketWriteOutv(request);
+
+        std::vector<uint8_t> received(SIZE);
+        std::thread reader([&]() { writer.socketReadIn(received.data(), SIZE); });
+
+        int released = 0;
+        LONGS_EQUAL(SIZE, writer.socketWriteOutZeroCopy(content.data(), SIZE, [&](nettle::ZeroCopyRelease) { released++; }));
+        reader.join();
+
+        // Closing without reaping hands the buffer back once, confirmed or not, well inside the send timeout
+        auto closing = std::chrono::steady_clock::now();
+        writer.socketClose();
+        CHECK_TRUE(std::chrono::steady_clock::now() - closing < std::chrono::seconds(1));
+
+        LONGS_EQUAL(1, released);
+        LONGS_EQUAL(0, writer.pendingZeroCopy());
+    }
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Tcp, TcpNonBlockingTest)
+{
+    nettle::HostPort hp("127.0.0.1", TCP_NONBLOCK_TEST_PORT);
+    GatedConnectionHandler handler;
+    nettle::TcpServer server(hp, handler);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    nettle::Writer writer(hp, nettle::WriterType::TCP);
+    CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+    CHECK_TRUE(writer.setNonBlocking(true));
+    CHECK_TRUE(writer.isNonBlocking());
+
+    char reply[8];
+    CHECK_TRUE(nettle::IoStatus::WOULD_BLOCK == writer.readSome(reply, sizeof(reply)).status);
+
+    // The server never reads so the send path eventually fills up instead of stalling
+    std::vector<uint8_t> chunk(64 * 1024, 'x');
+    nettle::IoResult sent {nettle::IoStatus::COMPLETE, 0, 0};
+    for(int i = 0; i < 4096 && sent.status == nettle::IoStatus::COMPLETE; i++) {
+        sent = writer.writeSome(chunk.data(), chunk.size());
+    }
+    CHECK_TRUE(sent.status == nettle::IoStatus::PARTIAL || sent.status == nettle::IoStatus::WOULD_BLOCK);
+
+    handler.reply.set_value();
+
+    nettle::IoResult read {nettle::IoStatus::WOULD_BLOCK, 0, 0};
+    for(int i = 0; i < MAX_TRYS && read.status == nettle::IoStatus::WOULD_BLOCK; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        read = writer.readSome(reply, sizeof(reply));
+    }
+    CHECK_TRUE(nettle::IoStatus::PARTIAL == read.status);
+    LONGS_EQUAL(4, read.bytes);
+    MEMCMP_EQUAL("pong", reply, 4);
+
+    handler.release.set_value();
+
+    for(int i = 0; i < MAX_TRYS && read.status != nettle::IoStatus::CLOSED; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        read = writer.readSome(reply, sizeof(reply));
+    }
+    CHECK_TRUE(nettle::IoStatus::CLOSED == read.status);
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Tcp, TcpUringTest)
+{
+    constexpr int NUM_WRITERS = 10;
+
+    nettle::IoEngine expected = nettle::IoUring::supported() ? nettle::IoEngine::IO_URING : nettle::IoEngine::POSIX;
+
+    {
+        nettle::HostPort hp("127.0.0.1", TCP_URING_TEST_PORT_A);
+        EventConnectionHandler handler;
+
+        nettle::TcpServerConfig config;
+        config.mode   = nettle::TcpServeMode::EVENT_LOOP;
+        config.engine = nettle::IoEngine::IO_URING;
+
+        nettle::TcpServer server(hp, handler, config);
+
+        CHECK_TRUE_TEXT(server.serve(), "Unable to start event loops");
+        CHECK_TRUE(expected == server.ioEngine());
+
+        std::vector<std::unique_ptr<nettle::Writer>> writers;
+        for(int i = 0; i < NUM_WRITERS; i++) {
+
+            writers.push_back(std::make_unique<nettle::Writer>(hp, nettle::WriterType::TCP));
+            CHECK_FALSE_TEXT(writers.back()->hasError(), "Writer reported an error!");
+        }
+
+        // Both messages may arrive together, the second must still be picked up
+        std::string test = "URING  TCP";
+        for(auto &writer : writers) {
+            writer->socketWriteOut((test + test).c_str(), 2 * test.size());
+        }
+
+        for(int i = 0; i < MAX_TRYS && handler.messagesReceived() < 2 * NUM_WRITERS; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        LONGS_EQUAL(2 * NUM_WRITERS, handler.messagesReceived());
+
+        writers.clear();
+
+        for(int i = 0; i < MAX_TRYS && handler.connectionsClosed() < NUM_WRITERS; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        LONGS_EQUAL(NUM_WRITERS, handler.connectionsClosed());
+
+        CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+    }
+
+    {
+        nettle::HostPort hp("127.0.0.1", TCP_URING_TEST_PORT_B);
+        FramedConnectionHandler handler;
+
+        nettle::TcpServerConfig config;
+        config.engine = nettle::IoEngine::IO_URING;
+
+        nettle::TcpServer server(hp, handler, config);
+
+        CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+        CHECK_TRUE(expected == server.ioEngine());
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        nettle::Writer writer(hp, nettle::WriterType::TCP);
+        CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+        std::vector<uint8_t> body(1024 * 1024);
+        for(std::size_t i = 0; i < body.size(); i++) {
+            body[i] = static_cast<uint8_t>(i);
+        }
+
+        uint32_t bodySize = body.size();
+        char tag[] = "BODY";
+
+        iovec message[] = {{tag, 4},
+                           {&bodySize, sizeof(bodySize)},
+                           {body.data(), body.size() / 2},
+                           {body.data() + body.size() / 2, body.size() - body.size() / 2}};
+
+        nettle::IoResult sent = writer.socketWriteOutLinked(message);
+        CHECK_TRUE(nettle::IoStatus::COMPLETE == sent.status);
+        LONGS_EQUAL(4 + sizeof(bodySize) + body.size(), sent.bytes);
+
+        for(int i = 0; i < MAX_TRYS * 10 && !handler.finished(); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        CHECK_TRUE_TEXT(handler.receivedIntactBody(), "Linked sends did not deliver the body in order");
+
+        writer.socketClose();
+
+        CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+    }
+}
+
+TEST(Tcp, TcpCoroutineTest)
+{
+    constexpr int NUM_CLIENTS = 50;
+
+    nettle::HostPort hp("127.0.0.1", TCP_COROUTINE_TEST_PORT);
+    GatedConnectionHandler handler;
+    nettle::TcpServer server(hp, handler);
+
+    // Connections are accepted by a coroutine, the server's own threads never start
+    nettle::Executor executor;
+    CHECK_TRUE_TEXT(executor.isOpen(), "Unable to set up executor");
+
+    std::atomic<int> echoed {0};
+    std::atomic<int> remaining {NUM_CLIENTS};
+
+    executor.spawn(acceptLoop(executor, server));
+    for(int i = 0; i < NUM_CLIENTS; i++) {
+        executor.spawn(echoClient(executor, hp, i, echoed, remaining));
+    }
+
+    // Everything, the server side included, runs on this thread until the last client stops it
+    executor.run();
+
+    LONGS_EQUAL(NUM_CLIENTS, echoed.load());
+
+    // Closing a socket resumes the read parked on it instead of leaking it
+    nettle::IoStatus parked = nettle::IoStatus::COMPLETE;
+    executor.spawn(closeWhileReading(executor, hp, parked));
+    executor.run();
+
+    CHECK_TRUE(nettle::IoStatus::CLOSED == parked);
+}
+
+TEST(Tcp, TcpFramingTest)
+{
+    constexpr int NUM_FRAMES = 200;
+
+    nettle::HostPort hp("127.0.0.1", TCP_FRAMING_TEST_PORT);
+    FrameEchoHandler handler;
+    nettle::TcpServer server(hp, handler);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // Sizes vary from empty to well past the server's initial 1KiB receive buffer
+    std::vector<std::string> messages;
+    for(int i = 0; i < NUM_FRAMES; i++) {
+        std::size_t size = (i == NUM_FRAMES / 2) ? 256 * 1024 : (i * 37) % 300;
+        messages.emplace_back(size, static_cast<char>('a' + i % 26));
+    }
+
+    nettle::Writer writer(hp, nettle::WriterType::TCP);
+    CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+    nettle::FrameWriter frameWriter(writer, nettle::FrameFormat::lengthPrefixed());
+    nettle::FrameReader frameReader(writer, nettle::FrameFormat::delimited("\n"));
+
+    // The fixed size format only takes exactly sized frames
+    nettle::FrameWriter fixedWriter(writer, nettle::FrameFormat::fixedSize(8));
+    CHECK_FALSE(fixedWriter.queue(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>("short"), 5)));
+    LONGS_EQUAL(0, fixedWriter.pending());
+
+    int echoed = 0;
+    for(int sent = 0; sent < NUM_FRAMES; ) {
+
+        // Small batches keep both sides' socket buffers from filling while the other writes
+        int batch = std::min(NUM_FRAMES - sent, 16);
+        for(int i = 0; i < batch; i++) {
+            auto &message = messages[sent + i];
+            CHECK_TRUE(frameWriter.queue(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(message.data()),
+                                                                  message.size())));
+        }
+        LONGS_EQUAL(batch, frameWriter.pending());
+        CHECK_TRUE(nettle::IoStatus::COMPLETE == frameWriter.flush().status);
+
+        for(int i = 0; i < batch; i++) {
+            nettle::FrameResult result = frameReader.next();
+            CHECK_TRUE(nettle::IoStatus::COMPLETE == result.status);
+
+            auto &message = messages[sent + i];
+            LONGS_EQUAL(message.size(), result.frame.size());
+            if(memcmp(message.data(), result.frame.data(), message.size()) == 0) {
+                echoed++;
+            }
+        }
+        sent += batch;
+    }
+
+    LONGS_EQUAL(NUM_FRAMES, echoed);
+    LONGS_EQUAL(0, frameReader.buffered());
+
+    // A frame larger than the send buffer stops a non-blocking flush part way, the
+    // rest stays queued and goes out with the next flushes
+    CHECK_TRUE(writer.setNonBlocking(true));
+    std::string large(12 * 1024 * 1024, 'z');
+    CHECK_TRUE(frameWriter.queue(std::span<const uint8_t>(reinterpret_cast<const uint8_t*>(large.data()), large.size())));
+
+    nettle::IoResult flushed = frameWriter.flush();
+    CHECK_TRUE(nettle::IoStatus::PARTIAL == flushed.status);
+    LONGS_EQUAL(1, frameWriter.pending());
+
+    std::size_t flushedBytes = flushed.bytes;
+    nettle::FrameResult echo = frameReader.next();
+    for(int i = 0; i < MAX_TRYS * 100 && echo.status != nettle::IoStatus::COMPLETE; i++) {
+        if(frameWriter.pending() > 0) {
+            flushedBytes += frameWriter.flush().bytes;
+        }
+        echo = frameReader.next();
+        if(echo.status == nettle::IoStatus::WOULD_BLOCK) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    LONGS_EQUAL(4 + large.size(), flushedBytes);
+    LONGS_EQUAL(0, frameWriter.pending());
+    CHECK_TRUE(nettle::IoStatus::COMPLETE == echo.status);
+    LONGS_EQUAL(large.size(), echo.frame.size());
+
+    writer.socketClose();
+
+    for(int i = 0; i < MAX_TRYS && !handler.finished(); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    CHECK_TRUE(handler.finished());
+    LONGS_EQUAL(NUM_FRAMES + 1, handler.framesEchoed());
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Tcp, TcpWriterPoolTest)
+{
+    constexpr int NUM_MESSAGES = 20;
+
+    nettle::HostPort hp("127.0.0.1", TCP_WRITER_POOL_TEST_PORT);
+    std::string test = "POOLED TCP";
+
+    nettle::TcpServerConfig serverConfig;
+    serverConfig.mode = nettle::TcpServeMode::EVENT_LOOP;
+
+    nettle::WriterPoolConfig poolConfig;
+    poolConfig.maxPerEndpoint = 2;
+    poolConfig.idleTimeout    = std::chrono::milliseconds(200);
+    poolConfig.borrowTimeout  = std::chrono::milliseconds(100);
+
+    auto pool = nettle::WriterPool::create(poolConfig);
+
+    {
+        EventConnectionHandler handler;
+        nettle::TcpServer server(hp, handler, serverConfig);
+        CHECK_TRUE_TEXT(server.serve(), "Unable to start server");
+
+        // Every message rides the one warm connection
+        for(int i = 0; i < NUM_MESSAGES; i++) {
+            CHECK_TRUE(nettle::IoStatus::COMPLETE == pool->write(hp, test.c_str(), test.size()).status);
+        }
+
+        for(int i = 0; i < MAX_TRYS && handler.messagesReceived() < NUM_MESSAGES; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        LONGS_EQUAL(NUM_MESSAGES, handler.messagesReceived());
+        LONGS_EQUAL(1, server.shardAcceptCounts().front());
+        LONGS_EQUAL(1, pool->stats().connected);
+        LONGS_EQUAL(NUM_MESSAGES - 1, pool->stats().reused);
+
+        CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+    }
+
+    // The idle connection was hung up on by the old server, the pool notices and reconnects
+    EventConnectionHandler handler;
+    nettle::TcpServer server(hp, handler, serverConfig);
+    CHECK_TRUE_TEXT(server.serve(), "Unable to restart server");
+
+    CHECK_TRUE(nettle::IoStatus::COMPLETE == pool->write(hp, test.c_str(), test.size()).status);
+    LONGS_EQUAL(1, pool->stats().discarded);
+    LONGS_EQUAL(2, pool->stats().connected);
+
+    for(int i = 0; i < MAX_TRYS && handler.messagesReceived() < 1; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    LONGS_EQUAL(1, handler.messagesReceived());
+
+    // The per endpoint maximum holds back a third borrower
+    nettle::PooledWriter first = pool->borrow(hp);
+    nettle::PooledWriter second = pool->borrow(hp);
+    CHECK_TRUE(first);
+    CHECK_TRUE(second);
+    CHECK_FALSE(pool->borrow(hp));
+
+    first.release();
+    second.release();
+    LONGS_EQUAL(2, pool->idleCount(hp));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    LONGS_EQUAL(2, pool->evictIdle());
+    LONGS_EQUAL(0, pool->idleCount(hp));
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Tcp, TcpAsyncWriterTest)
+{
+    constexpr int NUM_PRODUCERS = 4;
+    constexpr int NUM_MESSAGES  = 2000;
+
+    nettle::HostPort hp("127.0.0.1", TCP_ASYNC_WRITER_TEST_PORT);
+    DrainConnectionHandler handler;
+    nettle::TcpServer server(hp, handler);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    nettle::Writer writer(hp, nettle::WriterType::TCP);
+    CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+    std::atomic<int> pressureChanges {0};
+    std::atomic<int> repeatedPressure {0};
+    std::atomic<bool> lastPressure {false};
+
+    nettle::AsyncWriterConfig config;
+    config.flush.maxBytes    = 16 * 1024;
+    config.flush.maxDelay    = std::chrono::milliseconds(2);
+    config.maxBuffered       = 64 * 1024;
+    config.overloadPolicy    = nettle::OverloadPolicy::BLOCK;
+    config.onPressure        = [&](bool pressured) {
+        if (lastPressure.exchange(pressured) == pressured) {
+            repeatedPressure++;
+        }
+        pressureChanges++;
+    };
+
+    std::size_t expected = 0;
+    {
+        nettle::AsyncWriter asyncWriter(writer, config);
+
+        std::string message = "ASYNC  TCP";
+        std::vector<std::thread> producers;
+        for(int p = 0; p < NUM_PRODUCERS; p++) {
+            producers.emplace_back([&asyncWriter, &message]() {
+                for(int i = 0; i < NUM_MESSAGES; i++) {
+                    asyncWriter.enqueue(message.data(), message.size());
+                }
+            });
+        }
+        for(auto &producer : producers) {
+            producer.join();
+        }
+
+        // A gathered message and one that can never fit
+        std::string header = "HEAD";
+        std::string body = "BODY";
+        iovec parts[] = {{header.data(), header.size()}, {body.data(), body.size()}};
+        CHECK_TRUE(asyncWriter.enqueue(parts));
+
+        std::vector<uint8_t> tooLarge(config.maxBuffered + 1);
+        CHECK_FALSE(asyncWriter.enqueue(tooLarge.data(), tooLarge.size()));
+
+        CHECK_TRUE(asyncWriter.flush(std::chrono::milliseconds(5000)));
+        LONGS_EQUAL(0, asyncWriter.buffered());
+        CHECK_FALSE(asyncWriter.hasError());
+
+        nettle::AsyncWriterStats stats = asyncWriter.stats();
+        LONGS_EQUAL(NUM_PRODUCERS * NUM_MESSAGES + 1, stats.messages);
+        LONGS_EQUAL(1, stats.rejected);
+
+        expected = NUM_PRODUCERS * NUM_MESSAGES * message.size() + header.size() + body.size();
+        LONGS_EQUAL(expected, stats.bytes);
+
+        // Coalesced into far fewer sends than messages
+        CHECK_TRUE(stats.flushes < stats.messages / 10);
+    }
+
+    // Pressure is only ever signalled in pairs, raised then cleared, never twice the same way in a row
+    CHECK_TRUE(pressureChanges.load() % 2 == 0);
+    LONGS_EQUAL(0, repeatedPressure.load());
+    CHECK_FALSE(lastPressure.load());
+
+    writer.socketClose();
+
+    for(int i = 0; i < MAX_TRYS && !handler.finished(); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    CHECK_TRUE(handler.finished());
+    LONGS_EQUAL(expected, handler.bytesReceived());
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Tcp, TcpTuningTest)
+{
+    nettle::HostPort hp("127.0.0.1", TCP_TUNING_TEST_PORT);
+    TuningConnectionHandler handler;
+
+    nettle::TcpServerConfig config;
+    config.tuning = nettle::TuningProfile::bulkThroughput();
+    config.tuning.noDelay     = true;
+    config.tuning.fastOpen    = 16;
+    config.tuning.recvTimeout = std::chrono::milliseconds(3500);
+
+    nettle::TcpServer server(hp, handler, config);
+
+    // Listener gets what accepted connections inherit, connections get the rest
+    const nettle::TuningReport &listener = server.tuningReport();
+    CHECK_TRUE(listener.applied(nettle::SocketOption::RECV_BUFFER));
+    CHECK_TRUE(listener.applied(nettle::SocketOption::SEND_BUFFER));
+    CHECK_TRUE(listener.applied(nettle::SocketOption::DEFER_ACCEPT));
+    CHECK_TRUE(listener.find(nettle::SocketOption::RECV_BUFFER)->effective > 0);
+    CHECK_TRUE(listener.applied(nettle::SocketOption::NO_DELAY));
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    nettle::TuningProfile clientTuning = nettle::TuningProfile::lowLatency();
+    clientTuning.recvTimeout = std::chrono::milliseconds(200);
+
+    nettle::Writer writer(hp, nettle::WriterType::TCP, nettle::ErrorSink, clientTuning);
+    CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+    const nettle::TuningReport &client = writer.tuningReport();
+    CHECK_TRUE(client.applied(nettle::SocketOption::NO_DELAY));
+    CHECK_TRUE(client.applied(nettle::SocketOption::QUICK_ACK));
+    CHECK_TRUE(client.applied(nettle::SocketOption::PRIORITY));
+    LONGS_EQUAL(6, client.find(nettle::SocketOption::PRIORITY)->effective);
+
+    // Busy polling past the system default needs CAP_NET_ADMIN, it is attempted either way
+    CHECK_TRUE(client.find(nettle::SocketOption::BUSY_POLL) != nullptr);
+
+    // The profile's receive timeout replaced the five second default
+    char reply[4];
+    auto started = std::chrono::steady_clock::now();
+    nettle::IoResult read = writer.readSome(reply, sizeof(reply));
+    auto waited = std::chrono::steady_clock::now() - started;
+
+    CHECK_TRUE(nettle::IoStatus::TIMEOUT == read.status);
+    CHECK_TRUE(waited < std::chrono::seconds(2));
+
+    // Deferred accept only hands the connection over once data arrives
+    writer.socketWriteOut("tune", 4);
+
+    for(int i = 0; i < MAX_TRYS && !handler.finished(); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    CHECK_TRUE(handler.connectionNoDelay());
+    LONGS_EQUAL(3500, handler.connectionRecvTimeoutMs());
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Tcp, TimerWheelTest)
+{
+    auto start = nettle::TimerWheel::Clock::now();
+    nettle::TimerWheel wheel(std::chrono::milliseconds(1), start);
+
+    // Spread over several levels so firing has to cascade them down
+    std::vector<int> fired;
+    for(int delay : {5000, 3, 300000, 64, 4096, 1}) {
+        wheel.schedule(std::chrono::milliseconds(delay), [&fired, delay] { fired.push_back(delay); }, start);
+    }
+    nettle::TimerId cancelled = wheel.schedule(std::chrono::milliseconds(10), [&fired] { fired.push_back(-1); }, start);
+    nettle::TimerId pushed = wheel.schedule(std::chrono::milliseconds(20), [&fired] { fired.push_back(4000); }, start);
+
+    CHECK_TRUE(wheel.cancel(cancelled));
+    CHECK_FALSE(wheel.cancel(cancelled));
+    CHECK_TRUE(wheel.reschedule(pushed, std::chrono::milliseconds(4000), start));
+    LONGS_EQUAL(7, wheel.size());
+
+    LONGS_EQUAL(0, wheel.advance(start));
+    CHECK_TRUE(wheel.nextDeadline() && *wheel.nextDeadline() <= start + std::chrono::milliseconds(1));
+
+    LONGS_EQUAL(3, wheel.advance(start + std::chrono::milliseconds(100)));
+    LONGS_EQUAL(6, wheel.advance(start + std::chrono::milliseconds(5000)) + 3);
+    LONGS_EQUAL(1, wheel.size());
+    LONGS_EQUAL(1, wheel.advance(start + std::chrono::minutes(10)));
+
+    std::vector<int> expected {1, 3, 64, 4000, 4096, 5000, 300000};
+    CHECK_TRUE(expected == fired);
+    CHECK_FALSE(wheel.nextDeadline());
+}
+
+TEST(Tcp, TcpIdleTimeoutTest)
+{
+    nettle::HostPort hp("127.0.0.1", TCP_IDLE_TEST_PORT);
+    EventConnectionHandler handler;
+
+    nettle::TcpServerConfig config;
+    config.mode        = nettle::TcpServeMode::EVENT_LOOP;
+    config.idleTimeout = std::chrono::milliseconds(200);
+
+    nettle::TcpServer server(hp, handler, config);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start event loops");
+
+    nettle::Writer silent(hp, nettle::WriterType::TCP);
+    nettle::Writer chatty(hp, nettle::WriterType::TCP);
+    CHECK_FALSE_TEXT(silent.hasError(), "Writer reported an error!");
+    CHECK_FALSE_TEXT(chatty.hasError(), "Writer reported an error!");
+
+    // Only the connection that keeps talking outlives the timeout
+    std::string test = "IDLE   TCP";
+    for(int i = 0; i < 8; i++) {
+        chatty.socketWriteOut(test.c_str(), test.size());
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    LONGS_EQUAL(8, handler.messagesReceived());
+    LONGS_EQUAL(1, handler.connectionsClosed());
 
-        }
+    CHECK_TRUE(silent.setNonBlocking(true));
+    char reply[4];
+    CHECK_TRUE(nettle::IoStatus::CLOSED == silent.readSome(reply, sizeof(reply)).status);
 
-        void serverStarted() override  {
-            std::cout << "UDP<" << N << "> Was informed that the server started " << std::endl;
-        }
+    for(int i = 0; i < MAX_TRYS && handler.connectionsClosed() < 2; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
 
-        void serverStopping() override {
-            std::cout << "UDP<" << N << "> Was informed that the server is stopping " << std::endl;
-        }
+    LONGS_EQUAL(2, handler.connectionsClosed());
 
-        void serverStopped() override  {
-            std::cout << "UDP<" << N << "> Was informed that the server stopped " << std::endl;
-        }
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
 
-        void newData(uint8_t data[N]) override {
+TEST(Tcp, TcpMetricsTest)
+{
+    nettle::HostPort hp("127.0.0.1", TCP_METRICS_TEST_PORT);
+    EventConnectionHandler handler;
 
-            std::cout << "UDP<" << N << "> got data : " << data << std::endl;
+    nettle::TcpServerConfig config;
+    config.mode = nettle::TcpServeMode::EVENT_LOOP;
 
-            gotConn = true;
-        }
+    nettle::TcpServer server(hp, handler, config);
 
-        bool handlerGotAConnection() const {
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start event loops");
 
-            return gotConn;
+    {
+        nettle::Writer writer(hp, nettle::WriterType::TCP);
+        CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+        std::string test = "METRIC TCP";
+        writer.socketWriteOut(test.c_str(), test.size());
+        writer.socketWriteOut(test.c_str(), test.size());
+
+        LONGS_EQUAL(20, writer.stats().bytesOut);
+        LONGS_EQUAL(2, writer.stats().syscalls);
+
+        for(int i = 0; i < MAX_TRYS && handler.messagesReceived() < 2; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
         }
+        LONGS_EQUAL(1, server.metrics().activeConnections());
+    }
 
-    private:
+    for(int i = 0; i < MAX_TRYS && handler.connectionsClosed() < 1; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
 
-        bool gotConn;
-    };
+    nettle::MetricsSnapshot snapshot = server.metrics();
+    LONGS_EQUAL(1, snapshot.get(nettle::Counter::ACCEPTS));
+    LONGS_EQUAL(1, snapshot.get(nettle::Counter::CONNECTIONS_OPENED));
+    LONGS_EQUAL(1, snapshot.get(nettle::Counter::CONNECTIONS_CLOSED));
+    LONGS_EQUAL(0, snapshot.activeConnections());
+    LONGS_EQUAL(20, snapshot.get(nettle::Counter::BYTES_IN));
+    CHECK_TRUE(snapshot.get(nettle::Counter::SYSCALLS) >= 3);
+    CHECK_TRUE(snapshot.handlerDuration.count >= 3);
+
+    std::string text = nettle::toText(snapshot);
+    CHECK_TRUE(text.find("nettle_bytes_in_total 20\n") != std::string::npos);
+    CHECK_TRUE(text.find("nettle_handler_duration_us_bucket{le=\"+Inf\"} " + std::to_string(snapshot.handlerDuration.count)) != std::string::npos);
+
+    // Errors reported through the callback are counted by kind
+    nettle::Metrics metrics;
+    auto errorCb = nettle::countingErrors(metrics, [](nettle::SocketError) { });
+    errorCb(nettle::SocketError::SOCKET_WRITE);
+    errorCb(nettle::SocketError::SOCKET_WRITE);
+    LONGS_EQUAL(2, metrics.snapshot().errorCount(nettle::SocketError::SOCKET_WRITE));
+
+    // A duration of exactly 2^i us lands in the bucket labelled le="2^i"
+    for(int us : {1, 2, 3, 4, 5}) {
+        metrics.observe(std::chrono::microseconds(us));
+    }
+    nettle::HistogramSnapshot histogram = metrics.snapshot().handlerDuration;
+    LONGS_EQUAL(1, histogram.buckets[0]);
+    LONGS_EQUAL(1, histogram.buckets[1]);
+    LONGS_EQUAL(2, histogram.buckets[2]);
+    LONGS_EQUAL(1, histogram.buckets[3]);
+    LONGS_EQUAL(4, histogram.quantileUs(0.5));
+    LONGS_EQUAL(8, histogram.quantileUs(1.0));
+    CHECK_TRUE(nettle::toText(metrics.snapshot()).find("nettle_handler_duration_us_bucket{le=\"4\"} 4\n") != std::string::npos);
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
 }
 
-TEST_GROUP(Tcp)
+TEST(Tcp, TcpAcceptBurstTest)
 {
-};
+    nettle::HostPort hp("127.0.0.1", TCP_ACCEPT_TEST_PORT);
+    InheritingConnectionHandler handler;
 
-TEST(Tcp, TcpTest)
-{
-    nettle::HostPort hp("127.0.0.1", TCP_TEST_PORT);
-    TestConnectionHandler handler("TcpTest");
-    nettle::TcpServer server(hp, handler);
+    nettle::TcpServerConfig config;
+    config.shards             = 2;
+    config.maxPendingRequests = 64;
+    config.msSleepBetweenReq  = 200;
 
-    CHECK_FALSE_TEXT(server.stop(), "Stopped inactive server?");
+    nettle::TcpServer server(hp, handler, config);
 
     CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
 
-    CHECK_FALSE_TEXT(server.serve(), "Started active server?");
+    constexpr int BURST = 16;
+    std::vector<std::unique_ptr<nettle::Writer>> writers;
+    auto started = std::chrono::steady_clock::now();
+    for(int i = 0; i < BURST; i++) {
+        writers.push_back(std::make_unique<nettle::Writer>(hp, nettle::WriterType::TCP));
+        CHECK_FALSE_TEXT(writers.back()->hasError(), "Writer reported an error!");
+    }
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for(int i = 0; i < MAX_TRYS && handler.connectionsAccepted() < BURST; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
 
-    nettle::Writer writer(hp, nettle::WriterType::TCP);
+    // One sleep per wake-up instead of per connection, three seconds the old way
+    CHECK_TRUE(std::chrono::steady_clock::now() - started < std::chrono::seconds(2));
+    LONGS_EQUAL(BURST, handler.connectionsAccepted());
 
-    if(writer.hasError()) {
+    // Connections skip setsockopt and still carry the listener's timeouts
+    LONGS_EQUAL(BURST, handler.connectionsInherited());
+    LONGS_EQUAL(BURST, server.metrics().get(nettle::Counter::ACCEPTS));
 
-        writer.socketClose();
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
 
-        FAIL("Writer reported an error!");
+TEST(Tcp, TcpSocketMoveTest)
+{
+    sockaddr_in addr {};
+
+    int first = socket(AF_INET, SOCK_STREAM, 0);
+    nettle::Socket original;
+    CHECK_TRUE(original.setupSocket(first, addr));
+
+    // Construction takes the descriptor over and leaves the source without one
+    nettle::Socket owner(std::move(original));
+    CHECK_TRUE(owner.isOpen());
+    LONGS_EQUAL(first, owner.getSocketFd());
+    CHECK_FALSE(original.isOpen());
+    LONGS_EQUAL(-1, original.getSocketFd());
+
+    // Assignment closes the descriptor the target held before
+    int second = socket(AF_INET, SOCK_STREAM, 0);
+    nettle::Socket target;
+    CHECK_TRUE(target.setupSocket(second, addr));
+    target = std::move(owner);
+    LONGS_EQUAL(first, target.getSocketFd());
+    LONGS_EQUAL(-1, fcntl(second, F_GETFD));
+
+    // Closing or destroying a moved-from socket leaves the new owner's descriptor alone
+    original.socketClose();
+    {
+        nettle::Socket temporary(std::move(target));
+        target = std::move(temporary);
     }
+    CHECK_TRUE(target.isOpen());
+    CHECK_TRUE(fcntl(first, F_GETFD) != -1);
 
-    std::string test = "TCP  write";
+    // A moved-from socket keeps its error callback and can be set up again
+    int third = socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_TRUE(owner.setupSocket(third, addr));
+    CHECK_TRUE(owner.isOpen());
+}
 
-    writer.socketWriteOut(test.c_str(), test.size());
+TEST(Tcp, TcpKeptConnectionTest)
+{
+    nettle::HostPort hp("127.0.0.1", TCP_KEEP_TEST_PORT);
+    KeepingConnectionHandler handler;
 
-    writer.socketClose();
+    std::string test = "KEPT";
+    char reply[4];
 
-    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    nettle::Socket outliving;
+    std::unique_ptr<nettle::Writer> outlivingWriter;
+    {
+        nettle::TcpServer server(hp, handler);
 
-    CHECK_TRUE_TEXT(handler.handlerGotAConenction(), "Handler did not get requested writer connection");
+        CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
 
-    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        nettle::Writer writer(hp, nettle::WriterType::TCP);
+        CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+        for(int i = 0; i < MAX_TRYS && handler.connectionsKept() < 1; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        LONGS_EQUAL(1, handler.connectionsKept());
+
+        // Returning from newConnection doesn't count a kept connection closed
+        LONGS_EQUAL(1, server.metrics().activeConnections());
+
+        nettle::Socket kept = handler.take();
+        LONGS_EQUAL(test.size(), kept.socketWriteOut(test.c_str(), test.size()));
+
+        nettle::IoResult read = writer.readSome(reply, sizeof(reply));
+        CHECK_TRUE(nettle::IoStatus::COMPLETE == read.status);
+        CHECK_TRUE(memcmp(reply, test.c_str(), sizeof(reply)) == 0);
+
+        // Closing it does
+        kept.socketClose();
+        LONGS_EQUAL(1, server.metrics().get(nettle::Counter::CONNECTIONS_CLOSED));
+        LONGS_EQUAL(0, server.metrics().activeConnections());
+
+        outlivingWriter = std::make_unique<nettle::Writer>(hp, nettle::WriterType::TCP);
+        CHECK_FALSE_TEXT(outlivingWriter->hasError(), "Writer reported an error!");
+
+        for(int i = 0; i < MAX_TRYS && handler.connectionsKept() < 2; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        LONGS_EQUAL(2, handler.connectionsKept());
+        outliving = handler.take();
+
+        CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+    }
+
+    // A connection may outlive the server that accepted it
+    LONGS_EQUAL(test.size(), outliving.socketWriteOut(test.c_str(), test.size()));
+
+    nettle::IoResult read = outlivingWriter->readSome(reply, sizeof(reply));
+    CHECK_TRUE(nettle::IoStatus::COMPLETE == read.status);
+    CHECK_TRUE(memcmp(reply, test.c_str(), sizeof(reply)) == 0);
+
+    outliving.socketClose();
 }
 
 TEST_GROUP(Udp)
@@ -188,4 +2046,402 @@ TEST(Udp, UdpTest)
 
 }
 
+TEST(Udp, UdpBatchReceiveTest)
+{
+    constexpr int NUM_DATAGRAMS = 200;
+
+    nettle::HostPort hp("127.0.0.1", UDP_BATCH_TEST_PORT);
+    UdpBatchHandler<64> handler;
+
+    nettle::UdpServerConfig config;
+    config.batchSize = 16;
+
+    nettle::UdpServerN<64> server(hp, handler, config);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    nettle::Writer writer(hp, nettle::WriterType::UDP);
+    CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+    std::string test = "UDP  bat";
+    for(int i = 0; i < NUM_DATAGRAMS; i++) {
+        writer.socketWriteOut(test.c_str(), test.size());
+    }
+
+    for(int i = 0; i < MAX_TRYS && handler.datagramsReceived() < NUM_DATAGRAMS; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    LONGS_EQUAL(NUM_DATAGRAMS, handler.datagramsReceived());
+    LONGS_EQUAL(0, handler.malformedDatagrams());
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Udp, UdpBatchSendTest)
+{
+    constexpr int PER_SERVER = 50;
+
+    nettle::HostPort hpA("127.0.0.1", UDP_SEND_TEST_PORT_A);
+    nettle::HostPort hpB("127.0.0.1", UDP_SEND_TEST_PORT_B);
+    UdpBatchHandler<64> handlerA;
+    UdpBatchHandler<64> handlerB;
+
+    nettle::UdpServerN<64> serverA(hpA, handlerA);
+    nettle::UdpServerN<64> serverB(hpB, handlerB);
+
+    CHECK_TRUE_TEXT(serverA.serve(), "Unable to start server thread");
+    CHECK_TRUE_TEXT(serverB.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    nettle::Writer writer(hpA, nettle::WriterType::UDP);
+    CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+    sockaddr_in addrB {};
+    addrB.sin_family      = AF_INET;
+    addrB.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addrB.sin_port        = htons(UDP_SEND_TEST_PORT_B);
+
+    std::string test = "UDP  snd";
+    std::vector<uint8_t> oversized(70000, 0);
+
+    // Alternate between the connected peer and an explicit destination, with one
+    // datagram the kernel must refuse in the middle of the batch
+    std::vector<nettle::OutboundDatagram> datagrams;
+    for(int i = 0; i < 2 * PER_SERVER; i++) {
+
+        datagrams.push_back({test.c_str(), test.size(), (i % 2) ? &addrB : nullptr});
+
+        if(i == PER_SERVER) {
+            datagrams.push_back({oversized.data(), oversized.size()});
+        }
+    }
+
+    auto result = writer.sendBatch(datagrams);
+
+    LONGS_EQUAL(2 * PER_SERVER, result.sent);
+    LONGS_EQUAL(1, result.failed);
+    LONGS_EQUAL(0, result.error);
+    LONGS_EQUAL(-EMSGSIZE, datagrams[PER_SERVER + 1].result);
+    LONGS_EQUAL(test.size(), datagrams[0].result);
+
+    for(int i = 0; i < MAX_TRYS && (handlerA.datagramsReceived() < PER_SERVER || handlerB.datagramsReceived() < PER_SERVER); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    LONGS_EQUAL(PER_SERVER, handlerA.datagramsReceived());
+    LONGS_EQUAL(PER_SERVER, handlerB.datagramsReceived());
+
+    CHECK_TRUE_TEXT(serverA.stop(), "Unable to stop active server..");
+    CHECK_TRUE_TEXT(serverB.stop(), "Unable to stop active server..");
+}
+
+TEST(Udp, UdpSegmentationOffloadTest)
+{
+    constexpr int NUM_SEGMENTS = 100;
+
+    nettle::HostPort hp("127.0.0.1", UDP_GSO_TEST_PORT);
+    UdpBatchHandler<64> handler;
+
+    nettle::UdpServerConfig config;
+    config.gro = true;
+
+    nettle::UdpServerN<64> server(hp, handler, config);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    nettle::Writer writer(hp, nettle::WriterType::UDP);
+    CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+    // Whether or not the kernel offloads, the receiver must see the segments the sender wrote
+    std::string bulk;
+    for(int i = 0; i < NUM_SEGMENTS; i++) {
+        bulk += "UDP  gso";
+    }
+
+    auto result = writer.sendSegmented(bulk.c_str(), bulk.size(), 8);
+
+    LONGS_EQUAL(NUM_SEGMENTS, result.sent);
+    LONGS_EQUAL(0, result.error);
+
+    for(int i = 0; i < MAX_TRYS && handler.datagramsReceived() < NUM_SEGMENTS; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    LONGS_EQUAL(NUM_SEGMENTS, handler.datagramsReceived());
+    LONGS_EQUAL(0, handler.malformedDatagrams());
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Udp, UdpPooledDatagramTest)
+{
+    constexpr int NUM_DATAGRAMS = 20;
+
+    nettle::HostPort hp("127.0.0.1", UDP_POOL_TEST_PORT);
+    RetainingDatagramHandler handler;
+
+    nettle::UdpServer server(hp, handler);
+
+    // Sized from the loopback MTU at runtime
+    CHECK_TEXT(server.datagramSize() > 1472, "Datagram buffers were not sized to the loopback MTU");
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    nettle::Writer writer(hp, nettle::WriterType::UDP);
+    CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+    auto before = std::chrono::system_clock::now();
+
+    std::string test = "UDP pooled";
+    for(int i = 0; i < NUM_DATAGRAMS; i++) {
+        writer.socketWriteOut(test.c_str(), test.size());
+    }
+
+    for(int i = 0; i < MAX_TRYS && handler.datagramsReceived() < NUM_DATAGRAMS; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    LONGS_EQUAL(NUM_DATAGRAMS, handler.datagramsReceived());
+
+    auto kept = handler.takeKept();
+    LONGS_EQUAL(NUM_DATAGRAMS / 2, kept.size());
+
+    auto pool = server.bufferPool();
+    std::size_t availableWhileHeld = pool->available();
+
+    for(auto &datagram : kept) {
+
+        LONGS_EQUAL(test.size(), datagram.length);
+        MEMCMP_EQUAL(test.c_str(), datagram.data(), test.size());
+        CHECK_EQUAL(inet_addr("127.0.0.1"), datagram.source.sin_addr.s_addr);
+        CHECK_TEXT(datagram.timestamp >= before - std::chrono::seconds(1), "Datagram timestamp is stale");
+    }
+
+    kept.clear();
+
+    LONGS_EQUAL(availableWhileHeld + NUM_DATAGRAMS / 2, pool->available());
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Udp, UdpWaitStrategyTest)
+{
+    constexpr int NUM_DATAGRAMS = 20;
+
+    nettle::HostPort hp("127.0.0.1", UDP_WAIT_TEST_PORT);
+
+    for(auto wait : {nettle::WaitStrategy::BLOCKING, nettle::WaitStrategy::ADAPTIVE, nettle::WaitStrategy::BUSY_POLL}) {
+
+        UdpBatchHandler<64> handler;
+
+        nettle::UdpServerConfig config;
+        config.wait = wait;
+
+        nettle::UdpServerN<64> server(hp, handler, config);
+
+        CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        CHECK_TRUE(wait == server.waitStrategy());
+
+        nettle::Writer writer(hp, nettle::WriterType::UDP);
+        CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+        std::string test = "UDP wait";
+        for(int i = 0; i < NUM_DATAGRAMS; i++) {
+            writer.socketWriteOut(test.c_str(), test.size());
+        }
+
+        for(int i = 0; i < MAX_TRYS && handler.datagramsReceived() < NUM_DATAGRAMS; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        LONGS_EQUAL(NUM_DATAGRAMS, handler.datagramsReceived());
+
+        // Only the busy poller never blocks, every strategy found the socket empty at some point
+        nettle::MetricsSnapshot snapshot = server.metrics();
+        CHECK_TRUE(snapshot.get(nettle::Counter::EMPTY_RECEIVES) > 0);
+        CHECK_EQUAL(wait != nettle::WaitStrategy::BUSY_POLL, snapshot.get(nettle::Counter::RECEIVE_WAITS) > 0);
+        CHECK_EQUAL(wait != nettle::WaitStrategy::BLOCKING, snapshot.get(nettle::Counter::RECEIVE_SPINS) > 0);
+
+        const char *label = (wait == nettle::WaitStrategy::BLOCKING) ? "blocking" :
+                            (wait == nettle::WaitStrategy::ADAPTIVE) ? "adaptive" : "busy_poll";
+        STRCMP_EQUAL(label, snapshot.waitStrategy.c_str());
+        std::string text = nettle::toText(snapshot);
+        CHECK_TRUE(text.find(std::string("nettle_wait_strategy{strategy=\"") + label + "\"} 1\n") != std::string::npos);
+
+        // Nothing waits out the five second receive timeout on the way down
+        auto stopping = std::chrono::steady_clock::now();
+        CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+        CHECK_TRUE(std::chrono::steady_clock::now() - stopping < std::chrono::seconds(1));
+    }
+}
+
+TEST(Udp, UdpShardTest)
+{
+    constexpr int NUM_SENDERS   = 16;
+    constexpr int NUM_DATAGRAMS = 10;
+
+    nettle::HostPort hp("127.0.0.1", UDP_SHARD_TEST_PORT);
+    ShardRecordingHandler<64> handler;
+
+    nettle::UdpServerConfig config;
+    config.shards   = 2;
+    config.steering = nettle::ShardSteering::FLOW;
+
+    nettle::UdpServerN<64> server(hp, handler, config);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK_TRUE(nettle::ShardSteering::FLOW == server.steering());
+
+    std::vector<std::unique_ptr<nettle::Writer>> writers;
+    for(int i = 0; i < NUM_SENDERS; i++) {
+        writers.push_back(std::make_unique<nettle::Writer>(hp, nettle::WriterType::UDP));
+        CHECK_FALSE_TEXT(writers.back()->hasError(), "Writer reported an error!");
+    }
+
+    std::string test = "UDP shrd";
+    for(int i = 0; i < NUM_DATAGRAMS; i++) {
+        for(auto &writer : writers) {
+            writer->socketWriteOut(test.c_str(), test.size());
+        }
+    }
+
+    for(int i = 0; i < MAX_TRYS && handler.datagramsReceived() < NUM_SENDERS * NUM_DATAGRAMS; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    LONGS_EQUAL(NUM_SENDERS * NUM_DATAGRAMS, handler.datagramsReceived());
+
+    // Senders are spread over both shards and each one sticks to its shard
+    LONGS_EQUAL(2, handler.receivingThreads());
+    LONGS_EQUAL(0, handler.splitSources());
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Udp, UdpRingTest)
+{
+    constexpr int NUM_DATAGRAMS = 100;
+
+    nettle::Ring<int> ring(3);
+    LONGS_EQUAL(4, ring.capacity());
+    for(int i = 0; i < 5; i++) {
+        ring.tryPush(int(i));
+    }
+
+    std::vector<int> taken;
+    LONGS_EQUAL(3, ring.popBatch(taken, 3));
+    CHECK_TRUE((std::vector<int> {0, 1, 2}) == taken);
+    LONGS_EQUAL(4, ring.stats().highWater);
+    LONGS_EQUAL(1, ring.stats().dropped);
+
+    nettle::HostPort hp("127.0.0.1", UDP_RING_TEST_PORT);
+    GatedDatagramHandler<64> handler;
+
+    nettle::UdpServerConfig config;
+    config.workerThreads = 2;
+    config.ringCapacity  = 16;
+
+    nettle::UdpServerN<64> server(hp, handler, config);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    nettle::Writer writer(hp, nettle::WriterType::UDP);
+    CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+    // The receive thread keeps draining the socket while both workers are stuck
+    std::string test = "UDP ring";
+    for(int i = 0; i < NUM_DATAGRAMS; i++) {
+        writer.socketWriteOut(test.c_str(), test.size());
+    }
+
+    for(int i = 0; i < MAX_TRYS && server.metrics().get(nettle::Counter::DATAGRAMS_IN) < NUM_DATAGRAMS; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    nettle::RingStats stats = server.ringStats();
+    LONGS_EQUAL(16, stats.capacity);
+    LONGS_EQUAL(16, stats.highWater);
+    CHECK_TRUE(stats.dropped > 0);
+
+    handler.openGate();
+
+    int handled = NUM_DATAGRAMS - static_cast<int>(stats.dropped);
+    for(int i = 0; i < MAX_TRYS && handler.datagramsReceived() < handled; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    LONGS_EQUAL(handled, handler.datagramsReceived());
+    LONGS_EQUAL(stats.dropped, server.metrics().get(nettle::Counter::DATAGRAMS_DROPPED));
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}
+
+TEST(Udp, UdpUringReceiveTest)
+{
+    constexpr int NUM_DATAGRAMS = 20;
+
+    nettle::HostPort hp("127.0.0.1", UDP_URING_TEST_PORT);
+    RetainingDatagramHandler handler;
+
+    nettle::UdpServerConfig config;
+    config.engine = nettle::IoEngine::IO_URING;
+    config.datagramSize = 64;
+
+    nettle::UdpServer server(hp, handler, config);
+
+    CHECK_TRUE_TEXT(server.serve(), "Unable to start server thread");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    nettle::IoEngine expected = nettle::IoUring::supported() ? nettle::IoEngine::IO_URING : nettle::IoEngine::POSIX;
+    CHECK_TRUE(expected == server.ioEngine());
 
+    nettle::Writer writer(hp, nettle::WriterType::UDP);
+    CHECK_FALSE_TEXT(writer.hasError(), "Writer reported an error!");
+
+    std::string test = "UDP uring";
+    for(int i = 0; i < NUM_DATAGRAMS; i++) {
+        writer.socketWriteOut(test.c_str(), test.size());
+    }
+
+    for(int i = 0; i < MAX_TRYS && handler.datagramsReceived() < NUM_DATAGRAMS; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    LONGS_EQUAL(NUM_DATAGRAMS, handler.datagramsReceived());
+
+    for(auto &datagram : handler.takeKept()) {
+
+        LONGS_EQUAL(test.size(), datagram.length);
+        MEMCMP_EQUAL(test.c_str(), datagram.data(), test.size());
+        CHECK_EQUAL(inet_addr("127.0.0.1"), datagram.source.sin_addr.s_addr);
+    }
+
+    // Larger than the buffers: counted, never handed over cut short
+    std::string oversized(200, 'x');
+    writer.socketWriteOut(oversized.c_str(), oversized.size());
+
+    for(int i = 0; i < MAX_TRYS && server.metrics().get(nettle::Counter::DATAGRAMS_TRUNCATED) == 0; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    LONGS_EQUAL(1, server.metrics().get(nettle::Counter::DATAGRAMS_TRUNCATED));
+    LONGS_EQUAL(NUM_DATAGRAMS, handler.datagramsReceived());
+    LONGS_EQUAL(0, server.metrics().get(nettle::Counter::RECEIVE_ERRORS));
+
+    CHECK_TRUE_TEXT(server.stop(), "Unable to stop active server..");
+}